@@ -0,0 +1,100 @@
+#!/usr/bin/python3
+# Checks the log file formats and --convert and --repair against the text log fixture beside this script.
+# usage: logfiles.py victronbtlelogger
+import gzip, os, shutil, struct, subprocess, sys, tempfile
+
+Logger = sys.argv[1]
+Fixture = os.path.join(os.path.dirname(os.path.abspath(__file__)), "victron-CEA5D77BCD81-2026-09.txt")
+Name = "victron-CEA5D77BCD81-2026-09"
+HeaderSize = 16 # VictronLogHeader
+FrameSize = 48 # VictronLogFrame
+Environment = dict(os.environ, TZ="UTC") # the text format holds local time
+Failures = []
+
+def Run(*Arguments):
+    return subprocess.run([Logger] + list(Arguments), stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True, env=Environment)
+def Read(Path):
+    with open(Path, "rb") as f:
+        return f.read()
+def Write(Path, Data):
+    with open(Path, "wb") as f:
+        f.write(Data)
+def Check(Condition, Message):
+    if not Condition:
+        Failures.append(Message)
+# Copies the fixture into a directory of its own, under a different name if the test needs one
+def Fresh(Directory, Filename = Name + ".txt"):
+    os.makedirs(Directory)
+    shutil.copyfile(Fixture, os.path.join(Directory, Filename))
+    return os.path.join(Directory, Filename)
+# Converts a log file and moves the copy into a directory of its own, so it can be converted back
+def Convert(Path, Directory):
+    Result = Run("--convert", Path)
+    Check(Result.returncode == 0, "--convert %s failed: %s" % (os.path.basename(Path), Result.stdout))
+    Converted = [f for f in os.listdir(os.path.dirname(Path)) if f.startswith(Name) and not f.endswith(".idx") and f != os.path.basename(Path)]
+    os.makedirs(Directory)
+    if len(Converted) != 1:
+        Failures.append("--convert %s made %s" % (os.path.basename(Path), Converted))
+        return os.path.join(Directory, "missing")
+    shutil.move(os.path.join(os.path.dirname(Path), Converted[0]), os.path.join(Directory, Converted[0]))
+    return os.path.join(Directory, Converted[0])
+
+Temporary = tempfile.mkdtemp()
+Text = Read(Fixture)
+Lines = Text.splitlines(keepends=True)
+
+# text -> binary -> text gives back the same bytes
+Binary = Convert(Fresh(os.path.join(Temporary, "text")), os.path.join(Temporary, "binary"))
+Check(os.path.getsize(Binary) == HeaderSize + len(Lines) * FrameSize, "the binary file is %d bytes" % os.path.getsize(Binary))
+Check(Read(Convert(Binary, os.path.join(Temporary, "roundtrip"))) == Text, "text -> binary -> text changed the file")
+
+# the index beside the binary file has an entry for each hour, pointing at the first frame written in it
+Index = Read(os.path.join(Temporary, "text", Name + ".bin.idx"))
+Entries = [struct.unpack_from("<qQ", Index, HeaderSize + 16 * n) for n in range((len(Index) - HeaderSize) // 16)]
+Hours = sorted(set(Line[:13] for Line in Lines))
+Check(Index[:8] == b"VictronI", "the index file has no header")
+Check([Offset for Time, Offset in Entries] == [HeaderSize + FrameSize * [Line[:13] for Line in Lines].index(Hour) for Hour in Hours], "the index entries are %s" % Entries)
+
+# a frame cut short at the end is cut off by --repair, and then there is nothing left to repair
+Torn = os.path.join(Temporary, "torn", Name + ".bin")
+os.makedirs(os.path.dirname(Torn))
+Write(Torn, Read(Binary) + Read(Binary)[HeaderSize:HeaderSize + FrameSize // 2])
+Result = Run("--repair", Torn)
+Check((Result.returncode == 0) and (Read(Torn) == Read(Binary)), "--repair didn't cut off the torn frame: %s" % Result.stdout)
+Result = Run("--repair", Torn)
+Check((Result.returncode == 0) and ("Nothing to repair" in Result.stdout), "--repair of a good file: %s" % Result.stdout)
+
+# a frame with a flipped bit fails its checksum and is stepped over, the frames after it are still read
+Flipped = os.path.join(Temporary, "flipped", Name + ".bin")
+os.makedirs(os.path.dirname(Flipped))
+Damaged = bytearray(Read(Binary))
+Damaged[HeaderSize + 2 * FrameSize + 30] ^= 0x10 # in the manufacturer data of the third frame
+Write(Flipped, bytes(Damaged))
+Check(Read(Convert(Flipped, os.path.join(Temporary, "flipped-text"))) == b"".join(Lines[:2] + Lines[3:]), "the damaged frame wasn't the only one left out")
+
+# compressed text and binary files read the same as uncompressed ones
+for Extension in (".txt", ".bin"):
+    Compressed = os.path.join(Temporary, "gz" + Extension, Name + Extension + ".gz")
+    os.makedirs(os.path.dirname(Compressed))
+    Write(Compressed, gzip.compress(Text if Extension == ".txt" else Read(Binary)))
+    Copy = Convert(Compressed, os.path.join(Temporary, "gz" + Extension + "-copy"))
+    if Copy.endswith(".bin"):
+        Copy = Convert(Copy, os.path.join(Temporary, "gz" + Extension + "-text"))
+    Check(Read(Copy) == Text, "reading %s.gz gave different records" % Extension)
+
+# files that aren't named like log files are left alone, and so are text files without one good line
+Keys = os.path.join(Temporary, "keys", "victronencryptionkeys.txt")
+os.makedirs(os.path.dirname(Keys))
+Write(Keys, b"CE:A5:D7:7B:CD:81 D9AB754E122C1234567890252795729F\n")
+Result = Run("--repair", Keys)
+Check((Result.returncode != 0) and (os.path.getsize(Keys) > 0), "--repair of a key file: %s" % Result.stdout)
+Garbage = os.path.join(Temporary, "garbage", Name + ".txt")
+os.makedirs(os.path.dirname(Garbage))
+Write(Garbage, b"not a log file\n")
+Result = Run("--repair", Garbage)
+Check((Result.returncode != 0) and (os.path.getsize(Garbage) > 0), "--repair of a text file without a good line: %s" % Result.stdout)
+
+shutil.rmtree(Temporary)
+for Failure in Failures:
+    print("FAILED: " + Failure)
+sys.exit(1 if Failures else 0)
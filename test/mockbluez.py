@@ -0,0 +1,165 @@
+#!/usr/bin/python3
+# Runs victronbtlelogger against a mock of the BlueZ D-Bus interfaces on a private bus and checks what it did.
+# usage: mockbluez.py victronbtlelogger [--reject-monitor]
+#   The logger is started with --monitor. The mock adapter accepts the advertisement monitor, or with --reject-monitor
+#   answers RegisterMonitor the way BlueZ without --experimental does, so the logger has to fall back to discovery.
+#   Either way the mock sends encrypted SmartLithium advertisements and the logger has to decode them.
+# Exits 77, which ctest reports as skipped, if python-dbus, PyGObject, cryptography or dbus-daemon is missing.
+import os, shutil, signal, subprocess, sys, tempfile
+
+try:
+    import dbus, dbus.service, dbus.mainloop.glib
+    from gi.repository import GLib
+    from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+except ImportError as e:
+    print("skipped: %s" % e)
+    sys.exit(77)
+DBusDaemon = shutil.which("dbus-daemon")
+if DBusDaemon is None:
+    print("skipped: no dbus-daemon")
+    sys.exit(77)
+
+Logger = sys.argv[1]
+RejectMonitor = "--reject-monitor" in sys.argv[2:]
+Adapter = "/org/bluez/hci0"
+Address = "CE:A5:D7:7B:CD:81"
+DevicePath = Adapter + "/dev_" + Address.replace(":", "_")
+Key = bytes.fromhex("D9AB754E122C1234567890252795729F")
+Calls = []
+Monitors = []
+
+def SmartLithium(Nonce):
+    # The fields of record type 0x05, least significant bit first: four cells of 3.30V to 3.33V, 13.30V and 25C
+    Bits = 0
+    def Put(Bit, Width, Value):
+        nonlocal Bits
+        Bits |= (Value & ((1 << Width) - 1)) << Bit
+    for Cell in range(8):
+        Put(48 + 7 * Cell, 7, 70 + Cell if Cell < 4 else 0x7F)
+    Put(104, 12, 1330)
+    Put(120, 7, 65)
+    Plain = Bits.to_bytes(16, "little")
+    IV = bytes([Nonce & 0xFF, Nonce >> 8]) + bytes(14)
+    Encrypted = Cipher(algorithms.AES(Key), modes.CTR(IV)).encryptor().update(Plain)
+    return bytes([0x10, 0xA0, 0xEB, 0xA0, 0x05, Nonce & 0xFF, Nonce >> 8, Key[0]]) + Encrypted
+
+dbus.mainloop.glib.DBusGMainLoop(set_as_default=True)
+Daemon = subprocess.Popen([DBusDaemon, "--session", "--nofork", "--print-address"], stdout=subprocess.PIPE, text=True)
+BusAddress = Daemon.stdout.readline().strip()
+Bus = dbus.bus.BusConnection(BusAddress)
+Name = dbus.service.BusName("org.bluez", Bus)
+
+class Root(dbus.service.Object):
+    @dbus.service.method("org.freedesktop.DBus.ObjectManager", out_signature="a{oa{sa{sv}}}")
+    def GetManagedObjects(self):
+        Calls.append("GetManagedObjects")
+        return {
+            dbus.ObjectPath(Adapter): {"org.bluez.Adapter1": {"Address": "00:1A:7D:DA:71:00", "Powered": dbus.Boolean(True)}},
+            dbus.ObjectPath(DevicePath): {"org.bluez.Device1": {"Address": Address, "Name": "Mock SmartLithium", "RSSI": dbus.Int16(-60)}},
+        }
+
+class MockAdapter(dbus.service.Object):
+    @dbus.service.method("org.freedesktop.DBus.Properties", in_signature="ssv")
+    def Set(self, Interface, Property, Value):
+        Calls.append("Set " + Property)
+    @dbus.service.method("org.bluez.Adapter1", in_signature="a{sv}")
+    def SetDiscoveryFilter(self, Filter):
+        Calls.append("SetDiscoveryFilter")
+    @dbus.service.method("org.bluez.Adapter1")
+    def StartDiscovery(self):
+        Calls.append("StartDiscovery")
+    @dbus.service.method("org.bluez.Adapter1")
+    def StopDiscovery(self):
+        Calls.append("StopDiscovery")
+    @dbus.service.method("org.bluez.Adapter1", in_signature="o")
+    def RemoveDevice(self, Device):
+        Calls.append("RemoveDevice")
+    @dbus.service.method("org.bluez.AdvertisementMonitorManager1", in_signature="o", sender_keyword="Sender")
+    def RegisterMonitor(self, Application, Sender=None):
+        Calls.append("RegisterMonitor")
+        if RejectMonitor:
+            raise dbus.exceptions.DBusException("Method RegisterMonitor not found", name="org.freedesktop.DBus.Error.UnknownMethod")
+        # BlueZ answers first and reads the monitors from the application afterwards
+        GLib.idle_add(ReadMonitors, Sender, Application)
+    @dbus.service.method("org.bluez.AdvertisementMonitorManager1", in_signature="o")
+    def UnregisterMonitor(self, Application):
+        Calls.append("UnregisterMonitor")
+
+def ReadMonitors(Sender, Application):
+    def Found(Objects):
+        for Path, Interfaces in Objects.items():
+            Properties = Interfaces.get("org.bluez.AdvertisementMonitor1", {})
+            Monitors.append((str(Properties.get("Type")), [(int(s), int(t), bytes(c)) for s, t, c in Properties.get("Patterns", [])]))
+            Bus.get_object(Sender, Path).Activate(dbus_interface="org.bluez.AdvertisementMonitor1", reply_handler=lambda: Calls.append("Activate"), error_handler=Failed)
+    def Failed(Error):
+        Calls.append("Error " + str(Error))
+    Bus.get_object(Sender, Application).GetManagedObjects(dbus_interface="org.freedesktop.DBus.ObjectManager", reply_handler=Found, error_handler=Failed)
+    return False
+
+class Device(dbus.service.Object):
+    @dbus.service.signal("org.freedesktop.DBus.Properties", signature="sa{sv}as")
+    def PropertiesChanged(self, Interface, Changed, Invalidated):
+        pass
+
+Root(Bus, "/")
+MockAdapter(Bus, Adapter)
+TheDevice = Device(Bus, DevicePath)
+Nonce = [0x1000]
+def Advertise():
+    Nonce[0] += 1
+    TheDevice.PropertiesChanged("org.bluez.Device1", {"ManufacturerData": dbus.Dictionary({dbus.UInt16(0x02E1): dbus.ByteArray(SmartLithium(Nonce[0]))}, signature="qv"), "RSSI": dbus.Int16(-70)}, [])
+    return True
+
+Directory = tempfile.mkdtemp()
+KeyFile = os.path.join(Directory, "victronencryptionkeys.txt")
+with open(KeyFile, "w") as f:
+    f.write("%s %s\n" % (Address, Key.hex().upper()))
+Output = open(os.path.join(Directory, "output.txt"), "w+")
+Environment = dict(os.environ, DBUS_SYSTEM_BUS_ADDRESS=BusAddress)
+Process = subprocess.Popen([Logger, "-v", "2", "-m", "-k", KeyFile], stdout=Output, stderr=subprocess.STDOUT, env=Environment)
+Loop = GLib.MainLoop()
+def Stop():
+    Process.send_signal(signal.SIGINT)
+    GLib.timeout_add(100, Exited)
+    return False
+def Exited():
+    if Process.poll() is None:
+        return True
+    Loop.quit()
+    return False
+def TimedOut():
+    Process.kill()
+    Loop.quit()
+    return False
+GLib.timeout_add(200, Advertise)
+GLib.timeout_add(3000, Stop)
+GLib.timeout_add(10000, TimedOut)
+Loop.run()
+Daemon.terminate()
+Output.seek(0)
+Text = Output.read()
+shutil.rmtree(Directory)
+
+Failures = []
+def Check(Condition, Message):
+    if not Condition:
+        Failures.append(Message)
+Check(Process.returncode == 0, "logger exit status %s" % Process.returncode)
+Check("RegisterMonitor" in Calls, "the monitor was never registered")
+Check(" (SmartLithium)" in Text, "no SmartLithium advertisement was decoded")
+Check("Battery voltage: 13.3V" in Text, "the decoded battery voltage is wrong")
+if RejectMonitor:
+    Check("StartDiscovery" in Calls, "a rejected monitor didn't fall back to discovery")
+    Check("UnregisterMonitor" not in Calls, "a rejected monitor was unregistered")
+else:
+    Check(Monitors == [("or_patterns", [(0, 0xFF, bytes([0xE1, 0x02]))])], "the monitor isn't one pattern for Victron's company ID: %s" % Monitors)
+    Check("Activate" in Calls, "the monitor didn't answer Activate")
+    Check("StartDiscovery" not in Calls, "discovery was started as well as the monitor")
+    Check("UnregisterMonitor" in Calls, "the monitor wasn't unregistered on exit")
+if Failures:
+    print(Text)
+    print("D-Bus calls: %s" % Calls)
+    for Failure in Failures:
+        print("FAILED: " + Failure)
+    sys.exit(1)
+print("passed: %s" % Calls)
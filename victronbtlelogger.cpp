@@ -23,26 +23,61 @@
 //
 /////////////////////////////////////////////////////////////////////////////
  
+#include <array>
+#include <atomic>
 #include <cfloat>
+#include <chrono>
+#include <condition_variable>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <csignal>
+#include <deque>
 #include <dbus/dbus.h> //  sudo apt install libdbus-1-dev
+#include <endian.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <limits>
 #include <locale>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <openssl/evp.h> // sudo apt install libssl-dev
+#include <poll.h>
 #include <queue>
 #include <regex>
+#include <set>
+#include <string_view>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <thread>
+#include <unordered_map>
 #include <unistd.h>
+#include <utility>
 #include <utime.h>
+#include <variant>
 #include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#endif
+#include <zlib.h>
 #include "wimiso8601.h"
 
 /////////////////////////////////////////////////////////////////////////////
@@ -61,6 +96,28 @@ std::filesystem::path CacheDirectory;	// If this remains empty, cache Files are
 std::filesystem::path SVGDirectory;	// If this remains empty, SVG Files are not created. If it's specified, _day, _week, _month, and _year.svg files are created for each bluetooth address seen.
 bool SVGFahrenheit(true);
 /////////////////////////////////////////////////////////////////////////////
+#ifdef VICTRON_BENCHMARK
+// Only in the benchmark build. Every allocation through operator new is counted, so the advertisement benchmark can show that an advertisement
+// gets from D-Bus to the graph data without one.
+std::atomic<size_t> HeapAllocations(0);
+void* operator new(size_t Size)
+{
+	HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	for (;;)
+	{
+		void* rval(malloc((Size > 0) ? Size : 1));
+		if (rval != nullptr)
+			return(rval);
+		std::new_handler Handler(std::get_new_handler()); // a replacement has to give the handler a chance to free memory before giving up
+		if (Handler == nullptr)
+			throw std::bad_alloc();
+		Handler();
+	}
+}
+void operator delete(void* Memory) noexcept { free(Memory); }
+void operator delete(void* Memory, size_t) noexcept { free(Memory); }
+#endif // VICTRON_BENCHMARK
+/////////////////////////////////////////////////////////////////////////////
 // The following details were taken from https://github.com/oetiker/mrtg
 const size_t DAY_COUNT(600);			/* 400 samples is 33.33 hours */
 const size_t WEEK_COUNT(600);			/* 400 samples is 8.33 days */
@@ -71,15 +128,27 @@ const size_t WEEK_SAMPLE(30 * 60);		/* Sample every 30 minutes */
 const size_t MONTH_SAMPLE(2 * 60 * 60);	/* Sample every 2 hours */
 const size_t YEAR_SAMPLE(24 * 60 * 60);	/* Sample every 24 hours */
 /////////////////////////////////////////////////////////////////////////////
-volatile bool bRun = true; // This is declared volatile so that the compiler won't optimized it out of loops later in the code
+std::atomic<bool> bRun(true); // atomic so the receive thread and the processing thread both see the change
+int ShutdownEvent(-1); // eventfd written by the signal handlers so the receive thread wakes up from epoll_wait()
+void WakeOnShutdown(void)
+{
+	if (ShutdownEvent >= 0)
+	{
+		const uint64_t one(1);
+		if (sizeof(one) != write(ShutdownEvent, &one, sizeof(one)))
+			bRun = false;
+	}
+}
 void SignalHandlerSIGINT(int signal)
 {
 	bRun = false;
+	WakeOnShutdown();
 	std::cerr << "***************** SIGINT: Caught Ctrl-C, finishing loop and quitting. *****************" << std::endl;
 }
 void SignalHandlerSIGHUP(int signal)
 {
 	bRun = false;
+	WakeOnShutdown();
 	std::cerr << "***************** SIGHUP: Caught HangUp, finishing loop and quitting. *****************" << std::endl;
 }
 void SignalHandlerSIGALRM(int signal)
@@ -94,48 +163,177 @@ typedef struct {
 	uint8_t b[6];
 } __attribute__((packed)) bdaddr_t;
 #endif // !__BLUETOOTH_H
+// Addresses are 48 bits, so packed into a uint64_t they compare and hash as a single integer. b[0] is the least significant byte.
+inline uint64_t ba2uint64(const bdaddr_t& TheBlueToothAddress)
+{
+	uint64_t rval(0);
+	memcpy(&rval, TheBlueToothAddress.b, sizeof(TheBlueToothAddress.b));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	rval = __builtin_bswap64(rval);
+#endif
+	return(rval);
+}
 bool operator <(const bdaddr_t& a, const bdaddr_t& b)
 {
-	unsigned long long A = a.b[5];
-	A = A << 8 | a.b[4];
-	A = A << 8 | a.b[3];
-	A = A << 8 | a.b[2];
-	A = A << 8 | a.b[1];
-	A = A << 8 | a.b[0];
-	unsigned long long B = b.b[5];
-	B = B << 8 | b.b[4];
-	B = B << 8 | b.b[3];
-	B = B << 8 | b.b[2];
-	B = B << 8 | b.b[1];
-	B = B << 8 | b.b[0];
-	return(A < B);
+	return(ba2uint64(a) < ba2uint64(b));
 }
 bool operator ==(const bdaddr_t& a, const bdaddr_t& b)
 {
-	unsigned long long A = a.b[5];
-	A = A << 8 | a.b[4];
-	A = A << 8 | a.b[3];
-	A = A << 8 | a.b[2];
-	A = A << 8 | a.b[1];
-	A = A << 8 | a.b[0];
-	unsigned long long B = b.b[5];
-	B = B << 8 | b.b[4];
-	B = B << 8 | b.b[3];
-	B = B << 8 | b.b[2];
-	B = B << 8 | b.b[1];
-	B = B << 8 | b.b[0];
-	return(A == B);
+	return(ba2uint64(a) == ba2uint64(b));
+}
+// Spreads the vendor and device bits of a packed address over the whole word, so neighbouring addresses don't land in neighbouring slots.
+inline size_t bdaddr_hash(uint64_t Key)
+{
+	Key ^= Key >> 31;
+	Key *= 0x7fb5d329728ea185ULL;
+	Key ^= Key >> 27;
+	Key *= 0x81dadef4bc2dd44dULL;
+	Key ^= Key >> 33;
+	return(size_t(Key));
 }
+// Map from Bluetooth address to Value for the lookups made on every advertisement. It uses open addressing with linear probing on the packed address.
+// The keys are kept in their own array so a probe reads as few cache lines as possible, and the table is never more than half full so probes stay short.
+// As with std::unordered_map, adding an address can move every value, so pointers and iterators must not be kept across an insert.
+// It has no erase(iterator). Removing an entry moves later ones back into the gap, which would make iterating while erasing skip or repeat entries.
+template <typename Value>
+class bdaddr_map
+{
+public:
+	typedef std::pair<bdaddr_t, Value> value_type;
+	template <typename Map, typename Pair>
+	class basic_iterator
+	{
+	public:
+		basic_iterator(Map* TheMap, const size_t TheIndex) : map(TheMap), index(TheIndex) { while ((index < map->Keys.size()) && (map->Keys[index] == Empty)) index++; };
+		Pair& operator*() const { return(map->Slots[index]); };
+		Pair* operator->() const { return(&(map->Slots[index])); };
+		basic_iterator& operator++() { for (index++; (index < map->Keys.size()) && (map->Keys[index] == Empty); index++); return(*this); };
+		bool operator ==(const basic_iterator& b) const { return(index == b.index); };
+		bool operator !=(const basic_iterator& b) const { return(index != b.index); };
+	private:
+		Map* map;
+		size_t index;
+	};
+	typedef basic_iterator<bdaddr_map, value_type> iterator;
+	typedef basic_iterator<const bdaddr_map, const value_type> const_iterator;
+	iterator begin() { return(iterator(this, 0)); };
+	iterator end() { return(iterator(this, Keys.size())); };
+	const_iterator begin() const { return(const_iterator(this, 0)); };
+	const_iterator end() const { return(const_iterator(this, Keys.size())); };
+	size_t size(void) const { return(Count); };
+	bool empty(void) const { return(Count == 0); };
+	void clear(void) { Keys.clear(); Slots.clear(); Count = 0; };
+	void swap(bdaddr_map& b) { Keys.swap(b.Keys); Slots.swap(b.Slots); std::swap(Count, b.Count); };
+	iterator find(const bdaddr_t& TheAddress) { return(iterator(this, Find(ba2uint64(TheAddress)))); };
+	const_iterator find(const bdaddr_t& TheAddress) const { return(const_iterator(this, Find(ba2uint64(TheAddress)))); };
+	size_t count(const bdaddr_t& TheAddress) const { return((Find(ba2uint64(TheAddress)) < Keys.size()) ? 1 : 0); };
+	// Either get the existing entry or insert a new one, the same as std::map
+	std::pair<iterator, bool> insert(value_type TheValue)
+	{
+		bool bInserted(false);
+		const size_t index(Insert(TheValue.first, bInserted));
+		if (bInserted)
+			Slots[index].second = std::move(TheValue.second);
+		return(std::make_pair(iterator(this, index), bInserted));
+	};
+	Value& operator[](const bdaddr_t& TheAddress)
+	{
+		bool bInserted(false);
+		return(Slots[Insert(TheAddress, bInserted)].second);
+	};
+	size_t erase(const bdaddr_t& TheAddress)
+	{
+		size_t Hole(Find(ba2uint64(TheAddress)));
+		if (Hole >= Keys.size())
+			return(0);
+		const size_t Mask(Keys.size() - 1);
+		// Backward shift: an entry further along the probe sequence moves into the hole unless its home slot is after the hole
+		for (size_t Next = (Hole + 1) & Mask; Keys[Next] != Empty; Next = (Next + 1) & Mask)
+			if (((Next - bdaddr_hash(Keys[Next])) & Mask) >= ((Next - Hole) & Mask))
+			{
+				Keys[Hole] = Keys[Next];
+				Slots[Hole] = std::move(Slots[Next]);
+				Hole = Next;
+			}
+		Keys[Hole] = Empty;
+		Slots[Hole] = value_type(); // free whatever the value held
+		Count--;
+		return(1);
+	};
+private:
+	static constexpr uint64_t Empty = ~uint64_t(0); // never a 48 bit address
+	std::vector<uint64_t> Keys;
+	std::vector<value_type> Slots; // empty slots hold a default constructed value
+	size_t Count = 0;
+	size_t Find(const uint64_t Key) const
+	{
+		if (!Keys.empty())
+		{
+			const size_t Mask(Keys.size() - 1);
+			for (size_t index = bdaddr_hash(Key) & Mask; Keys[index] != Empty; index = (index + 1) & Mask)
+				if (Keys[index] == Key)
+					return(index);
+		}
+		return(Keys.size());
+	};
+	size_t Insert(const bdaddr_t& TheAddress, bool& bInserted)
+	{
+		const uint64_t Key(ba2uint64(TheAddress));
+		size_t index(Find(Key));
+		bInserted = (index >= Keys.size());
+		if (bInserted)
+		{
+			if (2 * (Count + 1) > Keys.size())
+				Rehash(std::max(size_t(16), 2 * Keys.size()));
+			const size_t Mask(Keys.size() - 1);
+			for (index = bdaddr_hash(Key) & Mask; Keys[index] != Empty; index = (index + 1) & Mask);
+			Keys[index] = Key;
+			Slots[index].first = TheAddress;
+			Count++;
+		}
+		return(index);
+	};
+	void Rehash(const size_t NewSize)
+	{
+		std::vector<uint64_t> OldKeys(NewSize, Empty);
+		std::vector<value_type> OldSlots(NewSize);
+		OldKeys.swap(Keys);
+		OldSlots.swap(Slots);
+		const size_t Mask(NewSize - 1);
+		for (size_t old = 0; old < OldKeys.size(); old++)
+			if (OldKeys[old] != Empty)
+			{
+				size_t index(bdaddr_hash(OldKeys[old]) & Mask);
+				while (Keys[index] != Empty)
+					index = (index + 1) & Mask;
+				Keys[index] = OldKeys[old];
+				Slots[index] = std::move(OldSlots[old]);
+			}
+	};
+};
 std::string ba2string(const bdaddr_t& TheBlueToothAddress)
 {
-	std::ostringstream oss;
+	static const char Digits[] = "0123456789ABCDEF";
+	std::string rval(17, ':');
 	for (auto i = 5; i >= 0; i--)
 	{
-		oss << std::hex << std::uppercase << std::setw(2) << std::setfill('0') << static_cast<int>(TheBlueToothAddress.b[i]);
-		if (i > 0)
-			oss << ":";
+		rval[3 * (5 - i)] = Digits[TheBlueToothAddress.b[i] >> 4];
+		rval[3 * (5 - i) + 1] = Digits[TheBlueToothAddress.b[i] & 0x0f];
 	}
-	return (oss.str());
+	return (rval);
+}
+// The same string, formatted once per device on each thread that asks for it. Console lines use this so they don't build a string for every advertisement.
+// The strings are held by pointer so they don't move when the table grows. Random private addresses would make it grow without end, so it starts over past a limit.
+const std::string& ba2string_cached(const bdaddr_t& TheBlueToothAddress)
+{
+	thread_local bdaddr_map<std::unique_ptr<const std::string>> AddressStrings;
+	if (auto Cached = AddressStrings.find(TheBlueToothAddress); Cached != AddressStrings.end())
+		return(*(Cached->second));
+	if (AddressStrings.size() >= 1024)
+		AddressStrings.clear();
+	auto& NewString(AddressStrings[TheBlueToothAddress]);
+	NewString = std::make_unique<const std::string>(ba2string(TheBlueToothAddress));
+	return(*NewString);
 }
 const std::regex BluetoothAddressRegex("((([[:xdigit:]]{2}:){5}))[[:xdigit:]]{2}");
 bdaddr_t string2ba(const std::string& TheBlueToothAddressString)
@@ -221,6 +419,7 @@ bool ValidateDirectory(const std::filesystem::path& DirectoryName)
 		}
 	return(rval);
 }
+bool VictronBinaryLog(false); // write log files as fixed width binary records instead of text
 // Create a standardized logfile name for this program based on a Bluetooth address and the global parameter of the log file directory.
 std::filesystem::path GenerateLogFileName(const bdaddr_t& a, time_t timer = 0)
 {
@@ -236,29 +435,446 @@ std::filesystem::path GenerateLogFileName(const bdaddr_t& a, time_t timer = 0)
 	if (0 != gmtime_r(&timer, &UTC))
 		if (!((UTC.tm_year == 70) && (UTC.tm_mon == 0) && (UTC.tm_mday == 1)))
 			OutputFilename << "-" << std::dec << UTC.tm_year + 1900 << "-" << std::setw(2) << std::setfill('0') << UTC.tm_mon + 1;
-	OutputFilename << ".txt";
+	OutputFilename << (VictronBinaryLog ? ".bin" : ".txt");
 	std::filesystem::path NewFormatFileName(LogDirectory / OutputFilename.str());
 	return(NewFormatFileName);
 }
+// Log files specific to this program. Months that are over may have been compressed.
+const std::regex LogFileRegex("victron-[[:xdigit:]]{12}-([[:digit:]]{4}-[[:digit:]]{2})\\.(txt|bin)(\\.gz)?");
+inline bool IsBinaryLogFile(const std::filesystem::path& filename)
+{
+	return(((filename.extension() == ".gz") ? filename.stem().extension() : filename.extension()) == ".bin");
+}
+std::filesystem::path GenerateLogIndexName(const std::filesystem::path& filename)
+{
+	std::filesystem::path IndexFilename(filename);
+	if (IndexFilename.extension() == ".gz") // the index of the uncompressed file is kept
+		IndexFilename.replace_extension();
+	IndexFilename += ".idx";
+	return(IndexFilename);
+}
 /////////////////////////////////////////////////////////////////////////////
-std::map<bdaddr_t, std::queue<std::string>> VictronVirtualLog;
+// One advertisement in a log file. Binary log files are a VictronLogHeader followed by VictronLogFrames, so they can be mapped and read in place without parsing.
+// Numbers are little endian. Text log files hold the same thing as an ISO 8601 time, a tab, the manufacturer data in hex, a tab, and the CRC32C of the line before it in hex.
+// Version 1 binary files hold bare VictronLogRecords and text lines written before the checksum was added end after the data, both are still read.
+struct VictronLogHeader {
+	char Magic[8]; // VictronLogMagic
+	uint32_t Version;
+	uint32_t RecordSize; // sizeof(VictronLogFrame), so a file written with a different record can't be misread
+};
+struct VictronLogRecord {
+	int64_t Time; // seconds since the epoch
+	uint8_t RecordType; // ManufacturerData[4], repeated so records can be picked without looking at the payload
+	uint8_t Length; // bytes of ManufacturerData used
+	uint8_t ManufacturerData[30]; // 8 header bytes plus at most 20 bytes of decrypted extra data
+};
+// A record as it is appended to a binary log file. Space the filesystem allocated but never wrote, or a frame cut short, fails the length or checksum
+// so a reader can step over it without trusting anything after the damage.
+struct VictronLogFrame {
+	uint32_t Checksum; // CRC32C of the rest of the frame as it is stored
+	uint32_t Length; // sizeof(VictronLogRecord)
+	VictronLogRecord Record;
+};
+static_assert(sizeof(VictronLogHeader) == 16, "binary log header is 16 bytes");
+static_assert(sizeof(VictronLogRecord) == 40, "binary log records are 40 bytes");
+static_assert(sizeof(VictronLogFrame) == 48, "binary log frames are 48 bytes and stay 8 byte aligned after the header");
+const char VictronLogMagic[8] = { 'V', 'i', 'c', 't', 'r', 'o', 'n', 'L' };
+const uint32_t VictronLogVersion(2);
+const uint32_t VictronLogVersionUnframed(1); // VictronLogRecords without a length or checksum
+// Each log file has an index beside it, named for the log file with .idx added, so a time range can be read without parsing the whole month.
+// It is a VictronLogHeader with VictronLogIndexMagic followed by an entry for each hour that has records, giving where the first of them was written.
+// Everything before that offset is older. Hours the index is missing only make a reader start earlier.
+struct VictronLogIndexEntry {
+	int64_t Time; // start of the hour, seconds since the epoch
+	uint64_t Offset; // bytes from the start of the log file, before it was compressed
+};
+static_assert(sizeof(VictronLogIndexEntry) == 16, "log index entries are 16 bytes");
+const char VictronLogIndexMagic[8] = { 'V', 'i', 'c', 't', 'r', 'o', 'n', 'I' };
+const uint32_t VictronLogIndexVersion(1);
+const int64_t VictronLogIndexInterval(60 * 60);
+bdaddr_map<std::vector<VictronLogRecord>> VictronVirtualLog; // only cleared once the records are handed over, so it stops allocating once it has grown to a minute of records
 std::filesystem::path VictronEncryptionKeyFilename("victronencryptionkeys.txt");
-std::map<bdaddr_t, std::string> VictronEncryptionKeys;
+inline int hexvalue(const char c)
+{
+	if ((c >= '0') && (c <= '9'))
+		return(c - '0');
+	if ((c >= 'A') && (c <= 'F'))
+		return(c - 'A' + 10);
+	if ((c >= 'a') && (c <= 'f'))
+		return(c - 'a' + 10);
+	return(-1);
+}
+// Every log line is mostly hex text, so replaying years of logs is mostly decoding hex.
+// SSE2 is part of x86-64 and NEON is part of AArch64, so the vector kernels need no run time check. Each handles 16 bytes at a time and leaves the tail to the scalar code.
+// Decoding is strict: Length is the number of bytes out, 2 * Length characters are read, and any character that isn't a hex digit makes it return false.
+const char HexDigits[] = "0123456789abcdef";
+void hex_encode_scalar(const uint8_t* In, size_t Length, char* Out)
+{
+	for (size_t index = 0; index < Length; index++)
+	{
+		Out[2 * index] = HexDigits[In[index] >> 4];
+		Out[2 * index + 1] = HexDigits[In[index] & 0x0f];
+	}
+}
+bool hex_decode_scalar(const char* In, size_t Length, uint8_t* Out)
+{
+	for (size_t index = 0; index < Length; index++)
+	{
+		const int high(hexvalue(In[2 * index]));
+		const int low(hexvalue(In[2 * index + 1]));
+		if ((high < 0) || (low < 0))
+			return(false);
+		Out[index] = uint8_t((high << 4) | low);
+	}
+	return(true);
+}
+#if defined(__SSE2__)
+inline __m128i hex_digits_sse2(const __m128i Nibbles)
+{
+	// '0' + n, plus the distance from '9' + 1 to 'a' where n is more than 9
+	const __m128i Letters(_mm_and_si128(_mm_cmpgt_epi8(Nibbles, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '9' - 1)));
+	return(_mm_add_epi8(_mm_add_epi8(Nibbles, _mm_set1_epi8('0')), Letters));
+}
+void hex_encode_sse2(const uint8_t* In, size_t Length, char* Out)
+{
+	const __m128i Mask(_mm_set1_epi8(0x0f));
+	size_t index = 0;
+	for (; index + 16 <= Length; index += 16)
+	{
+		const __m128i Bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(In + index)));
+		const __m128i High(hex_digits_sse2(_mm_and_si128(_mm_srli_epi16(Bytes, 4), Mask)));
+		const __m128i Low(hex_digits_sse2(_mm_and_si128(Bytes, Mask)));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Out + 2 * index), _mm_unpacklo_epi8(High, Low));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Out + 2 * index + 16), _mm_unpackhi_epi8(High, Low));
+	}
+	hex_encode_scalar(In + index, Length - index, Out + 2 * index);
+}
+inline __m128i hex_nibbles_sse2(const __m128i Text, __m128i& Valid)
+{
+	// Subtracting wraps, so only '0' to '9' land in 0 to 9 and only 'a' to 'f' or 'A' to 'F' land in 0 to 5
+	const __m128i Digit(_mm_sub_epi8(Text, _mm_set1_epi8('0')));
+	const __m128i Letter(_mm_sub_epi8(_mm_or_si128(Text, _mm_set1_epi8(0x20)), _mm_set1_epi8('a')));
+	const __m128i IsDigit(_mm_and_si128(_mm_cmpgt_epi8(Digit, _mm_set1_epi8(-1)), _mm_cmplt_epi8(Digit, _mm_set1_epi8(10))));
+	const __m128i IsLetter(_mm_and_si128(_mm_cmpgt_epi8(Letter, _mm_set1_epi8(-1)), _mm_cmplt_epi8(Letter, _mm_set1_epi8(6))));
+	Valid = _mm_and_si128(Valid, _mm_or_si128(IsDigit, IsLetter));
+	return(_mm_or_si128(_mm_and_si128(IsDigit, Digit), _mm_and_si128(IsLetter, _mm_add_epi8(Letter, _mm_set1_epi8(10)))));
+}
+inline __m128i hex_pairs_sse2(const __m128i Nibbles)
+{
+	// each 16 bit lane has the high nibble in its low byte and the low nibble in its high byte
+	return(_mm_or_si128(_mm_slli_epi16(_mm_and_si128(Nibbles, _mm_set1_epi16(0x00ff)), 4), _mm_srli_epi16(Nibbles, 8)));
+}
+bool hex_decode_sse2(const char* In, size_t Length, uint8_t* Out)
+{
+	__m128i Valid(_mm_set1_epi8(-1));
+	size_t index = 0;
+	for (; index + 16 <= Length; index += 16)
+	{
+		const __m128i First(hex_nibbles_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(In + 2 * index)), Valid));
+		const __m128i Second(hex_nibbles_sse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(In + 2 * index + 16)), Valid));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(Out + index), _mm_packus_epi16(hex_pairs_sse2(First), hex_pairs_sse2(Second)));
+	}
+	return((_mm_movemask_epi8(Valid) == 0xffff) && hex_decode_scalar(In + 2 * index, Length - index, Out + index));
+}
+#elif defined(__aarch64__)
+void hex_encode_neon(const uint8_t* In, size_t Length, char* Out)
+{
+	const uint8x16_t Digits(vld1q_u8(reinterpret_cast<const uint8_t*>(HexDigits)));
+	size_t index = 0;
+	for (; index + 16 <= Length; index += 16)
+	{
+		const uint8x16_t Bytes(vld1q_u8(In + index));
+		uint8x16x2_t Text;
+		Text.val[0] = vqtbl1q_u8(Digits, vshrq_n_u8(Bytes, 4));
+		Text.val[1] = vqtbl1q_u8(Digits, vandq_u8(Bytes, vdupq_n_u8(0x0f)));
+		vst2q_u8(reinterpret_cast<uint8_t*>(Out + 2 * index), Text); // interleaves the high and low digits
+	}
+	hex_encode_scalar(In + index, Length - index, Out + 2 * index);
+}
+inline uint8x16_t hex_nibbles_neon(const uint8x16_t Text, uint8x16_t& Valid)
+{
+	// Subtracting wraps, so only '0' to '9' land in 0 to 9 and only 'a' to 'f' or 'A' to 'F' land in 0 to 5
+	const uint8x16_t Digit(vsubq_u8(Text, vdupq_n_u8('0')));
+	const uint8x16_t Letter(vsubq_u8(vorrq_u8(Text, vdupq_n_u8(0x20)), vdupq_n_u8('a')));
+	const uint8x16_t IsDigit(vcltq_u8(Digit, vdupq_n_u8(10)));
+	const uint8x16_t IsLetter(vcltq_u8(Letter, vdupq_n_u8(6)));
+	Valid = vandq_u8(Valid, vorrq_u8(IsDigit, IsLetter));
+	return(vbslq_u8(IsDigit, Digit, vaddq_u8(Letter, vdupq_n_u8(10))));
+}
+bool hex_decode_neon(const char* In, size_t Length, uint8_t* Out)
+{
+	uint8x16_t Valid(vdupq_n_u8(0xff));
+	size_t index = 0;
+	for (; index + 16 <= Length; index += 16)
+	{
+		const uint8x16x2_t Text(vld2q_u8(reinterpret_cast<const uint8_t*>(In + 2 * index))); // separates the high and low digits
+		const uint8x16_t High(hex_nibbles_neon(Text.val[0], Valid));
+		const uint8x16_t Low(hex_nibbles_neon(Text.val[1], Valid));
+		vst1q_u8(Out + index, vorrq_u8(vshlq_n_u8(High, 4), Low));
+	}
+	return((vminvq_u8(Valid) == 0xff) && hex_decode_scalar(In + 2 * index, Length - index, Out + index));
+}
+#endif
+typedef void (*HexEncode_t)(const uint8_t* In, size_t Length, char* Out);
+typedef bool (*HexDecode_t)(const char* In, size_t Length, uint8_t* Out);
+HexEncode_t hex_encode(hex_encode_scalar); // the scalar code until HexSelfTest() has checked the vector kernels against it
+HexDecode_t hex_decode(hex_decode_scalar);
+std::string hex_string(const uint8_t* In, size_t Length)
+{
+	std::string rval(2 * Length, '0');
+	hex_encode(In, Length, rval.data());
+	return(rval);
+}
+// Checks the vector kernels against the scalar code over every byte value, every length up to four vectors, and a bad character in every position.
+// The vector kernels are only switched on if every answer matches. The benchmark build also measures the throughput of both.
+void HexSelfTest(void)
+{
+	HexEncode_t CandidateEncode(nullptr);
+	HexDecode_t CandidateDecode(nullptr);
+	std::string CandidateName;
+#if defined(__SSE2__)
+	CandidateEncode = hex_encode_sse2;
+	CandidateDecode = hex_decode_sse2;
+	CandidateName = "SSE2";
+#elif defined(__aarch64__)
+	CandidateEncode = hex_encode_neon;
+	CandidateDecode = hex_decode_neon;
+	CandidateName = "NEON";
+#endif
+	if (CandidateEncode == nullptr)
+		return;
+	const size_t TestLength(64);
+	uint8_t Bytes[256];
+	for (auto index = 0; index < int(sizeof(Bytes)); index++)
+		Bytes[index] = uint8_t(index * 0x35 + 0x5c); // every byte value, in no particular order
+	bool bMatch(true);
+	for (size_t Offset = 0; bMatch && (Offset + TestLength <= sizeof(Bytes)); Offset += TestLength / 2)
+	{
+		for (size_t Length = 0; bMatch && (Length <= TestLength); Length++)
+		{
+			char Expected[2 * TestLength + 1]{ 0 }, Actual[2 * TestLength + 1]{ 0 };
+			hex_encode_scalar(Bytes + Offset, Length, Expected);
+			CandidateEncode(Bytes + Offset, Length, Actual);
+			bMatch = (0 == memcmp(Expected, Actual, sizeof(Actual)));
+			uint8_t Decoded[TestLength]{ 0 };
+			bMatch = bMatch && CandidateDecode(Expected, Length, Decoded) && (0 == memcmp(Bytes + Offset, Decoded, Length));
+			for (auto& c : Expected)
+				c = char(toupper(c));
+			bMatch = bMatch && CandidateDecode(Expected, Length, Decoded) && (0 == memcmp(Bytes + Offset, Decoded, Length));
+			for (size_t Bad = 0; bMatch && (Bad < 2 * Length); Bad++)
+			{
+				const char Good(Expected[Bad]);
+				for (const char c : { 'g', 'G', '/', ':', '@', '`', ' ', '\0', '\xb0', '\xe1' })
+				{
+					Expected[Bad] = c;
+					bMatch = bMatch && !CandidateDecode(Expected, Length, Decoded);
+				}
+				Expected[Bad] = Good;
+			}
+		}
+	}
+#ifdef VICTRON_BENCHMARK
+	if (bMatch)
+	{
+		// Microbenchmark, a buffer that stays in cache through each path, reported as hex text per second
+		const size_t BufferLength(16 * 1024);
+		const int Iterations(2000);
+		std::vector<uint8_t> Binary(BufferLength);
+		std::vector<char> Text(2 * BufferLength);
+		for (size_t index = 0; index < BufferLength; index++)
+			Binary[index] = Bytes[index % sizeof(Bytes)];
+		const HexEncode_t Encoders[2] = { hex_encode_scalar, CandidateEncode };
+		const HexDecode_t Decoders[2] = { hex_decode_scalar, CandidateDecode };
+		double Throughput[2][2];
+		bool bDecoded(true);
+		for (auto kernel = 0; kernel < 2; kernel++)
+		{
+			auto Start(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
+			{
+				Binary[0] = uint8_t(iteration);
+				Encoders[kernel](Binary.data(), Binary.size(), Text.data());
+			}
+			auto Middle(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
+				bDecoded = Decoders[kernel](Text.data(), Binary.size(), Binary.data()) && bDecoded;
+			auto Finish(std::chrono::steady_clock::now());
+			Throughput[kernel][0] = double(Iterations) * Text.size() / std::chrono::duration_cast<std::chrono::nanoseconds>(Middle - Start).count();
+			Throughput[kernel][1] = double(Iterations) * Text.size() / std::chrono::duration_cast<std::chrono::nanoseconds>(Finish - Middle).count();
+		}
+		if (bDecoded)
+			std::cout << "[                   ] Hex encode scalar: " << std::fixed << std::setprecision(2) << Throughput[0][0] << " GB/s, " << CandidateName << ": " << Throughput[1][0] << " GB/s, "
+				<< "decode scalar: " << Throughput[0][1] << " GB/s, " << CandidateName << ": " << Throughput[1][1] << " GB/s" << std::defaultfloat << std::endl;
+	}
+#endif // VICTRON_BENCHMARK
+	if (bMatch)
+	{
+		hex_encode = CandidateEncode;
+		hex_decode = CandidateDecode;
+	}
+	else if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] " << CandidateName << " hex does not match scalar hex, using scalar hex" << std::endl;
+	else
+		std::cerr << CandidateName << " hex does not match scalar hex, using scalar hex" << std::endl;
+}
+// CRC32C (Castagnoli, reflected polynomial 0x82F63B78) protects each log record. Both x86 SSE 4.2 and the ARMv8 CRC extension compute it in hardware.
+// Called with the previous result to continue a checksum, or zero to start one.
+constexpr std::array<uint32_t, 256> Crc32cTableGenerate(void)
+{
+	std::array<uint32_t, 256> rval{ 0 };
+	for (uint32_t index = 0; index < 256; index++)
+	{
+		uint32_t Crc(index);
+		for (auto bit = 0; bit < 8; bit++)
+			Crc = (Crc >> 1) ^ ((Crc & 1) ? 0x82F63B78 : 0);
+		rval[index] = Crc;
+	}
+	return(rval);
+}
+constexpr std::array<uint32_t, 256> Crc32cTable(Crc32cTableGenerate());
+uint32_t crc32c_scalar(uint32_t Crc, const uint8_t* In, size_t Length)
+{
+	Crc = ~Crc;
+	while (Length-- > 0)
+		Crc = (Crc >> 8) ^ Crc32cTable[(Crc ^ *In++) & 0xff];
+	return(~Crc);
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2"))) uint32_t crc32c_sse42(uint32_t Crc, const uint8_t* In, size_t Length)
+{
+	Crc = ~Crc;
+#if defined(__x86_64__)
+	uint64_t Crc64(Crc);
+	for (; Length >= 8; In += 8, Length -= 8)
+	{
+		uint64_t Word;
+		memcpy(&Word, In, sizeof(Word));
+		Crc64 = _mm_crc32_u64(Crc64, Word);
+	}
+	Crc = uint32_t(Crc64);
+#endif
+	for (; Length >= 4; In += 4, Length -= 4)
+	{
+		uint32_t Word;
+		memcpy(&Word, In, sizeof(Word));
+		Crc = _mm_crc32_u32(Crc, Word);
+	}
+	for (; Length > 0; In++, Length--)
+		Crc = _mm_crc32_u8(Crc, *In);
+	return(~Crc);
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crc"))) uint32_t crc32c_armv8(uint32_t Crc, const uint8_t* In, size_t Length)
+{
+	Crc = ~Crc;
+	for (; Length >= 8; In += 8, Length -= 8)
+	{
+		uint64_t Word;
+		memcpy(&Word, In, sizeof(Word));
+		Crc = __crc32cd(Crc, Word);
+	}
+	for (; Length > 0; In++, Length--)
+		Crc = __crc32cb(Crc, *In);
+	return(~Crc);
+}
+#endif
+typedef uint32_t (*Crc32c_t)(uint32_t Crc, const uint8_t* In, size_t Length);
+Crc32c_t crc32c(crc32c_scalar); // the scalar code until Crc32cSelfTest() has checked the hardware against it
+// Checks the hardware instruction against the published check value and against the scalar code for every length and alignment up to 64 bytes,
+// continuing a checksum part way through. The hardware is only used if every answer matches. The benchmark build also measures the throughput of both.
+void Crc32cSelfTest(void)
+{
+	Crc32c_t Candidate(nullptr);
+	std::string CandidateName;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax(0), ebx(0), ecx(0), edx(0);
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSE4_2))
+	{
+		Candidate = crc32c_sse42;
+		CandidateName = "SSE 4.2";
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_CRC32)
+	{
+		Candidate = crc32c_armv8;
+		CandidateName = "ARMv8 CRC32";
+	}
+#endif
+	const uint8_t CheckString[] = { '1', '2', '3', '4', '5', '6', '7', '8', '9' };
+	bool bMatch(crc32c_scalar(0, CheckString, sizeof(CheckString)) == 0xE3069283); // RFC 3720 B.4
+	if ((Candidate == nullptr) || !bMatch)
+		return;
+	bMatch = (Candidate(0, CheckString, sizeof(CheckString)) == 0xE3069283);
+	uint8_t Bytes[72];
+	for (auto index = 0; index < int(sizeof(Bytes)); index++)
+		Bytes[index] = uint8_t(index * 0x35 + 0x5c);
+	for (size_t Offset = 0; bMatch && (Offset < 8); Offset++)
+		for (size_t Length = 0; bMatch && (Length + Offset <= 64); Length++)
+			bMatch = (Candidate(0, Bytes + Offset, Length) == crc32c_scalar(0, Bytes + Offset, Length)) &&
+				(Candidate(Candidate(0, Bytes + Offset, Length / 3), Bytes + Offset + Length / 3, Length - Length / 3) == crc32c_scalar(0, Bytes + Offset, Length));
+#ifdef VICTRON_BENCHMARK
+	if (bMatch)
+	{
+		// Microbenchmark over log record sized pieces of a buffer that stays in cache
+		std::vector<uint8_t> Buffer(16 * 1024);
+		for (size_t index = 0; index < Buffer.size(); index++)
+			Buffer[index] = Bytes[index % sizeof(Bytes)];
+		const Crc32c_t Kernels[2] = { crc32c_scalar, Candidate };
+		double Throughput[2];
+		uint32_t Sum[2] = { 0, 0 };
+		for (auto kernel = 0; kernel < 2; kernel++)
+		{
+			auto Start(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < 200; iteration++)
+				for (size_t index = 0; index + 44 <= Buffer.size(); index += 44)
+					Sum[kernel] += Kernels[kernel](0, Buffer.data() + index, 44);
+			auto Finish(std::chrono::steady_clock::now());
+			Throughput[kernel] = 200.0 * (Buffer.size() / 44 * 44) / std::chrono::duration_cast<std::chrono::nanoseconds>(Finish - Start).count();
+		}
+		if (Sum[0] == Sum[1])
+			std::cout << "[                   ] CRC32C scalar: " << std::fixed << std::setprecision(2) << Throughput[0] << " GB/s, " << CandidateName << ": " << Throughput[1] << " GB/s" << std::defaultfloat << std::endl;
+	}
+#endif // VICTRON_BENCHMARK
+	if (bMatch)
+		crc32c = Candidate;
+	else if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] " << CandidateName << " CRC32C does not match scalar CRC32C, using scalar CRC32C" << std::endl;
+	else
+		std::cerr << CandidateName << " CRC32C does not match scalar CRC32C, using scalar CRC32C" << std::endl;
+}
+typedef std::array<uint8_t, 16> VictronEncryptionKey_t; // AES-128
+typedef bdaddr_map<VictronEncryptionKey_t> VictronEncryptionKeyTable_t;
+// The key file is parsed into a new table that is never modified once it is published, so a reload can't change a table another thread is using.
+// Each thread holds its own reference and only goes back to the published table when the generation changes, so looking up a key takes no lock.
+std::shared_ptr<const VictronEncryptionKeyTable_t> VictronEncryptionKeysPublished(std::make_shared<const VictronEncryptionKeyTable_t>()); // only accessed with std::atomic_load and std::atomic_store
+std::atomic<size_t> VictronEncryptionKeysGeneration(0); // incremented after each table is published
+std::shared_ptr<const VictronEncryptionKeyTable_t> VictronEncryptionKeys(VictronEncryptionKeysPublished); // the processing thread's reference, it is the thread that reads the file
+int VictronEncryptionKeysEvent(-1); // eventfd used to wake the receive thread when a new table is published
+// Keys are exactly 32 hex digits. Anything else is reported when the file is read instead of silently failing to decrypt every advertisement.
+bool string2key(const std::string& TheText, VictronEncryptionKey_t& TheKey)
+{
+	VictronEncryptionKey_t NewKey;
+	bool rval((TheText.length() == 2 * NewKey.size()) && hex_decode(TheText.data(), NewKey.size(), NewKey.data()));
+	if (rval)
+		TheKey = NewKey;
+	return(rval);
+}
 bool ReadVictronEncryptionKeys(const std::filesystem::path& VictronEncryptionKeysFilename)
 {
 	bool rval = false;
-	static time_t LastModified = 0;
+	static struct timespec LastModified({ 0, 0 });
 	struct stat64 VictronEncryptionKeysFileStat;
 	VictronEncryptionKeysFileStat.st_mtim.tv_sec = 0;
 	if (0 == stat64(VictronEncryptionKeysFilename.c_str(), &VictronEncryptionKeysFileStat))
 	{
 		rval = true;
-		if (VictronEncryptionKeysFileStat.st_mtim.tv_sec > LastModified)	// only read the file if it's modified
+		if ((VictronEncryptionKeysFileStat.st_mtim.tv_sec != LastModified.tv_sec) || (VictronEncryptionKeysFileStat.st_mtim.tv_nsec != LastModified.tv_nsec))	// only read the file if it's modified, an edit can land in the same second as the last one
 		{
 			std::ifstream TheFile(VictronEncryptionKeysFilename);
 			if (TheFile.is_open())
 			{
-				LastModified = VictronEncryptionKeysFileStat.st_mtim.tv_sec;	// only update our time if the file is actually read
+				LastModified = VictronEncryptionKeysFileStat.st_mtim;	// only update our time if the file is actually read
+				auto NewKeys(std::make_shared<VictronEncryptionKeyTable_t>()); // built from scratch so that changed and removed keys take effect
 				if (ConsoleVerbosity > 0)
 					std::cout << "[" << getTimeISO8601(true) << "] Reading: " << VictronEncryptionKeysFilename.string() << std::endl;
 				else
@@ -274,221 +890,789 @@ bool ReadVictronEncryptionKeys(const std::filesystem::path& VictronEncryptionKey
 						const std::string delimiters(" \t");
 						auto i = TheLine.find_first_of(delimiters);		// Find first delimiter
 						i = TheLine.find_first_not_of(delimiters, i);	// Move past consecutive delimiters
-						std::string theEncryptionKey((i == std::string::npos) ? "" : TheLine.substr(i));
-						VictronEncryptionKeys.insert(std::make_pair(theBlueToothAddress, theEncryptionKey));
-						if (ConsoleVerbosity > 1)
-							std::cout << "[                   ] [" << ba2string(theBlueToothAddress) << "] " << theEncryptionKey << std::endl;
+						auto j = TheLine.find_first_of(delimiters + "\r", i);	// Ignore anything after the key, including the carriage return of a DOS format file
+						std::string theEncryptionKey((i == std::string::npos) ? "" : TheLine.substr(i, (j == std::string::npos) ? std::string::npos : j - i));
+						VictronEncryptionKey_t theKey;
+						if (string2key(theEncryptionKey, theKey))
+						{
+							(*NewKeys)[theBlueToothAddress] = theKey;
+							if (ConsoleVerbosity > 1)
+								std::cout << "[                   ] [" << ba2string(theBlueToothAddress) << "] " << theEncryptionKey << std::endl;
+						}
+						else if (ConsoleVerbosity > 0)
+							std::cout << "[                   ] [" << ba2string(theBlueToothAddress) << "] Invalid encryption key, expected 32 hex digits: \"" << theEncryptionKey << "\"" << std::endl;
+						else
+							std::cerr << "[" << ba2string(theBlueToothAddress) << "] Invalid encryption key, expected 32 hex digits: \"" << theEncryptionKey << "\"" << std::endl;
 					}
 				}
 				TheFile.close();
+				if (NewKeys->empty() && !VictronEncryptionKeys->empty())
+				{
+					// Most likely caught while the file was being written, the next change will be read
+					if (ConsoleVerbosity > 0)
+						std::cout << "[" << getTimeISO8601(true) << "] No keys found, keeping the " << VictronEncryptionKeys->size() << " already loaded" << std::endl;
+					else
+						std::cerr << "No keys found, keeping the " << VictronEncryptionKeys->size() << " already loaded" << std::endl;
+				}
+				else
+				{
+					VictronEncryptionKeys = NewKeys;
+					std::atomic_store(&VictronEncryptionKeysPublished, VictronEncryptionKeys);
+					VictronEncryptionKeysGeneration++;
+					if (VictronEncryptionKeysEvent >= 0)
+					{
+						const uint64_t one(1);
+						if (sizeof(one) != write(VictronEncryptionKeysEvent, &one, sizeof(one)))
+							std::cerr << "Error waking receive thread: " << strerror(errno) << std::endl;
+					}
+				}
 			}
 		}
 	}
 	return(rval);
 }
-bool GenerateLogFile(std::map<bdaddr_t, std::queue<std::string>>& AddressTemperatureMap)
+// Appends the CRC32C of a text log line, as it will be checked when the line is read back
+void AppendLogLineChecksum(std::string& Line, const size_t LineStart)
 {
-	bool rval = false;
-	if (!LogDirectory.empty())
+	const uint32_t Checksum(crc32c(0, reinterpret_cast<const uint8_t*>(Line.data() + LineStart), Line.size() - LineStart));
+	Line.push_back('\t');
+	for (auto shift = 28; shift >= 0; shift -= 4)
+		Line.push_back(HexDigits[(Checksum >> shift) & 0x0f]);
+}
+// Parses one text log line. A line with a checksum is only accepted if the checksum matches. A line from before checksums were written
+// is accepted if it holds a time and a plausible amount of hex. bChecksum says which kind of line it was.
+bool ParseLogLine(const char* Line, size_t Length, VictronLogRecord& Record, bool& bChecksum)
+{
+	while ((Length > 0) && isspace(static_cast<unsigned char>(Line[Length - 1])))
+		Length--;
+	const char* LineEnd(Line + Length);
+	const char* DateEnd(static_cast<const char*>(memchr(Line, '\t', Length)));
+	if (DateEnd == nullptr)
+		return(false);
+	const char* DataStart(DateEnd + 1);
+	const char* DataEnd(static_cast<const char*>(memchr(DataStart, '\t', LineEnd - DataStart)));
+	bChecksum = (DataEnd != nullptr);
+	if (bChecksum)
 	{
-		if (ConsoleVerbosity > 1)
-			std::cout << "[" << getTimeISO8601(true) << "] GenerateLogFile: " << LogDirectory << std::endl;
-		for (auto it = AddressTemperatureMap.begin(); it != AddressTemperatureMap.end(); ++it)
-		{
-			if (!it->second.empty()) // Only open the log file if there are entries to add
-			{
-				std::filesystem::path filename(GenerateLogFileName(it->first));
-				std::ofstream LogFile(filename, std::ios_base::out | std::ios_base::app | std::ios_base::ate);
-				if (LogFile.is_open())
-				{
-					//time_t MostRecentData(0);
-					while (!it->second.empty())
-					{
-						LogFile << it->second.front() << std::endl;
-						//MostRecentData = std::max(it->second.front().Time, MostRecentData);
-						it->second.pop();
-					}
-					LogFile.close();
-					//struct utimbuf Log_ut;
-					//Log_ut.actime = MostRecentData;
-					//Log_ut.modtime = MostRecentData;
-					//utime(filename.c_str(), &Log_ut);
-					rval = true;
-				}
-			}
-		}
+		uint8_t Stored[4];
+		if ((LineEnd - DataEnd != 9) || !hex_decode(DataEnd + 1, sizeof(Stored), Stored))
+			return(false);
+		if (((uint32_t(Stored[0]) << 24) | (uint32_t(Stored[1]) << 16) | (uint32_t(Stored[2]) << 8) | Stored[3]) != crc32c(0, reinterpret_cast<const uint8_t*>(Line), DataEnd - Line))
+			return(false);
 	}
 	else
+		DataEnd = LineEnd;
+	const size_t DataLength(DataEnd - DataStart);
+	Record.Length = uint8_t(DataLength / 2);
+	if ((DataLength % 2 != 0) || (Record.Length <= 4) || (DataLength / 2 > sizeof(Record.ManufacturerData)) || !hex_decode(DataStart, Record.Length, Record.ManufacturerData))
+		return(false);
+	try { Record.Time = ISO8601totime(std::string(Line, DateEnd)); }
+	catch (const std::exception&) { return(false); }
+	Record.RecordType = Record.ManufacturerData[4];
+	return(true);
+}
+// Turns the queued records into the bytes stored in a log file, emptying the queue. If Hours is given it gets an index entry, relative to the
+// start of the returned bytes, for the first record and for each record that starts a new hour.
+std::string FormatLogRecords(std::queue<VictronLogRecord>& Records, const bool bBinary, const uint32_t Version = VictronLogVersion, std::vector<VictronLogIndexEntry>* Hours = nullptr)
+{
+	std::string rval;
+	if (bBinary)
+		rval.reserve(Records.size() * sizeof(VictronLogFrame));
+	while (!Records.empty())
 	{
-		// clear the queued data if LogDirectory not specified
-		for (auto it = AddressTemperatureMap.begin(); it != AddressTemperatureMap.end(); ++it)
+		const int64_t Hour(Records.front().Time - (Records.front().Time % VictronLogIndexInterval));
+		if ((Hours != nullptr) && (Hours->empty() || (Hour > Hours->back().Time)))
+			Hours->push_back({ Hour, rval.size() });
+		if (bBinary)
 		{
-			while (!it->second.empty())
+			VictronLogFrame Frame;
+			Frame.Length = htole32(sizeof(VictronLogRecord));
+			Frame.Record = Records.front();
+			Frame.Record.Time = htole64(Frame.Record.Time);
+			if (Version == VictronLogVersionUnframed)
+				rval.append(reinterpret_cast<const char*>(&Frame.Record), sizeof(Frame.Record));
+			else
 			{
-				it->second.pop();
+				Frame.Checksum = htole32(crc32c(0, reinterpret_cast<const uint8_t*>(&Frame.Length), sizeof(Frame) - sizeof(Frame.Checksum)));
+				rval.append(reinterpret_cast<const char*>(&Frame), sizeof(Frame));
 			}
 		}
+		else
+		{
+			const size_t LineStart(rval.size());
+			rval.append(timeToISO8601(Records.front().Time)).append("\t").append(hex_string(Records.front().ManufacturerData, Records.front().Length));
+			AppendLogLineChecksum(rval, LineStart);
+			rval.push_back('\n');
+		}
+		Records.pop();
 	}
 	return(rval);
 }
-/////////////////////////////////////////////////////////////////////////////
-const char* dbus_message_iter_type_to_string(const int type)
+// Reads the entries of a log index that still fit a log file of LogSize bytes. Reading stops at the first entry that is out of order or past the end,
+// which is where a crash or a repair left the index ahead of the log.
+std::vector<VictronLogIndexEntry> ReadLogIndex(const std::filesystem::path& IndexFilename, const uint64_t LogSize)
 {
-	switch (type)
+	std::vector<VictronLogIndexEntry> rval;
+	int fd(open(IndexFilename.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd >= 0)
 	{
-	case DBUS_TYPE_INVALID:
-		return "Invalid";
-	case DBUS_TYPE_VARIANT:
-		return "Variant";
-	case DBUS_TYPE_ARRAY:
-		return "Array";
-	case DBUS_TYPE_BYTE:
-		return "Byte";
-	case DBUS_TYPE_BOOLEAN:
-		return "Boolean";
-	case DBUS_TYPE_INT16:
-		return "Int16";
-	case DBUS_TYPE_UINT16:
-		return "UInt16";
-	case DBUS_TYPE_INT32:
-		return "Int32";
-	case DBUS_TYPE_UINT32:
-		return "UInt32";
-	case DBUS_TYPE_INT64:
-		return "Int64";
-	case DBUS_TYPE_UINT64:
-		return "UInt64";
-	case DBUS_TYPE_DOUBLE:
-		return "Double";
-	case DBUS_TYPE_STRING:
-		return "String";
-	case DBUS_TYPE_OBJECT_PATH:
-		return "ObjectPath";
-	case DBUS_TYPE_SIGNATURE:
-		return "Signature";
-	case DBUS_TYPE_STRUCT:
-		return "Struct";
-	case DBUS_TYPE_DICT_ENTRY:
-		return "DictEntry";
-	default:
-		return "Unknown Type";
+		struct stat64 FileStat;
+		VictronLogHeader Header;
+		if ((0 == fstat64(fd, &FileStat)) && (sizeof(Header) == pread64(fd, &Header, sizeof(Header), 0)) && (0 == memcmp(Header.Magic, VictronLogIndexMagic, sizeof(Header.Magic))) &&
+			(le32toh(Header.Version) == VictronLogIndexVersion) && (le32toh(Header.RecordSize) == sizeof(VictronLogIndexEntry)))
+		{
+			std::vector<VictronLogIndexEntry> Entries((FileStat.st_size - sizeof(Header)) / sizeof(VictronLogIndexEntry));
+			const ssize_t Length(Entries.size() * sizeof(VictronLogIndexEntry));
+			if (Length == pread64(fd, Entries.data(), Length, sizeof(Header)))
+				for (auto& Entry : Entries)
+				{
+					Entry.Time = le64toh(Entry.Time);
+					Entry.Offset = le64toh(Entry.Offset);
+					if ((Entry.Offset > LogSize) || (!rval.empty() && ((Entry.Time <= rval.back().Time) || (Entry.Offset < rval.back().Offset))))
+						break;
+					rval.push_back(Entry);
+				}
+		}
+		close(fd);
 	}
+	return(rval);
 }
-bool bluez_find_adapters(DBusConnection* dbus_conn, std::map<bdaddr_t, std::string>& AdapterMap)
+// Cuts a log index back to the entries that fit a log file of LogSize bytes. Returns the number of entries kept.
+size_t TrimLogIndex(const int IndexFile, const std::filesystem::path& IndexFilename, const uint64_t LogSize)
 {
-	std::ostringstream ssOutput;
-	// Initialize D-Bus error
-	DBusError dbus_error;
-	dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects");
-	if (!dbus_msg)
+	const std::vector<VictronLogIndexEntry> Entries(ReadLogIndex(IndexFilename, LogSize));
+	const off64_t IndexSize(Entries.empty() ? 0 : sizeof(VictronLogHeader) + Entries.size() * sizeof(VictronLogIndexEntry));
+	struct stat64 FileStat;
+	if ((0 == fstat64(IndexFile, &FileStat)) && (FileStat.st_size != IndexSize))
+		ftruncate64(IndexFile, IndexSize);
+	return(Entries.size());
+}
+// The time of the last record in a log file, found by reading only its end, or zero if it can't be read.
+time_t LastLogRecordTime(const int fd, const bool bBinary, const uint64_t LogSize)
+{
+	time_t rval(0);
+	if (bBinary)
 	{
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << "Can't allocate dbus_message_new_method_call: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
+		VictronLogHeader Header;
+		if ((LogSize >= sizeof(Header)) && (sizeof(Header) == pread64(fd, &Header, sizeof(Header), 0)))
+		{
+			const size_t RecordSize(le32toh(Header.RecordSize));
+			const uint64_t Count((LogSize - sizeof(Header)) / RecordSize);
+			VictronLogFrame Frame;
+			if ((Count > 0) && (le32toh(Header.Version) == VictronLogVersion) && (RecordSize == sizeof(Frame)) &&
+				(sizeof(Frame) == pread64(fd, &Frame, sizeof(Frame), sizeof(Header) + (Count - 1) * sizeof(Frame))) &&
+				(le32toh(Frame.Checksum) == crc32c(0, reinterpret_cast<const uint8_t*>(&Frame.Length), sizeof(Frame) - sizeof(Frame.Checksum))))
+				rval = le64toh(Frame.Record.Time);
+		}
 	}
 	else
 	{
-		dbus_error_init(&dbus_error);
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_USE_DEFAULT, &dbus_error);
-		dbus_message_unref(dbus_msg);
-		if (!dbus_reply)
+		char Tail[256];
+		const size_t Length(std::min(LogSize, uint64_t(sizeof(Tail))));
+		if ((Length > 0) && (ssize_t(Length) == pread64(fd, Tail, Length, LogSize - Length)))
 		{
-			if (ConsoleVerbosity > 0)
-				ssOutput << "[                   ] ";
-			ssOutput << "Can't get bluez managed objects" << std::endl;
-			if (dbus_error_is_set(&dbus_error))
+			const char* LineEnd(static_cast<const char*>(memrchr(Tail, '\n', Length)));
+			if (LineEnd != nullptr)
 			{
-				if (ConsoleVerbosity > 0)
-					ssOutput << "[                   ] ";
-				ssOutput << dbus_error.message << std::endl;
-				dbus_error_free(&dbus_error);
+				const char* LineStart(static_cast<const char*>(memrchr(Tail, '\n', LineEnd - Tail)));
+				LineStart = (LineStart == nullptr) ? Tail : LineStart + 1;
+				while ((LineStart < LineEnd) && (*LineStart == '\0'))
+					LineStart++;
+				VictronLogRecord Record({ 0, 0, 0, { 0 } });
+				bool bChecksum(false);
+				if (((LineStart > Tail) || (Length == LogSize)) && ParseLogLine(LineStart, LineEnd - LineStart, Record, bChecksum))
+					rval = Record.Time;
 			}
 		}
-		else
+	}
+	return(rval);
+}
+// The index kept open beside a log file while records are appended to it
+struct VictronLogIndex {
+	int fd = -1;
+	int64_t Hour = std::numeric_limits<int64_t>::min(); // the last hour given an entry, or one whose records are already in the log without one
+};
+// Opens the index of a log file that is open for appending. Entries the log doesn't reach are dropped. If the log has records from after the index ends,
+// from a crash between writing the two or from before there were indexes, the hours they cover get no entry so nothing is skipped.
+void VictronLogIndexOpen(const std::filesystem::path& filename, const int LogFile, const bool bBinary, VictronLogIndex& Index)
+{
+	const std::filesystem::path IndexFilename(GenerateLogIndexName(filename));
+	Index = VictronLogIndex();
+	struct stat64 FileStat;
+	if (0 == fstat64(LogFile, &FileStat))
+	{
+		Index.fd = open(IndexFilename.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+		if (Index.fd >= 0)
 		{
-			if (dbus_message_get_type(dbus_reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
+			const uint64_t LogSize(FileStat.st_size);
+			if (LogSize <= (bBinary ? sizeof(VictronLogHeader) : 0)) // a new log starts a new index
+				ftruncate64(Index.fd, 0);
+			else
 			{
-				const std::string dbus_reply_Signature(dbus_message_get_signature(dbus_reply));
-				int indent(16);
-				if (ConsoleVerbosity > 1)
-				{
-					ssOutput << "[                   ] " << std::right << std::setw(indent) << "Message Type: " << std::string(dbus_message_type_to_string(dbus_message_get_type(dbus_reply))) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
-					ssOutput << "[                   ] " << std::right << std::setw(indent) << "Signature: " << dbus_reply_Signature << std::endl;
-					ssOutput << "[                   ] " << std::right << std::setw(indent) << "Destination: " << std::string(dbus_message_get_destination(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
-					ssOutput << "[                   ] " << std::right << std::setw(indent) << "Sender: " << std::string(dbus_message_get_sender(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
-					//if (NULL != dbus_message_get_path(dbus_reply)) std::cout << std::right << std::setw(indent) << "Path: " << std::string(dbus_message_get_path(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga18adf731bb42d324fe2624407319e4af
-					//if (NULL != dbus_message_get_interface(dbus_reply)) std::cout << std::right << std::setw(indent) << "Interface: " << std::string(dbus_message_get_interface(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga1ad192bd4538cae556121a71b4e09d42
-					//if (NULL != dbus_message_get_member(dbus_reply)) std::cout << std::right << std::setw(indent) << "Member: " << std::string(dbus_message_get_member(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf5c6b705c53db07a5ae2c6b76f230cf9
-					//if (NULL != dbus_message_get_container_instance(dbus_reply)) std::cout << std::right << std::setw(indent) << "Container Instance: " << std::string(dbus_message_get_container_instance(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
-				}
-				if (!dbus_reply_Signature.compare("a{oa{sa{sv}}}"))
-				{
-					DBusMessageIter root_iter;
-					dbus_message_iter_init(dbus_reply, &root_iter);
-					do {
-						DBusMessageIter array1_iter;
-						dbus_message_iter_recurse(&root_iter, &array1_iter);
-						do {
-							indent += 4;
-							DBusMessageIter dict1_iter;
-							dbus_message_iter_recurse(&array1_iter, &dict1_iter);
-							DBusBasicValue value;
-							dbus_message_iter_get_basic(&dict1_iter, &value);
-							std::string dict1_object_path(value.str);
-							if (ConsoleVerbosity > 1)
-								ssOutput << "[                   ] " << std::right << std::setw(indent) << "Object Path: " << dict1_object_path << std::endl;
-							dbus_message_iter_next(&dict1_iter);
-							DBusMessageIter array2_iter;
-							dbus_message_iter_recurse(&dict1_iter, &array2_iter);
-							do
-							{
-								DBusMessageIter dict2_iter;
-								dbus_message_iter_recurse(&array2_iter, &dict2_iter);
-								dbus_message_iter_get_basic(&dict2_iter, &value);
-								std::string dict2_string(value.str);
-								if (ConsoleVerbosity > 1)
-									ssOutput << "[                   ] " << std::right << std::setw(indent) << "String: " << dict2_string << std::endl;
-								if (!dict2_string.compare("org.bluez.Adapter1"))
-								{
-									indent += 4;
-									dbus_message_iter_next(&dict2_iter);
-									DBusMessageIter array3_iter;
-									dbus_message_iter_recurse(&dict2_iter, &array3_iter);
-									do {
-										DBusMessageIter dict3_iter;
-										dbus_message_iter_recurse(&array3_iter, &dict3_iter);
-										dbus_message_iter_get_basic(&dict3_iter, &value);
-										std::string dict3_string(value.str);
-										if (!dict3_string.compare("Address"))
-										{
-											dbus_message_iter_next(&dict3_iter);
-											if (DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(&dict3_iter))
-											{
-												// recurse into variant to get string
-												DBusMessageIter variant_iter;
-												dbus_message_iter_recurse(&dict3_iter, &variant_iter);
-												if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&variant_iter))
-												{
-													dbus_message_iter_get_basic(&variant_iter, &value);
-													std::string Address(value.str);
-													if (ConsoleVerbosity > 1)
-														ssOutput << "[                   ] " << std::right << std::setw(indent) << "Address: " << Address << std::endl;
-													bdaddr_t localBTAddress(string2ba(Address));
-													AdapterMap.insert(std::pair<bdaddr_t, std::string>(localBTAddress, dict1_object_path));
-												}
-											}
-										}
-									} while (dbus_message_iter_next(&array3_iter));
-									indent -= 4;
-								}
-							} while (dbus_message_iter_next(&array2_iter));
-							indent -= 4;
-						} while (dbus_message_iter_next(&array1_iter));
-					} while (dbus_message_iter_next(&root_iter));
+				if (TrimLogIndex(Index.fd, IndexFilename, LogSize) > 0)
+					Index.Hour = ReadLogIndex(IndexFilename, LogSize).back().Time;
+				time_t LastTime(LastLogRecordTime(LogFile, bBinary, LogSize));
+				if (LastTime == 0) // unreadable, so it's only safe to index hours that haven't started yet
+					LastTime = time(nullptr);
+				Index.Hour = std::max(Index.Hour, int64_t(LastTime - (LastTime % VictronLogIndexInterval)));
+			}
+		}
+	}
+}
+// Adds the entries for hours after Index.Hour to the index. An index that can't be written is closed, the log file is still complete without it.
+void VictronLogIndexAppend(VictronLogIndex& Index, const std::vector<VictronLogIndexEntry>& Hours, const uint64_t Base)
+{
+	if (Index.fd >= 0)
+	{
+		std::string Entries;
+		struct stat64 FileStat;
+		if ((0 == fstat64(Index.fd, &FileStat)) && (FileStat.st_size == 0))
+		{
+			VictronLogHeader Header;
+			memcpy(Header.Magic, VictronLogIndexMagic, sizeof(Header.Magic));
+			Header.Version = htole32(VictronLogIndexVersion);
+			Header.RecordSize = htole32(sizeof(VictronLogIndexEntry));
+			Entries.append(reinterpret_cast<const char*>(&Header), sizeof(Header));
+		}
+		int64_t LastHour(Index.Hour);
+		for (auto& Hour : Hours)
+			if (Hour.Time > LastHour)
+			{
+				const VictronLogIndexEntry Entry({ int64_t(htole64(Hour.Time)), htole64(Base + Hour.Offset) });
+				Entries.append(reinterpret_cast<const char*>(&Entry), sizeof(Entry));
+				LastHour = Hour.Time;
+			}
+		if ((LastHour > Index.Hour) && (ssize_t(Entries.size()) != write(Index.fd, Entries.data(), Entries.size())))
+		{
+			close(Index.fd);
+			Index.fd = -1;
+		}
+		Index.Hour = LastHour;
+	}
+}
+// Writes the records to the end of an open log file with one writev, putting the header in front if it is a new binary file.
+// Records are added to an old version 1 file in its own format. What a crash left part way through a record is cut off a binary file,
+// and ended with a newline in a text file, so the new records start where a reader expects them. The queue is only emptied if everything was written.
+// Given an index, the hours the records start are added to it once they are in the log. Version 1 files aren't indexed.
+bool WriteLogRecords(const int fd, std::queue<VictronLogRecord>& Records, const bool bBinary, VictronLogIndex* Index = nullptr)
+{
+	struct stat64 FileStat;
+	if (0 != fstat64(fd, &FileStat))
+		return(false);
+	VictronLogHeader Header;
+	memcpy(Header.Magic, VictronLogMagic, sizeof(Header.Magic));
+	Header.Version = htole32(VictronLogVersion);
+	Header.RecordSize = htole32(sizeof(VictronLogFrame));
+	uint32_t Version(VictronLogVersion);
+	uint64_t Base(FileStat.st_size); // where the records will start
+	std::string Prefix;
+	if (bBinary)
+	{
+		if (size_t(FileStat.st_size) < sizeof(Header))
+		{
+			if ((FileStat.st_size > 0) && (0 != ftruncate64(fd, 0)))
+				return(false);
+			Base = 0;
+			Prefix.assign(reinterpret_cast<const char*>(&Header), sizeof(Header));
+		}
+		else
+		{
+			VictronLogHeader Existing;
+			if ((sizeof(Existing) != pread64(fd, &Existing, sizeof(Existing), 0)) || (0 != memcmp(Existing.Magic, VictronLogMagic, sizeof(Existing.Magic))))
+				return(false);
+			Version = le32toh(Existing.Version);
+			const size_t RecordSize(le32toh(Existing.RecordSize));
+			if (!(((Version == VictronLogVersion) && (RecordSize == sizeof(VictronLogFrame))) || ((Version == VictronLogVersionUnframed) && (RecordSize == sizeof(VictronLogRecord)))))
+				return(false);
+			const off64_t Torn((FileStat.st_size - sizeof(Existing)) % RecordSize);
+			if ((Torn != 0) && (0 != ftruncate64(fd, FileStat.st_size - Torn)))
+				return(false);
+			Base -= Torn;
+		}
+	}
+	else if (FileStat.st_size > 0)
+	{
+		char Last('\n');
+		if ((1 == pread64(fd, &Last, 1, FileStat.st_size - 1)) && (Last != '\n'))
+			Prefix = "\n";
+	}
+	Base += Prefix.size();
+	std::queue<VictronLogRecord> Unwritten(Records);
+	std::vector<VictronLogIndexEntry> Hours;
+	const std::string Body(FormatLogRecords(Unwritten, bBinary, Version, &Hours));
+	struct iovec Buffers[2];
+	int BufferCount(0);
+	if (!Prefix.empty())
+		Buffers[BufferCount++] = { const_cast<char*>(Prefix.data()), Prefix.size() };
+	Buffers[BufferCount++] = { const_cast<char*>(Body.data()), Body.size() };
+	for (int index = 0; index < BufferCount; )
+	{
+		ssize_t Written(writev(fd, Buffers + index, BufferCount - index));
+		if (Written < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return(false);
+		}
+		for (; (index < BufferCount) && (size_t(Written) >= Buffers[index].iov_len); index++)
+			Written -= Buffers[index].iov_len;
+		if (index < BufferCount)
+		{
+			Buffers[index].iov_base = static_cast<char*>(Buffers[index].iov_base) + Written;
+			Buffers[index].iov_len -= Written;
+		}
+	}
+	std::queue<VictronLogRecord>().swap(Records);
+	if ((Index != nullptr) && (Version == VictronLogVersion))
+		VictronLogIndexAppend(*Index, Hours, Base);
+	return(true);
+}
+// Appends the queued records in the format matching the file extension. Used for one off writes, the log writer thread keeps its files open.
+bool AppendLogFile(const std::filesystem::path& filename, std::queue<VictronLogRecord>& Records)
+{
+	bool rval = false;
+	int fd(open(filename.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644));
+	if (fd >= 0)
+	{
+		VictronLogIndex Index;
+		VictronLogIndexOpen(filename, fd, IsBinaryLogFile(filename), Index);
+		rval = WriteLogRecords(fd, Records, IsBinaryLogFile(filename), &Index);
+		if (Index.fd >= 0)
+			close(Index.fd);
+		if (0 != close(fd))
+			rval = false;
+	}
+	return(rval);
+}
+// Once its month is over a log file never changes, so the log writer compresses it with gzip. The compressed copy is streamed to a temporary file,
+// synced, given the original's modification time and renamed into place before the original is removed, so a crash at any point leaves a whole copy.
+bool CompressLogFile(const std::filesystem::path& filename)
+{
+	bool rval = false;
+	const std::filesystem::path CompressedFilename(filename.string() + ".gz");
+	const std::filesystem::path TemporaryFilename(CompressedFilename.string() + ".tmp");
+	struct stat64 FileStat;
+	int InFile(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+	if ((InFile >= 0) && (0 == fstat64(InFile, &FileStat)))
+	{
+		int OutFile(open(TemporaryFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+		if (OutFile >= 0)
+		{
+			const int CompressedFile(dup(OutFile)); // gzclose closes its descriptor, OutFile is kept to sync the data
+			gzFile Compressed((CompressedFile >= 0) ? gzdopen(CompressedFile, "wb") : nullptr);
+			if (Compressed != nullptr)
+			{
+				gzbuffer(Compressed, 128 * 1024);
+				std::vector<char> Buffer(128 * 1024);
+				ssize_t BytesRead;
+				bool bWritten(true);
+				posix_fadvise(InFile, 0, 0, POSIX_FADV_SEQUENTIAL);
+				while (bWritten && ((BytesRead = read(InFile, Buffer.data(), Buffer.size())) > 0))
+					bWritten = (gzwrite(Compressed, Buffer.data(), unsigned(BytesRead)) == BytesRead);
+				rval = bWritten && (BytesRead == 0);
+				if (Z_OK != gzclose(Compressed))
+					rval = false;
+			}
+			else if (CompressedFile >= 0)
+				close(CompressedFile);
+			if (0 != fdatasync(OutFile))
+				rval = false;
+			close(OutFile);
+		}
+		if (rval)
+		{
+			struct utimbuf ut;
+			ut.actime = FileStat.st_atim.tv_sec;
+			ut.modtime = FileStat.st_mtim.tv_sec;
+			utime(TemporaryFilename.c_str(), &ut);
+			rval = (0 == rename(TemporaryFilename.c_str(), CompressedFilename.c_str())) && (0 == unlink(filename.c_str()));
+		}
+		else
+			unlink(TemporaryFilename.c_str());
+	}
+	if (InFile >= 0)
+		close(InFile);
+	if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] " << (rval ? "Compressed: " : "Can't compress: ") << filename.string() << std::endl;
+	else
+		std::cerr << (rval ? "Compressed: " : "Can't compress: ") << filename.string() << std::endl;
+	return(rval);
+}
+// Compresses every log file from a month before ThisMonth (YYYY-MM) that hasn't been compressed yet
+void CompressClosedLogFiles(const std::string& ThisMonth)
+{
+	if (!LogDirectory.empty())
+	{
+		std::deque<std::filesystem::path> files;
+		std::error_code ec;
+		for (auto const& dir_entry : std::filesystem::directory_iterator{ LogDirectory, ec })
+		{
+			std::smatch LogFileMatch;
+			const std::string Filename(dir_entry.path().filename().string());
+			if (dir_entry.is_regular_file() && std::regex_match(Filename, LogFileMatch, LogFileRegex))
+				if ((LogFileMatch[1].str() < ThisMonth) && !LogFileMatch[3].matched)
+					files.push_back(dir_entry);
+		}
+		sort(files.begin(), files.end());
+		for (auto& filename : files)
+			CompressLogFile(filename);
+	}
+}
+// Log files are written by their own thread so a slow SD card never holds up decoding. The processing thread hands over what has been queued
+// every minute, and the writer keeps each device's file open until the month changes so each batch costs one writev per device.
+enum class LogDurability { none, batch, interval };
+LogDurability VictronLogDurability(LogDurability::none);
+time_t VictronLogSyncInterval(0); // seconds between fdatasync calls with LogDurability::interval
+std::mutex VictronLogWriterMutex;
+std::condition_variable VictronLogWriterWake;
+bdaddr_map<std::queue<VictronLogRecord>> VictronLogWriterPending; // handed over by the processing thread, guarded by VictronLogWriterMutex
+bool bVictronLogWriterStop(false); // guarded by VictronLogWriterMutex
+struct VictronLogFile {
+	std::filesystem::path Path; // the month the file descriptor is open for
+	int fd = -1;
+	VictronLogIndex Index;
+	bool bDirty = false; // written since the last fdatasync
+};
+void VictronLogFileSync(VictronLogFile& File)
+{
+	if ((File.fd >= 0) && File.bDirty)
+	{
+		if (0 != fdatasync(File.fd))
+			std::cerr << "fdatasync " << File.Path.string() << ": " << strerror(errno) << std::endl;
+		if ((File.Index.fd >= 0) && (0 != fdatasync(File.Index.fd))) // after the log, so the index is never on disk ahead of it
+			std::cerr << "fdatasync " << GenerateLogIndexName(File.Path).string() << ": " << strerror(errno) << std::endl;
+		File.bDirty = false;
+	}
+}
+void VictronLogFileClose(VictronLogFile& File)
+{
+	if (File.fd >= 0)
+	{
+		if (VictronLogDurability != LogDurability::none)
+			VictronLogFileSync(File);
+		close(File.fd);
+	}
+	if (File.Index.fd >= 0)
+		close(File.Index.fd);
+	File = VictronLogFile();
+}
+void VictronLogWriterThread(void)
+{
+	bdaddr_map<VictronLogFile> Files;
+	bdaddr_map<std::queue<VictronLogRecord>> Batch;
+	bdaddr_map<std::queue<VictronLogRecord>> Unwritten; // kept for the next batch if the file couldn't be opened or written
+	time_t LastSync(time(nullptr));
+	std::string CompressedBefore; // the month closed log files were last compressed in
+	std::unique_lock<std::mutex> WriterLock(VictronLogWriterMutex);
+	for (;;)
+	{
+		VictronLogWriterWake.wait_for(WriterLock, std::chrono::seconds((VictronLogDurability == LogDurability::interval) ? VictronLogSyncInterval : 60), [] { return(bVictronLogWriterStop || !VictronLogWriterPending.empty()); });
+		Batch.swap(VictronLogWriterPending);
+		const bool bStopping(bVictronLogWriterStop);
+		WriterLock.unlock();
+		for (auto& [TheAddress, Records] : Unwritten) // older records go first
+		{
+			std::queue<VictronLogRecord>& Newer(Batch[TheAddress]);
+			for (; !Newer.empty(); Newer.pop())
+				Records.push(Newer.front());
+			Newer.swap(Records);
+		}
+		Unwritten.clear();
+		for (auto& [TheAddress, Records] : Batch)
+			if (!Records.empty())
+			{
+				VictronLogFile& File(Files[TheAddress]);
+				std::filesystem::path filename(GenerateLogFileName(TheAddress));
+				if (File.Path != filename) // a new month, or the last open failed
+				{
+					VictronLogFileClose(File);
+					File.fd = open(filename.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+					if (File.fd >= 0)
+					{
+						File.Path = filename;
+						VictronLogIndexOpen(filename, File.fd, IsBinaryLogFile(filename), File.Index);
+					}
+					else
+						std::cerr << "Can't open " << filename.string() << ": " << strerror(errno) << std::endl;
+				}
+				if ((File.fd >= 0) && WriteLogRecords(File.fd, Records, IsBinaryLogFile(filename), &File.Index))
+					File.bDirty = true;
+				else
+				{
+					if (File.fd >= 0)
+						std::cerr << "Can't write " << filename.string() << ": " << strerror(errno) << std::endl;
+					VictronLogFileClose(File); // opened again next time
+					Unwritten[TheAddress].swap(Records);
 				}
 			}
-			dbus_message_unref(dbus_reply);
+		Batch.clear();
+		const time_t TimeNow(time(nullptr));
+		if ((VictronLogDurability == LogDurability::batch) || ((VictronLogDurability == LogDurability::interval) && (TimeNow - LastSync >= VictronLogSyncInterval)))
+		{
+			for (auto& [TheAddress, File] : Files)
+				VictronLogFileSync(File);
+			LastSync = TimeNow;
+		}
+		std::string ThisMonth(timeToISO8601(TimeNow).substr(0, 7));
+		if (!bStopping && (ThisMonth != CompressedBefore))
+		{
+			// Files from last month are still open for devices that haven't been heard from since it ended
+			for (auto& [TheAddress, File] : Files)
+				if ((File.fd >= 0) && (File.Path != GenerateLogFileName(TheAddress, TimeNow)))
+					VictronLogFileClose(File);
+			CompressClosedLogFiles(ThisMonth);
+			CompressedBefore = ThisMonth;
+		}
+		WriterLock.lock();
+		if (bStopping && VictronLogWriterPending.empty())
+			break;
+	}
+	WriterLock.unlock();
+	for (auto& [TheAddress, File] : Files)
+		VictronLogFileClose(File);
+	for (auto& [TheAddress, Records] : Unwritten)
+		if (!Records.empty())
+			std::cerr << "[" << ba2string(TheAddress) << "] " << Records.size() << " records could not be written to the log" << std::endl;
+}
+// Hands the queued records to the log writer thread. The records are copied rather than the map swapped, so the processing thread keeps its capacity.
+bool GenerateLogFile(bdaddr_map<std::vector<VictronLogRecord>>& AddressTemperatureMap)
+{
+	bool rval = false;
+	if (!LogDirectory.empty())
+	{
+		if (ConsoleVerbosity > 1)
+			std::cout << "[" << getTimeISO8601(true) << "] GenerateLogFile: " << LogDirectory << std::endl;
+		std::lock_guard<std::mutex> WriterLock(VictronLogWriterMutex);
+		for (auto& [TheAddress, Records] : AddressTemperatureMap)
+			if (!Records.empty())
+			{
+				std::queue<VictronLogRecord>& Pending(VictronLogWriterPending[TheAddress]); // still holds the last batch if the writer hasn't caught up
+				for (auto& Record : Records)
+					Pending.push(Record);
+				Records.clear();
+			}
+		rval = true;
+	}
+	else
+	{
+		// clear the queued data if LogDirectory not specified
+		for (auto it = AddressTemperatureMap.begin(); it != AddressTemperatureMap.end(); ++it)
+			it->second.clear();
+	}
+	if (rval)
+		VictronLogWriterWake.notify_one();
+	return(rval);
+}
+/////////////////////////////////////////////////////////////////////////////
+const char* dbus_message_iter_type_to_string(const int type)
+{
+	switch (type)
+	{
+	case DBUS_TYPE_INVALID:
+		return "Invalid";
+	case DBUS_TYPE_VARIANT:
+		return "Variant";
+	case DBUS_TYPE_ARRAY:
+		return "Array";
+	case DBUS_TYPE_BYTE:
+		return "Byte";
+	case DBUS_TYPE_BOOLEAN:
+		return "Boolean";
+	case DBUS_TYPE_INT16:
+		return "Int16";
+	case DBUS_TYPE_UINT16:
+		return "UInt16";
+	case DBUS_TYPE_INT32:
+		return "Int32";
+	case DBUS_TYPE_UINT32:
+		return "UInt32";
+	case DBUS_TYPE_INT64:
+		return "Int64";
+	case DBUS_TYPE_UINT64:
+		return "UInt64";
+	case DBUS_TYPE_DOUBLE:
+		return "Double";
+	case DBUS_TYPE_STRING:
+		return "String";
+	case DBUS_TYPE_OBJECT_PATH:
+		return "ObjectPath";
+	case DBUS_TYPE_SIGNATURE:
+		return "Signature";
+	case DBUS_TYPE_STRUCT:
+		return "Struct";
+	case DBUS_TYPE_DICT_ENTRY:
+		return "DictEntry";
+	default:
+		return "Unknown Type";
+	}
+}
+/////////////////////////////////////////////////////////////////////////////
+// BlueZ method calls are sent with dbus_connection_send_with_reply() and the reply is handled when the event loop dispatches it.
+// Advertisements keep flowing while an adapter is being set up or torn down, and a hung bluetoothd can no longer stall us forever.
+const int BlueZMethodTimeout(10 * 1000); // milliseconds to wait for a reply before libdbus gives up and hands us an error instead
+typedef std::function<void(DBusMessage* dbus_reply)> DBusReplyHandler; // dbus_reply is nullptr if the call failed or timed out
+struct DBusPendingReply {
+	std::string Description; // written to the console when the reply arrives
+	bool bLog; // false to only write the description if the call fails
+	DBusReplyHandler Handler;
+};
+size_t DBusPendingCalls(0); // method calls still waiting for a reply, only used on the receive thread
+void dbus_pending_reply_free(void* user_data)
+{
+	delete static_cast<DBusPendingReply*>(user_data);
+	DBusPendingCalls--;
+}
+void dbus_pending_reply_notify(DBusPendingCall* pending, void* user_data)
+{
+	DBusPendingReply& Pending(*static_cast<DBusPendingReply*>(user_data));
+	DBusMessage* dbus_reply = dbus_pending_call_steal_reply(pending); // https://dbus.freedesktop.org/doc/api/html/group__DBusPendingCall.html
+	std::ostringstream ssOutput;
+	if (ConsoleVerbosity > 0)
+		ssOutput << "[                   ] ";
+	ssOutput << Pending.Description;
+	bool bSuccess(dbus_reply != nullptr);
+	DBusError dbus_error;
+	dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
+	if (bSuccess && dbus_set_error_from_message(&dbus_error, dbus_reply)) // a timeout shows up here as org.freedesktop.DBus.Error.NoReply
+	{
+		ssOutput << " Error: " << dbus_error.message;
+		dbus_error_free(&dbus_error);
+		bSuccess = false;
+	}
+	if (ConsoleVerbosity > 0)
+	{
+		if (Pending.bLog || !bSuccess)
+			std::cout << ssOutput.str() << std::endl;
+	}
+	else if (Pending.bLog || !bSuccess)
+		std::cerr << ssOutput.str() << std::endl;
+	if (Pending.Handler)
+		Pending.Handler(bSuccess ? dbus_reply : nullptr);
+	if (dbus_reply != nullptr)
+		dbus_message_unref(dbus_reply);
+}
+// Sends dbus_msg, taking ownership of it. Handler is called from the event loop when the reply arrives or the call times out.
+// Returns false if the call couldn't be sent, in which case Handler will never be called.
+bool dbus_call_async(DBusConnection* dbus_conn, DBusMessage* dbus_msg, DBusReplyHandler Handler, const std::string& Detail = std::string(), const bool bLog = true)
+{
+	bool rval(false);
+	if (!dbus_msg)
+	{
+		std::ostringstream ssOutput;
+		if (ConsoleVerbosity > 0)
+			ssOutput << "[                   ] ";
+		ssOutput << "Can't allocate dbus_message_new_method_call: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
+		if (ConsoleVerbosity > 0)
+			std::cout << ssOutput.str();
+		else
+			std::cerr << ssOutput.str();
+	}
+	else
+	{
+		std::ostringstream ssDescription;
+		ssDescription << dbus_message_get_path(dbus_msg) << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg) << Detail;
+		DBusPendingCall* pending(nullptr);
+		if (dbus_connection_send_with_reply(dbus_conn, dbus_msg, &pending, BlueZMethodTimeout) && (pending != nullptr)) // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html
+		{
+			DBusPendingReply* Pending = new DBusPendingReply({ ssDescription.str(), bLog, Handler });
+			DBusPendingCalls++;
+			if (dbus_pending_call_set_notify(pending, dbus_pending_reply_notify, Pending, dbus_pending_reply_free))
+				rval = true;
+			else
+				dbus_pending_reply_free(Pending);
+			dbus_pending_call_unref(pending); // the connection keeps its own reference until the reply arrives
+		}
+		dbus_message_unref(dbus_msg);
+	}
+	return(rval);
+}
+bool bluez_get_managed_objects(DBusConnection* dbus_conn, DBusReplyHandler Handler)
+{
+	return(dbus_call_async(dbus_conn, dbus_message_new_method_call("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects"), Handler, std::string(), false));
+}
+bool bluez_find_adapters(DBusMessage* dbus_reply, std::map<bdaddr_t, std::string>& AdapterMap)
+{
+	// dbus_reply is the reply to GetManagedObjects
+	std::ostringstream ssOutput;
+	if (dbus_message_get_type(dbus_reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
+	{
+		const std::string dbus_reply_Signature(dbus_message_get_signature(dbus_reply));
+		int indent(16);
+		if (ConsoleVerbosity > 1)
+		{
+			ssOutput << "[                   ] " << std::right << std::setw(indent) << "Message Type: " << std::string(dbus_message_type_to_string(dbus_message_get_type(dbus_reply))) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
+			ssOutput << "[                   ] " << std::right << std::setw(indent) << "Signature: " << dbus_reply_Signature << std::endl;
+			ssOutput << "[                   ] " << std::right << std::setw(indent) << "Destination: " << std::string(dbus_message_get_destination(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
+			ssOutput << "[                   ] " << std::right << std::setw(indent) << "Sender: " << std::string(dbus_message_get_sender(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
+			//if (NULL != dbus_message_get_path(dbus_reply)) std::cout << std::right << std::setw(indent) << "Path: " << std::string(dbus_message_get_path(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga18adf731bb42d324fe2624407319e4af
+			//if (NULL != dbus_message_get_interface(dbus_reply)) std::cout << std::right << std::setw(indent) << "Interface: " << std::string(dbus_message_get_interface(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga1ad192bd4538cae556121a71b4e09d42
+			//if (NULL != dbus_message_get_member(dbus_reply)) std::cout << std::right << std::setw(indent) << "Member: " << std::string(dbus_message_get_member(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf5c6b705c53db07a5ae2c6b76f230cf9
+			//if (NULL != dbus_message_get_container_instance(dbus_reply)) std::cout << std::right << std::setw(indent) << "Container Instance: " << std::string(dbus_message_get_container_instance(dbus_reply)) << std::endl; // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaed63e4c2baaa50d782e8ebb7643def19
+		}
+		if (!dbus_reply_Signature.compare("a{oa{sa{sv}}}"))
+		{
+			DBusMessageIter root_iter;
+			dbus_message_iter_init(dbus_reply, &root_iter);
+			do {
+				DBusMessageIter array1_iter;
+				dbus_message_iter_recurse(&root_iter, &array1_iter);
+				do {
+					indent += 4;
+					DBusMessageIter dict1_iter;
+					dbus_message_iter_recurse(&array1_iter, &dict1_iter);
+					DBusBasicValue value;
+					dbus_message_iter_get_basic(&dict1_iter, &value);
+					std::string dict1_object_path(value.str);
+					if (ConsoleVerbosity > 1)
+						ssOutput << "[                   ] " << std::right << std::setw(indent) << "Object Path: " << dict1_object_path << std::endl;
+					dbus_message_iter_next(&dict1_iter);
+					DBusMessageIter array2_iter;
+					dbus_message_iter_recurse(&dict1_iter, &array2_iter);
+					do
+					{
+						DBusMessageIter dict2_iter;
+						dbus_message_iter_recurse(&array2_iter, &dict2_iter);
+						dbus_message_iter_get_basic(&dict2_iter, &value);
+						std::string dict2_string(value.str);
+						if (ConsoleVerbosity > 1)
+							ssOutput << "[                   ] " << std::right << std::setw(indent) << "String: " << dict2_string << std::endl;
+						if (!dict2_string.compare("org.bluez.Adapter1"))
+						{
+							indent += 4;
+							dbus_message_iter_next(&dict2_iter);
+							DBusMessageIter array3_iter;
+							dbus_message_iter_recurse(&dict2_iter, &array3_iter);
+							do {
+								DBusMessageIter dict3_iter;
+								dbus_message_iter_recurse(&array3_iter, &dict3_iter);
+								dbus_message_iter_get_basic(&dict3_iter, &value);
+								std::string dict3_string(value.str);
+								if (!dict3_string.compare("Address"))
+								{
+									dbus_message_iter_next(&dict3_iter);
+									if (DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(&dict3_iter))
+									{
+										// recurse into variant to get string
+										DBusMessageIter variant_iter;
+										dbus_message_iter_recurse(&dict3_iter, &variant_iter);
+										if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&variant_iter))
+										{
+											dbus_message_iter_get_basic(&variant_iter, &value);
+											std::string Address(value.str);
+											if (ConsoleVerbosity > 1)
+												ssOutput << "[                   ] " << std::right << std::setw(indent) << "Address: " << Address << std::endl;
+											bdaddr_t localBTAddress(string2ba(Address));
+											AdapterMap.insert(std::pair<bdaddr_t, std::string>(localBTAddress, dict1_object_path));
+										}
+									}
+								}
+							} while (dbus_message_iter_next(&array3_iter));
+							indent -= 4;
+						}
+					} while (dbus_message_iter_next(&array2_iter));
+					indent -= 4;
+				} while (dbus_message_iter_next(&array1_iter));
+			} while (dbus_message_iter_next(&root_iter));
 		}
 	}
 	for (const auto& [key, value] : AdapterMap)
@@ -503,73 +1687,32 @@ bool bluez_find_adapters(DBusConnection* dbus_conn, std::map<bdaddr_t, std::stri
 		std::cerr << ssOutput.str();
 	return(!AdapterMap.empty());
 }
-bool bluez_power_on(DBusConnection* dbus_conn, const char* adapter_path, const bool PowerOn = true)
+bool bluez_power_on(DBusConnection* dbus_conn, const char* adapter_path, DBusReplyHandler Handler, const bool PowerOn = true)
 {
-	bool rVal(true);
-	std::ostringstream ssOutput;
 	// This was hacked from looking at https://git.kernel.org/pub/scm/network/connman/connman.git/tree/gdbus/client.c#n667
 	// https://www.mankier.com/5/org.bluez.Adapter#Interface-boolean_Powered_%5Breadwrite%5D
 	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.freedesktop.DBus.Properties", "Set"); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga98ddc82450d818138ef326a284201ee0
-	if (!dbus_msg)
-	{
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << "Can't allocate dbus_message_new_method_call: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
-	}
-	else
+	const char* powered = "Powered";
+	if (dbus_msg)
 	{
 		DBusMessageIter iterParameter;
 		dbus_message_iter_init_append(dbus_msg, &iterParameter); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf733047c467ce21f4a53b65a388f1e9d
 		const char* adapter = "org.bluez.Adapter1";
 		dbus_message_iter_append_basic(&iterParameter, DBUS_TYPE_STRING, &adapter); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga17491f3b75b3203f6fc47dcc2e3b221b
-		const char* powered = "Powered";
 		dbus_message_iter_append_basic(&iterParameter, DBUS_TYPE_STRING, &powered);
 		DBusMessageIter variant;
 		dbus_message_iter_open_container(&iterParameter, DBUS_TYPE_VARIANT, DBUS_TYPE_BOOLEAN_AS_STRING, &variant); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga943150f4e87fd8507da224d22c266100
 		dbus_bool_t cpTrue = PowerOn ? TRUE : FALSE;
 		dbus_message_iter_append_basic(&variant, DBUS_TYPE_BOOLEAN, &cpTrue);
 		dbus_message_iter_close_container(&iterParameter, &variant); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf00482f63d4af88b7851621d1f24087a
-
-		// Initialize D-Bus error
-		DBusError dbus_error;
-		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_USE_DEFAULT, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga8d6431f17a9e53c9446d87c2ba8409f0
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << dbus_message_get_path(dbus_msg) << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg) << powered << ": " << std::boolalpha << PowerOn;
-		if (!dbus_reply)
-		{
-			if (dbus_error_is_set(&dbus_error))
-			{
-				ssOutput << " Error: " << dbus_error.message << " " << __FILE__ << "(" << __LINE__ << ")";
-				dbus_error_free(&dbus_error);
-				rVal = false;
-			}
-		}
-		else
-			dbus_message_unref(dbus_reply);
-		dbus_message_unref(dbus_msg);  // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gab69441efe683918f6a82469c8763f464
-		ssOutput << std::endl;
 	}
-	if (ConsoleVerbosity > 0)
-		std::cout << ssOutput.str();
-	else
-		std::cerr << ssOutput.str();
-	return(rVal);
+	return(dbus_call_async(dbus_conn, dbus_msg, Handler, std::string(powered) + (PowerOn ? ": true" : ": false")));
 }
-bool bluez_filter_le(DBusConnection* dbus_conn, const char* adapter_path, const bool DuplicateData = true, const bool bFilter = true)
+bool bluez_filter_le(DBusConnection* dbus_conn, const char* adapter_path, DBusReplyHandler Handler, const bool DuplicateData = true, const bool bFilter = true)
 {
-	bool rVal(true);
-	std::ostringstream ssOutput;
 	// https://www.mankier.com/5/org.bluez.Adapter#Interface-void_SetDiscoveryFilter(dict_filter)
 	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.bluez.Adapter1", "SetDiscoveryFilter");
-	if (!dbus_msg)
-	{
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << "Can't allocate dbus_message_new_method_call: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
-	}
-	else
+	if (dbus_msg)
 	{
 		if (bFilter)
 		{
@@ -617,287 +1760,330 @@ bool bluez_filter_le(DBusConnection* dbus_conn, const char* adapter_path, const
 			dbus_message_iter_close_container(&iterArray, &iterDict);
 			dbus_message_iter_close_container(&iterParameter, &iterArray);
 		}
-		// Initialize D-Bus error
-		DBusError dbus_error;
-		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_INFINITE, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga8d6431f17a9e53c9446d87c2ba8409f0
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << dbus_message_get_path(dbus_msg) << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg);
-		if (!dbus_reply)
-		{
-			if (dbus_error_is_set(&dbus_error))
-			{
-				ssOutput << " Error: " << dbus_error.message << " " << __FILE__ << "(" << __LINE__ << ")";
-				dbus_error_free(&dbus_error);
-				rVal = false;
-			}
-		}
-		else
-			dbus_message_unref(dbus_reply);
-		dbus_message_unref(dbus_msg);
-		ssOutput << std::endl;
 	}
-	if (ConsoleVerbosity > 0)
-		std::cout << ssOutput.str();
-	else
-		std::cerr << ssOutput.str();
-	return(rVal);
+	return(dbus_call_async(dbus_conn, dbus_msg, Handler));
 }
-bool bluez_discovery(DBusConnection* dbus_conn, const char* adapter_path, const bool bStartDiscovery = true)
+bool bluez_discovery(DBusConnection* dbus_conn, const char* adapter_path, DBusReplyHandler Handler, const bool bStartDiscovery = true)
 {
-	bool bStarted = false;
 	// https://git.kernel.org/pub/scm/bluetooth/bluez.git/tree/doc/adapter-api.txt
 	// https://git.kernel.org/pub/scm/bluetooth/bluez.git/tree/doc/org.bluez.Adapter.rst
-	std::ostringstream ssOutput;
 	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.bluez.Adapter1", bStartDiscovery ? "StartDiscovery" : "StopDiscovery");
-	if (!dbus_msg)
-	{
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << "Can't allocate dbus_message_new_method_call: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
-	}
-	else
-	{
-		DBusError dbus_error;
-		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_INFINITE, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga8d6431f17a9e53c9446d87c2ba8409f0
-		if (ConsoleVerbosity > 0)
-			ssOutput << "[                   ] ";
-		ssOutput << dbus_message_get_path(dbus_msg) << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg);
-		if (!dbus_reply)
-		{
-			if (dbus_error_is_set(&dbus_error))
-			{
-				ssOutput << ": Error: " << dbus_error.message << " " << __FILE__ << "(" << __LINE__ << ")";
-				dbus_error_free(&dbus_error);
-			}
-		}
-		else
-		{
-			bStarted = bStartDiscovery;
-			dbus_message_unref(dbus_reply);
-		}
-		dbus_message_unref(dbus_msg);
-		ssOutput << std::endl;
-	}
-	if (ConsoleVerbosity > 0)
-		std::cout << ssOutput.str();
-	else
-		std::cerr << ssOutput.str();
-	return(bStarted);
+	return(dbus_call_async(dbus_conn, dbus_msg, Handler));
 }
 /////////////////////////////////////////////////////////////////////////////
-union VictronExtraData_t {
-	uint8_t rawbytes[20];
-	struct __attribute__((packed))
-	{
-		unsigned int device_state : 8;
-		unsigned int charger_error : 8;
-		int battery_voltage : 16;
-		int battery_current : 16;
-		unsigned int yield_today : 16;
-		unsigned int pv_power : 16;
-		unsigned int load_current : 9;
-		//unsigned int unused : 39;
-	} SolarCharger;  // 0x01
-	struct __attribute__((packed))
-	{
-		unsigned int ttg : 16;
-		unsigned int battery_voltage : 16;
-		unsigned int alarm_reason : 16;
-		unsigned int aux_voltage : 16;
-		unsigned int mid_voltage : 16;
-		unsigned int temperature : 16;
-		unsigned int aux_input : 2;
-		unsigned int battery_current : 22;
-		unsigned int consumed_ah : 20;
-		unsigned int soc : 10;
-		//unsigned int unused : 10;
-	} BatteryMonitor; // 0x02
-	struct __attribute__((packed))
-	{
-		unsigned int device_state : 8;
-		unsigned int charger_error : 8;
-		unsigned int input_voltage : 16;
-		unsigned int output_voltage : 16;
-		unsigned int off_reason : 32;
-		//unsigned int unused : 48;
-	} DCDCConverter; // 0x04
-	struct __attribute__((packed))
-	{
-		unsigned int bms_flags : 32;
-		unsigned int smartlithium_error : 16;
-		unsigned int cell_1 : 7;
-		unsigned int cell_2 : 7;
-		unsigned int cell_3 : 7;
-		unsigned int cell_4 : 7;
-		unsigned int cell_5 : 7;
-		unsigned int cell_6 : 7;
-		unsigned int cell_7 : 7;
-		unsigned int cell_8 : 7;
-		unsigned int battery_voltage : 12;
-		unsigned int balancer_status : 4;
-		unsigned int battery_temperature : 7;
-		//unsigned int unused : 1;
-	} SmartLithium;  // 0x05
-	struct __attribute__((packed))
-	{
-		unsigned int error : 8;
-		unsigned int ttg : 16;
-		unsigned int battery_voltage : 16;
-		unsigned int battery_current : 16;
-		unsigned int io_status : 16;
-		unsigned int warnings : 18;
-		unsigned int soc : 10;
-		unsigned int consumed_ah : 20;
-		unsigned int temperature : 7;
-		//unsigned int unused : 1;
-	} LynxSmartBMS; // 0x0a
-	struct __attribute__((packed))
-	{
-		unsigned int device_state : 8;
-		unsigned int charger_error : 8;
-		unsigned int output_voltage : 16;
-		unsigned int output_current : 16;
-		unsigned int input_voltage : 16;
-		unsigned int input_current : 16;
-		unsigned int off_reason : 32;
-		//unsigned int unused : 16;
-	} OrionXS; // 0x0F
+// Victron bit packs the extra manufacturer data least significant bit first, starting at byte 8 of the manufacturer data.
+// Each record type is described by a table of its fields, taken from extra-manufacturer-data-2022-12-14.pdf and the tables in README.md,
+// and every field is read the same way so the layout doesn't depend on how the compiler lays out bit-fields or on the host byte order.
+const int64_t VictronFieldNA(-1); // the field has no "not available" value, every raw value is valid
+struct VictronField {
+	const char* Name;
+	unsigned Bit; // first bit, counted from the least significant bit of the first byte of extra data
+	unsigned Width; // at most 32 bits
+	bool Signed; // two's complement
+	double Scale;
+	double Offset; // added after scaling
+	int64_t NotAvailable; // raw value sent when the device doesn't have the value, or VictronFieldNA
+	const char* Units; // fields without units are flags or enumerations, and are shown in hex
+	int Selector = -1; // index of a field in the same record that says whether this one is sent, some fields share their bits
+	uint32_t SelectorValue = 0;
 };
-struct __attribute__((packed)) VictronManufacturerData_t {
-	uint8_t ManufacturerRecordType;
-	uint16_t ModelID;
-	uint8_t ReadoutType;
-	uint8_t RecordType;
-	uint16_t InitializationVector;
-	uint8_t FirstByteDecryptionKey;
-	VictronExtraData_t ExtraData;
+constexpr VictronField VictronSolarChargerFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Charger error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Battery voltage", 16, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Battery current", 32, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "Yield today", 48, 16, false, 0.01, 0, 0xFFFF, "kWh" },
+	{ "PV power", 64, 16, false, 1, 0, 0xFFFF, "W" },
+	{ "Load current", 80, 9, false, 0.1, 0, 0x1FF, "A" },
 };
-/////////////////////////////////////////////////////////////////////////////
-class VictronSmartLithium
-{
-public:
-	VictronSmartLithium() : Time(0), Cell { 0 }, Voltage(0), Temperature(0), TemperatureMin(DBL_MAX), TemperatureMax(-DBL_MAX), Averages(0) { };
-	VictronSmartLithium(const std::string& data); // This is for reading from log file
-	time_t Time;
-	bool ReadManufacturerData(const std::vector<uint8_t> & ManufacturerData, const time_t newtime = 0);
-	bool ReadManufacturerData(const std::string& data, const time_t newtime = 0);
-	std::string WriteConsole(void) const;
-	std::string WriteCache(void) const;
-	bool ReadCache(const std::string& data);
-	bool IsValid(void) const { return(Averages > 0); };
-	enum granularity { day, week, month, year };
-	void NormalizeTime(granularity type);
-	granularity GetTimeGranularity(void) const;
-	VictronSmartLithium& operator +=(const VictronSmartLithium& b);
-	unsigned GetCellCount(void) const { return (4); }; //TODO: calculate this
-	double GetCellVoltage(const unsigned index) const { return(Cell[std::max(index, GetCellCount()-1)]); };
-	double GetVoltage(void) const { return(Voltage); };
-	double GetTemperature(const bool Fahrenheit = false) const { if (Fahrenheit) return((Temperature * 9.0 / 5.0) + 32.0); return(Temperature); };
-	double GetTemperatureMin(const bool Fahrenheit = false) const { if (Fahrenheit) return(std::min(((Temperature * 9.0 / 5.0) + 32.0), ((TemperatureMin * 9.0 / 5.0) + 32.0))); return(std::min(Temperature, TemperatureMin)); };
-	double GetTemperatureMax(const bool Fahrenheit = false) const { if (Fahrenheit) return(std::max(((Temperature * 9.0 / 5.0) + 32.0), ((TemperatureMax * 9.0 / 5.0) + 32.0))); return(std::max(Temperature, TemperatureMax)); };
-protected:
-	double Cell[8];
-	double Voltage;
-	double Temperature;
-	double TemperatureMin;
-	double TemperatureMax;
-	int Averages;
+constexpr VictronField VictronBatteryMonitorFields[] = {
+	{ "TTG", 0, 16, false, 1, 0, 0xFFFF, "min" },
+	{ "Battery voltage", 16, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Alarm reason", 32, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Aux voltage", 48, 16, true, 0.01, 0, VictronFieldNA, "V", 6, 0 },
+	{ "Mid voltage", 48, 16, false, 0.01, 0, VictronFieldNA, "V", 6, 1 },
+	{ "Temperature", 48, 16, false, 0.01, -273.15, VictronFieldNA, "\u00B0" "C", 6, 2 },
+	{ "Aux input", 64, 2, false, 1, 0, 0x3, "" },
+	{ "Battery current", 66, 22, true, 0.001, 0, 0x3FFFFF, "A" },
+	{ "Consumed", 88, 20, false, -0.1, 0, 0xFFFFF, "Ah" },
+	{ "SOC", 108, 10, false, 0.1, 0, 0x3FF, "%" },
+};
+constexpr VictronField VictronInverterFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Alarm reason", 8, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Battery voltage", 24, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "AC apparent power", 40, 16, false, 1, 0, 0xFFFF, "VA" },
+	{ "AC voltage", 56, 15, false, 0.01, 0, 0x7FFF, "V" },
+	{ "AC current", 71, 11, false, 0.1, 0, 0x7FF, "A" },
+};
+constexpr VictronField VictronDCDCConverterFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Charger error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Input voltage", 16, 16, false, 0.01, 0, 0xFFFF, "V" },
+	{ "Output voltage", 32, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Off reason", 48, 32, false, 1, 0, VictronFieldNA, "" },
+};
+constexpr VictronField VictronSmartLithiumFields[] = {
+	{ "BMS flags", 0, 32, false, 1, 0, VictronFieldNA, "" },
+	{ "SmartLithium error", 32, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Cell 1", 48, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 2", 55, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 3", 62, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 4", 69, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 5", 76, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 6", 83, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 7", 90, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Cell 8", 97, 7, false, 0.01, 2.60, 0x7F, "V" },
+	{ "Battery voltage", 104, 12, false, 0.01, 0, 0x0FFF, "V" },
+	{ "Balancer status", 116, 4, false, 1, 0, 0x0F, "" },
+	{ "Battery temperature", 120, 7, false, 1, -40, 0x7F, "\u00B0" "C" },
+};
+constexpr VictronField VictronInverterRSFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Charger error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Battery voltage", 16, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Battery current", 32, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "PV power", 48, 16, false, 1, 0, 0xFFFF, "W" },
+	{ "Yield today", 64, 16, false, 0.01, 0, 0xFFFF, "kWh" },
+	{ "AC out power", 80, 16, true, 1, 0, 0x7FFF, "W" },
+};
+constexpr VictronField VictronGXDeviceFields[] = {
+	{ "Battery voltage", 0, 16, false, 0.01, 0, 0xFFFF, "V" },
+	{ "PV power", 16, 20, false, 1, 0, 0xFFFFF, "W" },
+	{ "SOC", 36, 7, false, 1, 0, 0x7F, "%" },
+	{ "Battery power", 43, 21, true, 1, 0, 0x0FFFFF, "W" },
+	{ "DC power", 64, 21, true, 1, 0, 0x0FFFFF, "W" },
+};
+constexpr VictronField VictronACChargerFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Charger error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Battery voltage 1", 16, 13, false, 0.01, 0, 0x1FFF, "V" },
+	{ "Battery current 1", 29, 11, false, 0.1, 0, 0x7FF, "A" },
+	{ "Battery voltage 2", 40, 13, false, 0.01, 0, 0x1FFF, "V" },
+	{ "Battery current 2", 53, 11, false, 0.1, 0, 0x7FF, "A" },
+	{ "Battery voltage 3", 64, 13, false, 0.01, 0, 0x1FFF, "V" },
+	{ "Battery current 3", 77, 11, false, 0.1, 0, 0x7FF, "A" },
+	{ "Temperature", 88, 7, false, 1, -40, 0x7F, "\u00B0" "C" },
+	{ "AC current", 95, 9, false, 0.1, 0, 0x1FF, "A" },
+};
+constexpr VictronField VictronSmartBatteryProtectFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Output state", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Error code", 16, 8, false, 1, 0, 0xFF, "" },
+	{ "Alarm reason", 24, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Warning reason", 40, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Input voltage", 56, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Output voltage", 72, 16, false, 0.01, 0, 0xFFFF, "V" },
+	{ "Off reason", 88, 32, false, 1, 0, VictronFieldNA, "" },
+};
+constexpr VictronField VictronLynxSmartBMSFields[] = {
+	{ "Error", 0, 8, false, 1, 0, VictronFieldNA, "" },
+	{ "TTG", 8, 16, false, 1, 0, 0xFFFF, "min" },
+	{ "Battery voltage", 24, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Battery current", 40, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "IO status", 56, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Warnings/Alarms", 72, 18, false, 1, 0, VictronFieldNA, "" },
+	{ "SOC", 90, 10, false, 0.1, 0, 0x3FF, "%" },
+	{ "Consumed", 100, 20, false, -0.1, 0, 0xFFFFF, "Ah" },
+	{ "Temperature", 120, 7, false, 1, -40, 0x7F, "\u00B0" "C" },
+};
+constexpr VictronField VictronMultiRSFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "Charger error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Battery current", 16, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "Battery voltage", 32, 14, false, 0.01, 0, 0x3FFF, "V" },
+	{ "Active AC in", 46, 2, false, 1, 0, 0x3, "" },
+	{ "Active AC in power", 48, 16, true, 1, 0, 0x7FFF, "W" },
+	{ "AC out power", 64, 16, true, 1, 0, 0x7FFF, "W" },
+	{ "PV power", 80, 16, false, 1, 0, 0xFFFF, "W" },
+	{ "Yield today", 96, 16, false, 0.01, 0, 0xFFFF, "kWh" },
+};
+constexpr VictronField VictronVEBusFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, 0xFF, "" },
+	{ "VE.Bus error", 8, 8, false, 1, 0, 0xFF, "" },
+	{ "Battery current", 16, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "Battery voltage", 32, 14, false, 0.01, 0, 0x3FFF, "V" },
+	{ "Active AC in", 46, 2, false, 1, 0, 0x3, "" },
+	{ "Active AC in power", 48, 19, true, 1, 0, 0x3FFFF, "W" },
+	{ "AC out power", 67, 19, true, 1, 0, 0x3FFFF, "W" },
+	{ "Alarm", 86, 2, false, 1, 0, 0x3, "" },
+	{ "Battery temperature", 88, 7, false, 1, -40, 0x7F, "\u00B0" "C" },
+	{ "SOC", 95, 7, false, 1, 0, 0x7F, "%" },
+};
+constexpr VictronField VictronDCEnergyMeterFields[] = {
+	{ "BMV monitor mode", 0, 16, true, 1, 0, VictronFieldNA, "" },
+	{ "Battery voltage", 16, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Alarm reason", 32, 16, false, 1, 0, VictronFieldNA, "" },
+	{ "Aux voltage", 48, 16, true, 0.01, 0, VictronFieldNA, "V", 5, 0 },
+	{ "Temperature", 48, 16, false, 0.01, -273.15, VictronFieldNA, "\u00B0" "C", 5, 2 },
+	{ "Aux input", 64, 2, false, 1, 0, 0x3, "" },
+	{ "Battery current", 66, 22, true, 0.001, 0, 0x3FFFFF, "A" },
+};
+constexpr VictronField VictronOrionXSFields[] = {
+	{ "Device state", 0, 8, false, 1, 0, VictronFieldNA, "" },
+	{ "Error code", 8, 8, false, 1, 0, VictronFieldNA, "" },
+	{ "Output voltage", 16, 16, true, 0.01, 0, 0x7FFF, "V" },
+	{ "Output current", 32, 16, true, 0.1, 0, 0x7FFF, "A" },
+	{ "Input voltage", 48, 16, false, 0.01, 0, 0xFFFF, "V" },
+	{ "Input current", 64, 16, false, 0.1, 0, 0xFFFF, "A" },
+	{ "Off reason", 80, 32, false, 1, 0, VictronFieldNA, "" },
+};
+struct VictronRecordType {
+	uint8_t RecordType; // byte 4 of the manufacturer data
+	const char* Name;
+	const VictronField* Fields;
+	size_t FieldCount;
 };
-VictronSmartLithium::VictronSmartLithium(const std::string& data)
-{
-	for (auto& a : Cell)
-		a = 0;
-	Averages = 0;
-	std::istringstream TheLine(data);
-	// erase any nulls from the data. these are occasionally in the log file when the platform crashed during a write to the logfile.
-	while (TheLine.peek() == '\000')
-		TheLine.get();
-	std::string theDate;
-	TheLine >> theDate;
-	Time = ISO8601totime(theDate);
-	std::string ManufacturerData;
-	TheLine >> ManufacturerData;
-	ReadManufacturerData(ManufacturerData);
-}
-bool VictronSmartLithium::ReadManufacturerData(const std::vector<uint8_t>& ManufacturerData, const time_t newtime)
+#define VICTRON_RECORD_TYPE(RecordType, Name, Fields) { RecordType, Name, Fields, sizeof(Fields) / sizeof(Fields[0]) }
+constexpr VictronRecordType VictronRecordTypes[] = {
+	VICTRON_RECORD_TYPE(0x01, "Solar Charger", VictronSolarChargerFields),
+	VICTRON_RECORD_TYPE(0x02, "Battery Monitor", VictronBatteryMonitorFields),
+	VICTRON_RECORD_TYPE(0x03, "Inverter", VictronInverterFields),
+	VICTRON_RECORD_TYPE(0x04, "DC/DC", VictronDCDCConverterFields),
+	VICTRON_RECORD_TYPE(0x05, "SmartLithium", VictronSmartLithiumFields),
+	VICTRON_RECORD_TYPE(0x06, "Inverter RS", VictronInverterRSFields),
+	VICTRON_RECORD_TYPE(0x07, "GX-Device", VictronGXDeviceFields),
+	VICTRON_RECORD_TYPE(0x08, "AC Charger", VictronACChargerFields),
+	VICTRON_RECORD_TYPE(0x09, "Smart Battery Protect", VictronSmartBatteryProtectFields),
+	VICTRON_RECORD_TYPE(0x0A, "Lynx Smart BMS", VictronLynxSmartBMSFields),
+	VICTRON_RECORD_TYPE(0x0B, "Multi RS", VictronMultiRSFields),
+	VICTRON_RECORD_TYPE(0x0C, "VE.Bus", VictronVEBusFields),
+	VICTRON_RECORD_TYPE(0x0D, "DC Energy Meter", VictronDCEnergyMeterFields),
+	VICTRON_RECORD_TYPE(0x0F, "Orion XS", VictronOrionXSFields),
+};
+#undef VICTRON_RECORD_TYPE
+// Checked when compiling, so a typo in a table can't read past the 16 bytes of extra data or make a selector point at the wrong field.
+constexpr bool VictronRecordTypesValid(void)
 {
-	bool rval = false;
-	if (ManufacturerData.size() >= 8 + sizeof(VictronExtraData_t::SmartLithium)) // Make sure data is big enough to be valid
-	{
-		if ((ManufacturerData[4] == 0x05) && // make sure it's a smartlithium device
-			(ManufacturerData[5] == 0) &&
-			(ManufacturerData[6] == 0) &&
-			(ManufacturerData[7] == 0)) // make sure it's already been decrypted
+	for (auto& Record : VictronRecordTypes)
+		for (size_t index = 0; index < Record.FieldCount; index++)
 		{
-			if (newtime != 0)
-				Time = newtime;
-			VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-			if (ExtraDataPtr->SmartLithium.cell_1 != 0x7f) Cell[0] = double(ExtraDataPtr->SmartLithium.cell_1) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_2 != 0x7f) Cell[1] = double(ExtraDataPtr->SmartLithium.cell_2) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_3 != 0x7f) Cell[2] = double(ExtraDataPtr->SmartLithium.cell_3) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_4 != 0x7f) Cell[3] = double(ExtraDataPtr->SmartLithium.cell_4) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_5 != 0x7f) Cell[4] = double(ExtraDataPtr->SmartLithium.cell_5) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_6 != 0x7f) Cell[5] = double(ExtraDataPtr->SmartLithium.cell_6) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_7 != 0x7f) Cell[6] = double(ExtraDataPtr->SmartLithium.cell_7) * 0.01 + 2.60;
-			if (ExtraDataPtr->SmartLithium.cell_8 != 0x7f) Cell[7] = double(ExtraDataPtr->SmartLithium.cell_8) * 0.01 + 2.60;
-			Voltage = double(ExtraDataPtr->SmartLithium.battery_voltage) * 0.01;
-			Temperature = ExtraDataPtr->SmartLithium.battery_temperature - 40;
-			TemperatureMin = TemperatureMax = Temperature;
-			Averages = 1;
-			rval = true;
+			const VictronField& Field(Record.Fields[index]);
+			if ((Field.Width == 0) || (Field.Width > 32) || (Field.Bit + Field.Width > 128))
+				return(false);
+			if ((Field.Selector >= 0) && ((size_t(Field.Selector) >= Record.FieldCount) || (Record.Fields[Field.Selector].Selector >= 0)))
+				return(false);
 		}
-	}
-	return(rval);
+	return(true);
 }
-bool VictronSmartLithium::ReadManufacturerData(const std::string& data, const time_t newtime)
+static_assert(VictronRecordTypesValid(), "Victron field tables must fit in 128 bits and selectors must name a plain field");
+constexpr const VictronRecordType* GetVictronRecordType(const uint8_t RecordType)
 {
-	std::vector<uint8_t> ManufacturerData;
-	for (auto i = 0; i < data.length(); i += 2) 
-		ManufacturerData.push_back(std::stoi(data.substr(i, 2), nullptr, 16));
-	return(ReadManufacturerData(ManufacturerData, newtime));
+	for (auto& Record : VictronRecordTypes)
+		if (Record.RecordType == RecordType)
+			return(&Record);
+	return(nullptr);
 }
-std::string VictronSmartLithium::WriteConsole(void) const
+// The number of bytes of extra data needed to hold every field of the record
+constexpr size_t VictronRecordLength(const VictronField* Fields, const size_t FieldCount)
 {
-	std::ostringstream ssValue;
-	ssValue << " (SmartLithium)";
-	for (auto& a : Cell)
-		if (a != 0)
-			ssValue << " Cell: " << a << "V";
-	ssValue << " Voltage: " << Voltage << "V";
-	ssValue << " Temperature: " << Temperature << "\u00B0" << "C";
-	return(ssValue.str());
+	size_t Bits(0);
+	for (size_t index = 0; index < FieldCount; index++)
+		Bits = std::max(Bits, size_t(Fields[index].Bit + Fields[index].Width));
+	return((Bits + 7) / 8);
+}
+// Reads Width bits starting at Bit, least significant bit first. Fields are at most 32 bits, so with the offset into the first byte they fit in five bytes.
+constexpr uint32_t VictronBits(const uint8_t* ExtraData, const unsigned Bit, const unsigned Width)
+{
+	uint64_t Value(0);
+	for (unsigned index = 0; index < ((Bit % 8) + Width + 7) / 8; index++)
+		Value |= uint64_t(ExtraData[Bit / 8 + index]) << (8 * index);
+	return(uint32_t((Value >> (Bit % 8)) & ((uint64_t(1) << Width) - 1)));
+}
+constexpr int64_t VictronFieldRaw(const VictronField& Field, const uint8_t* ExtraData)
+{
+	const uint32_t Raw(VictronBits(ExtraData, Field.Bit, Field.Width));
+	if (Field.Signed && (Raw & (uint32_t(1) << (Field.Width - 1))))
+		return(int64_t(Raw) - (int64_t(1) << Field.Width));
+	return(Raw);
+}
+constexpr uint8_t VictronBitsTest[] = { 0x34, 0x12, 0xF0, 0xFF, 0x00 };
+static_assert(VictronBits(VictronBitsTest, 0, 16) == 0x1234, "little endian bytes");
+static_assert(VictronBits(VictronBitsTest, 12, 12) == 0xF01, "fields that start and end inside a byte");
+static_assert(VictronBits(VictronBitsTest, 4, 32) == 0x0FFF0123, "32 bit fields that span five bytes");
+static_assert(VictronFieldRaw({ "", 16, 16, true, 1, 0, VictronFieldNA, "" }, VictronBitsTest) == -16, "sign extension");
+static_assert(VictronFieldRaw({ "", 24, 7, false, 1, 0, VictronFieldNA, "" }, VictronBitsTest) == 0x7F, "unsigned fields are not extended");
+// True if the field was sent and fits in Length bytes, and gives its value in Units.
+inline bool VictronFieldValue(const VictronField& Field, const uint8_t* ExtraData, const size_t Length, double& Value)
+{
+	if (Field.Bit + Field.Width > 8 * Length)
+		return(false);
+	if ((Field.NotAvailable != VictronFieldNA) && (VictronBits(ExtraData, Field.Bit, Field.Width) == uint32_t(Field.NotAvailable)))
+		return(false);
+	Value = double(VictronFieldRaw(Field, ExtraData)) * Field.Scale + Field.Offset;
+	return(true);
+}
+// The classes that store a record type read each field through this. Fields[Index] is a constant, so the compiler builds a reader with the shifts and masks for that one field.
+template <const VictronField* Fields, size_t Index>
+inline bool VictronFieldValue(const uint8_t* ExtraData, const size_t Length, double& Value)
+{
+	constexpr VictronField Field(Fields[Index]);
+	return(VictronFieldValue(Field, ExtraData, Length, Value));
+}
+// The offset as a whole number of steps of Scale, 2.60V is 260 steps of 0.01V
+constexpr int64_t VictronFieldOffsetSteps(const VictronField& Field)
+{
+	return(int64_t(Field.Offset / Field.Scale + ((Field.Offset < 0) ? -0.5 : 0.5)));
+}
+// The same value as a whole number of steps of Scale, so classes that store samples can add them up exactly and only turn them into Units to show them.
+template <const VictronField* Fields, size_t Index>
+inline bool VictronFieldSteps(const uint8_t* ExtraData, const size_t Length, int32_t& Steps)
+{
+	constexpr VictronField Field(Fields[Index]);
+	static_assert((VictronFieldOffsetSteps(Field) * Field.Scale - Field.Offset < 1e-9) && (VictronFieldOffsetSteps(Field) * Field.Scale - Field.Offset > -1e-9), "the offset must be a whole number of steps");
+	if (Field.Bit + Field.Width > 8 * Length)
+		return(false);
+	if ((Field.NotAvailable != VictronFieldNA) && (VictronBits(ExtraData, Field.Bit, Field.Width) == uint32_t(Field.NotAvailable)))
+		return(false);
+	Steps = int32_t(VictronFieldRaw(Field, ExtraData) + VictronFieldOffsetSteps(Field));
+	return(true);
 }
-std::string VictronSmartLithium::WriteCache(void) const
+// Every field the record sent, for the console. Record types without a table just show their name.
+std::string VictronWriteConsole(const uint8_t RecordType, const uint8_t* ExtraData, const size_t Length)
 {
 	std::ostringstream ssValue;
-	ssValue << Time;
-	ssValue << "\t" << Averages;
-	for (auto& a : Cell)
-		ssValue << "\t" << a;
-	ssValue << "\t" << Voltage;
-	ssValue << "\t" << Temperature;
-	ssValue << "\t" << TemperatureMin;
-	ssValue << "\t" << TemperatureMax;
+	const VictronRecordType* Record(GetVictronRecordType(RecordType));
+	if (Record == nullptr)
+		ssValue << " (Record type 0x" << std::hex << std::setfill('0') << std::setw(2) << int(RecordType) << ")";
+	else
+	{
+		ssValue << " (" << Record->Name << ")";
+		for (size_t index = 0; index < Record->FieldCount; index++)
+		{
+			const VictronField& Field(Record->Fields[index]);
+			double Value;
+			if (((Field.Selector < 0) || (VictronBits(ExtraData, Record->Fields[Field.Selector].Bit, Record->Fields[Field.Selector].Width) == Field.SelectorValue)) &&
+				VictronFieldValue(Field, ExtraData, Length, Value))
+			{
+				ssValue << " " << Field.Name << ": ";
+				if (*Field.Units == '\0')
+					ssValue << "0x" << std::hex << std::setfill('0') << std::setw((Field.Width + 3) / 4) << VictronBits(ExtraData, Field.Bit, Field.Width) << std::dec;
+				else
+					ssValue << Value << Field.Units;
+			}
+		}
+	}
 	return(ssValue.str());
 }
-bool VictronSmartLithium::ReadCache(const std::string& data)
+/////////////////////////////////////////////////////////////////////////////
+// What every sample type shares: the time, how many samples were added together, and the MRTG time buckets.
+class VictronSample
 {
-	bool rval = false;
-	std::istringstream ssValue(data);
-	ssValue >> Time;
-	ssValue >> Averages;
-	for (auto& a : Cell)
-		ssValue >> a;
-	ssValue >> Voltage;
-	ssValue >> Temperature;
-	ssValue >> TemperatureMin;
-	ssValue >> TemperatureMax;
-	return(rval);
-}
-void VictronSmartLithium::NormalizeTime(granularity type)
+public:
+	time_t Time;
+	bool IsValid(void) const { return(Averages > 0); };
+	enum granularity { day, week, month, year };
+	void NormalizeTime(granularity type);
+	granularity GetTimeGranularity(void) const;
+protected:
+	VictronSample() : Time(0), Averages(0) { };
+	uint32_t Averages;
+	double Mean(const int64_t Sum, const double Step) const { return(IsValid() ? double(Sum) * Step / Averages : 0); };
+	bool IsDecrypted(const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const uint8_t RecordType, const size_t RecordLength) const;
+	void Add(const VictronSample& b);
+	std::string WriteCacheTime(void) const;
+};
+void VictronSample::NormalizeTime(granularity type)
 {
 	if (type == day)
 		Time = (Time / DAY_SAMPLE) * DAY_SAMPLE;
@@ -917,7 +2103,7 @@ void VictronSmartLithium::NormalizeTime(granularity type)
 		}
 	}
 }
-VictronSmartLithium::granularity VictronSmartLithium::GetTimeGranularity(void) const
+VictronSample::granularity VictronSample::GetTimeGranularity(void) const
 {
 	granularity rval = granularity::day;
 	struct tm UTC;
@@ -933,185 +2119,220 @@ VictronSmartLithium::granularity VictronSmartLithium::GetTimeGranularity(void) c
 	}
 	return(rval);
 }
-VictronSmartLithium& VictronSmartLithium::operator +=(const VictronSmartLithium& b)
+// True if the data is long enough to hold every field of the record, is the record type expected, and has already been decrypted
+bool VictronSample::IsDecrypted(const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const uint8_t RecordType, const size_t RecordLength) const
 {
-	if (b.IsValid())
+	return((ManufacturerDataLength >= 8 + RecordLength) &&
+		(ManufacturerData[4] == RecordType) &&
+		(ManufacturerData[5] == 0) &&
+		(ManufacturerData[6] == 0) &&
+		(ManufacturerData[7] == 0));
+}
+void VictronSample::Add(const VictronSample& b)
+{
+	Time = std::max(Time, b.Time); // Use the maximum time (newest time)
+	Averages += b.Averages; // existing samples + new samples
+}
+std::string VictronSample::WriteCacheTime(void) const
+{
+	std::ostringstream ssValue;
+	ssValue << Time;
+	ssValue << "\t" << Averages;
+	return(ssValue.str());
+}
+/////////////////////////////////////////////////////////////////////////////
+// A field a sample type keeps, by its index in the record type's field table, and the line it's drawn as on the graph.
+// A sample is thrown away if any field it keeps wasn't sent, so a missing value is never averaged in as zero.
+// Optional fields are the exception: a cell the battery doesn't have is never sent, so it's kept as zero and its line isn't drawn.
+struct VictronStoredField {
+	size_t Index;
+	int Axis; // 0 draws against the left axis, 1 against the right
+	const char* Color;
+	bool Optional = false;
+};
+constexpr bool VictronIsCelsius(const VictronField& Field)
+{
+	return(std::string_view(Field.Units) == "\u00B0" "C");
+}
+// Checked when compiling, so every field kept is in the table and has units, and the lines drawn against one axis all share the same units.
+constexpr bool VictronStoredFieldsValid(const VictronField* Fields, const size_t FieldCount, const VictronStoredField* Stored, const size_t StoredCount)
+{
+	for (size_t index = 0; index < StoredCount; index++)
 	{
-		Time = std::max(Time, b.Time); // Use the maximum time (newest time)
-		for (unsigned long index = 0; index < (sizeof(Cell) / sizeof(Cell[0])); index++)
-			Cell[index] = ((Cell[index] * Averages) + (b.Cell[index] * b.Averages)) / (Averages + b.Averages);
-		Voltage = ((Voltage * Averages) + (b.Voltage * b.Averages)) / (Averages + b.Averages);
-		Temperature = ((Temperature * Averages) + (b.Temperature * b.Averages)) / (Averages + b.Averages);
-		TemperatureMin = std::min(std::min(Temperature, TemperatureMin), b.TemperatureMin);
-		TemperatureMax = std::max(std::max(Temperature, TemperatureMax), b.TemperatureMax);
-		Averages += b.Averages; // existing average + new average
+		if ((Stored[index].Index >= FieldCount) || (*Fields[Stored[index].Index].Units == '\0') || (Stored[index].Axis < 0) || (Stored[index].Axis > 1))
+			return(false);
+		for (size_t other = 0; other < index; other++)
+			if ((Stored[other].Axis == Stored[index].Axis) && (std::string_view(Fields[Stored[other].Index].Units) != Fields[Stored[index].Index].Units))
+				return(false);
 	}
-	return(*this);
+	return(true);
 }
-/////////////////////////////////////////////////////////////////////////////
-class VictronOrionXS
+// Every record type that's kept and graphed is this template, given its field table and the fields it keeps.
+// The fields are kept as sums of every sample in the steps of their table entry, so combining samples is exact and doesn't depend on the order they're combined in.
+// They are only turned into units when they are shown. The cache file holds the sums in the order the fields are listed.
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+class VictronFieldSample : public VictronSample
 {
+	static_assert((GetVictronRecordType(Type) != nullptr) && (GetVictronRecordType(Type)->Fields == Fields), "the field table must be the one listed for the record type");
+	static_assert(VictronStoredFieldsValid(Fields, GetVictronRecordType(Type)->FieldCount, Stored, StoredCount), "kept fields must have units, and share them with the other fields on their axis");
 public:
-	VictronOrionXS() : Time(0), OutputVoltage(0), OutputCurrent(0), InputVoltage(0), InputCurrent(0), Averages(0) { };
-	VictronOrionXS(const std::string& data); // This is for reading from log file
-	time_t Time;
-	bool ReadManufacturerData(const std::vector<uint8_t>& ManufacturerData, const time_t newtime = 0);
-	bool ReadManufacturerData(const std::string& data, const time_t newtime = 0);
-	std::string WriteConsole(void) const;
+	VictronFieldSample() : FieldSums { 0 } { };
+	static const uint8_t RecordType = Type;
+	static constexpr const VictronStoredField* StoredFields = Stored;
+	static const size_t StoredFieldCount = StoredCount;
+	bool ReadManufacturerData(const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const time_t newtime = 0);
 	std::string WriteCache(void) const;
-	bool ReadCache(const std::string& data);
-	bool IsValid(void) const { return(Averages > 0); };
-	enum granularity { day, week, month, year };
-	void NormalizeTime(granularity type);
-	granularity GetTimeGranularity(void) const;
-	VictronOrionXS& operator +=(const VictronOrionXS& b);
-	double GetVoltageOut(void) const { return(OutputVoltage); };
-	double GetVoltageIn(void) const { return(InputVoltage); };
-	double GetCurrentOut(void) const { return(OutputCurrent); };
-	double GetCurrentIn(void) const { return(InputCurrent); };
+	bool ReadCache(const std::string& data, const bool Sums = true);
+	VictronFieldSample& operator +=(const VictronFieldSample& b);
+	static const VictronField& GetField(const size_t index) { return(Fields[Stored[index].Index]); };
+	static std::string GetUnits(const size_t index, const bool Fahrenheit = false) { return((Fahrenheit && VictronIsCelsius(GetField(index))) ? "\u00B0" "F" : GetField(index).Units); };
+	static int GetPrecision(const size_t index) { return(std::max(1, int(std::ceil(-std::log10(std::fabs(GetField(index).Scale)) - 1e-9)))); }; // enough decimals to show one step
+	double GetValue(const size_t index, const bool Fahrenheit = false) const;
 protected:
-	double OutputVoltage;
-	double OutputCurrent;
-	double InputVoltage;
-	double InputCurrent;
-	int Averages;
+	int64_t FieldSums[StoredCount];
+	template <size_t... n>
+	static bool ReadSteps(const uint8_t* ExtraData, const size_t Length, int32_t* Steps, std::index_sequence<n...>) { return((... && (VictronFieldSteps<Fields, Stored[n].Index>(ExtraData, Length, Steps[n]) || Stored[n].Optional))); };
 };
-VictronOrionXS::VictronOrionXS(const std::string& data) : Time(0), OutputVoltage(0), OutputCurrent(0), InputVoltage(0), InputCurrent(0), Averages(0)
-{
-	//Averages = 0;
-	std::istringstream TheLine(data);
-	// erase any nulls from the data. these are occasionally in the log file when the platform crashed during a write to the logfile.
-	while (TheLine.peek() == '\000')
-		TheLine.get();
-	std::string theDate;
-	TheLine >> theDate;
-	Time = ISO8601totime(theDate);
-	std::string ManufacturerData;
-	TheLine >> ManufacturerData;
-	ReadManufacturerData(ManufacturerData);
-}
-bool VictronOrionXS::ReadManufacturerData(const std::vector<uint8_t>& ManufacturerData, const time_t newtime)
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+bool VictronFieldSample<Type, Fields, Stored, StoredCount>::ReadManufacturerData(const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const time_t newtime)
 {
 	bool rval = false;
-	if (ManufacturerData.size() >= 8 + sizeof(VictronExtraData_t::OrionXS)) // Make sure data is big enough to be valid
+	if (IsDecrypted(ManufacturerData, ManufacturerDataLength, RecordType, VictronRecordLength(Fields, GetVictronRecordType(Type)->FieldCount)))
 	{
-		if ((ManufacturerData[4] == 0x0f) && // make sure it's an Orion XS
-			(ManufacturerData[5] == 0) &&
-			(ManufacturerData[6] == 0) &&
-			(ManufacturerData[7] == 0)) // make sure it's already been decrypted
+		int32_t Steps[StoredCount]{ 0 }; // optional fields that aren't sent stay zero
+		if (ReadSteps(ManufacturerData + 8, ManufacturerDataLength - 8, Steps, std::make_index_sequence<StoredCount>()))
 		{
 			if (newtime != 0)
 				Time = newtime;
-			VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-			if (ExtraDataPtr->OrionXS.output_voltage != 0x7FFF) OutputVoltage = double(ExtraDataPtr->OrionXS.output_voltage) * 0.01;
-			if (ExtraDataPtr->OrionXS.output_current != 0x7FFF) OutputCurrent = double(ExtraDataPtr->OrionXS.output_current) * 0.1;
-			if (ExtraDataPtr->OrionXS.input_voltage != 0xFFFF) InputVoltage = double(ExtraDataPtr->OrionXS.input_voltage) * 0.01;
-			if (ExtraDataPtr->OrionXS.input_current != 0xFFFF) InputCurrent = double(ExtraDataPtr->OrionXS.input_current) * 0.1;
+			for (size_t index = 0; index < StoredCount; index++)
+				FieldSums[index] = Steps[index];
 			Averages = 1;
 			rval = true;
 		}
 	}
 	return(rval);
 }
-bool VictronOrionXS::ReadManufacturerData(const std::string& data, const time_t newtime)
-{
-	std::vector<uint8_t> ManufacturerData;
-	for (auto i = 0; i < data.length(); i += 2)
-		ManufacturerData.push_back(std::stoi(data.substr(i, 2), nullptr, 16));
-	return(ReadManufacturerData(ManufacturerData, newtime));
-}
-std::string VictronOrionXS::WriteConsole(void) const
-{
-	std::ostringstream ssValue;
-	ssValue << " (Orion XS)";
-	ssValue << " OutputVoltage: " << OutputVoltage << "V";
-	ssValue << " OutputCurrent: " << OutputCurrent << "A";
-	ssValue << " InputVoltage: " << InputVoltage << "V";
-	ssValue << " InputCurrent: " << InputCurrent << "A";
-	return(ssValue.str());
-}
-std::string VictronOrionXS::WriteCache(void) const
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+std::string VictronFieldSample<Type, Fields, Stored, StoredCount>::WriteCache(void) const
 {
 	std::ostringstream ssValue;
-	ssValue << Time;
-	ssValue << "\t" << Averages;
-	ssValue << "\t" << OutputVoltage;
-	ssValue << "\t" << OutputCurrent;
-	ssValue << "\t" << InputVoltage;
-	ssValue << "\t" << InputCurrent;
+	ssValue << WriteCacheTime();
+	for (auto& a : FieldSums)
+		ssValue << "\t" << a;
 	return(ssValue.str());
 }
-bool VictronOrionXS::ReadCache(const std::string& data)
+// Cache files written before samples were stored as sums hold averages in units. They are turned into sums as they're read, which is only as exact as the averages were.
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+bool VictronFieldSample<Type, Fields, Stored, StoredCount>::ReadCache(const std::string& data, const bool Sums)
 {
 	bool rval = false;
 	std::istringstream ssValue(data);
 	ssValue >> Time;
 	ssValue >> Averages;
-	ssValue >> OutputVoltage;
-	ssValue >> OutputCurrent;
-	ssValue >> InputVoltage;
-	ssValue >> InputCurrent;
-	return(rval);
-}
-void VictronOrionXS::NormalizeTime(granularity type)
-{
-	if (type == day)
-		Time = (Time / DAY_SAMPLE) * DAY_SAMPLE;
-	else if (type == week)
-		Time = (Time / WEEK_SAMPLE) * WEEK_SAMPLE;
-	else if (type == month)
-		Time = (Time / MONTH_SAMPLE) * MONTH_SAMPLE;
-	else if (type == year)
+	if (Sums)
 	{
-		struct tm UTC;
-		if (0 != localtime_r(&Time, &UTC))
-		{
-			UTC.tm_hour = 0;
-			UTC.tm_min = 0;
-			UTC.tm_sec = 0;
-			Time = mktime(&UTC);
-		}
+		for (auto& a : FieldSums)
+			ssValue >> a;
 	}
-}
-VictronOrionXS::granularity VictronOrionXS::GetTimeGranularity(void) const
-{
-	granularity rval = granularity::day;
-	struct tm UTC;
-	if (0 != localtime_r(&Time, &UTC))
+	else
 	{
-		//if (((UTC.tm_hour == 0) && (UTC.tm_min == 0)) || ((UTC.tm_hour == 23) && (UTC.tm_min == 0) && (UTC.tm_isdst == 1)))
-		if ((UTC.tm_hour == 0) && (UTC.tm_min == 0))
-			rval = granularity::year;
-		else if ((UTC.tm_hour % 2 == 0) && (UTC.tm_min == 0))
-			rval = granularity::month;
-		else if ((UTC.tm_min == 0) || (UTC.tm_min == 30))
-			rval = granularity::week;
+		double Value(0);
+		for (size_t index = 0; index < StoredCount; index++)
+			if (ssValue >> Value)
+				FieldSums[index] = std::llround(Value / GetField(index).Scale) * Averages;
 	}
+	rval = !ssValue.fail();
 	return(rval);
 }
-VictronOrionXS& VictronOrionXS::operator +=(const VictronOrionXS& b)
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+VictronFieldSample<Type, Fields, Stored, StoredCount>& VictronFieldSample<Type, Fields, Stored, StoredCount>::operator +=(const VictronFieldSample& b)
 {
 	if (b.IsValid())
 	{
-		Time = std::max(Time, b.Time); // Use the maximum time (newest time)
-		OutputVoltage = ((OutputVoltage * Averages) + (b.OutputVoltage * b.Averages)) / (Averages + b.Averages);
-		OutputCurrent = ((OutputCurrent * Averages) + (b.OutputCurrent * b.Averages)) / (Averages + b.Averages);
-		InputVoltage = ((InputVoltage * Averages) + (b.InputVoltage * b.Averages)) / (Averages + b.Averages);
-		InputCurrent = ((InputCurrent * Averages) + (b.InputCurrent * b.Averages)) / (Averages + b.Averages);
-		Averages += b.Averages; // existing average + new average
+		Add(b);
+		for (size_t index = 0; index < StoredCount; index++)
+			FieldSums[index] += b.FieldSums[index];
 	}
 	return(*this);
 }
+template <uint8_t Type, const VictronField* Fields, const VictronStoredField* Stored, size_t StoredCount>
+double VictronFieldSample<Type, Fields, Stored, StoredCount>::GetValue(const size_t index, const bool Fahrenheit) const
+{
+	const double Value(Mean(FieldSums[index], GetField(index).Scale));
+	if (Fahrenheit && VictronIsCelsius(GetField(index)))
+		return((Value * 9.0 / 5.0) + 32.0);
+	return(Value);
+}
+// The cells share the battery voltage's axis and colour. The order of each list is the order of the cache file, so it can't change.
+constexpr VictronStoredField VictronSmartLithiumStored[] = {
+	{ 2, 1, "green", true },
+	{ 3, 1, "green", true },
+	{ 4, 1, "green", true },
+	{ 5, 1, "green", true },
+	{ 6, 1, "green", true },
+	{ 7, 1, "green", true },
+	{ 8, 1, "green", true },
+	{ 9, 1, "green", true },
+	{ 10, 1, "green" },
+	{ 12, 0, "blue" },
+};
+constexpr VictronStoredField VictronOrionXSStored[] = {
+	{ 2, 0, "aqua" },
+	{ 3, 1, "lime" },
+	{ 4, 0, "blue" },
+	{ 5, 1, "green" },
+};
+constexpr VictronStoredField VictronSolarChargerStored[] = {
+	{ 2, 0, "blue" },
+	{ 3, 1, "green" },
+};
+constexpr VictronStoredField VictronBatteryMonitorStored[] = {
+	{ 1, 0, "blue" },
+	{ 7, 1, "green" },
+};
+// The record has no currents, and the two sides are often different battery voltages
+constexpr VictronStoredField VictronDCDCConverterStored[] = {
+	{ 2, 0, "blue" },
+	{ 3, 1, "green" },
+};
+constexpr VictronStoredField VictronLynxSmartBMSStored[] = {
+	{ 2, 1, "green" },
+	{ 8, 0, "blue" },
+};
+#define VICTRON_SAMPLE(RecordType, Fields, Stored) VictronFieldSample<RecordType, Fields, Stored, sizeof(Stored) / sizeof(Stored[0])>
+typedef VICTRON_SAMPLE(0x05, VictronSmartLithiumFields, VictronSmartLithiumStored) VictronSmartLithium;
+typedef VICTRON_SAMPLE(0x0F, VictronOrionXSFields, VictronOrionXSStored) VictronOrionXS;
+typedef VICTRON_SAMPLE(0x01, VictronSolarChargerFields, VictronSolarChargerStored) VictronSolarCharger;
+typedef VICTRON_SAMPLE(0x02, VictronBatteryMonitorFields, VictronBatteryMonitorStored) VictronBatteryMonitor;
+typedef VICTRON_SAMPLE(0x04, VictronDCDCConverterFields, VictronDCDCConverterStored) VictronDCDCConverter;
+typedef VICTRON_SAMPLE(0x0A, VictronLynxSmartBMSFields, VictronLynxSmartBMSStored) VictronLynxSmartBMS;
+#undef VICTRON_SAMPLE
 /////////////////////////////////////////////////////////////////////////////
-std::map<bdaddr_t, std::vector<VictronSmartLithium>> VictronSmartLithiumMRTGLogs; // memory map of BT addresses and vector structure similar to MRTG Log Files
-std::map<bdaddr_t, std::vector<VictronOrionXS>> VictronOrionXSMRTGLogs; // memory map of BT addresses and vector structure similar to MRTG Log Files
-std::map<bdaddr_t, std::string> VictronNames;
-template <typename VictronType, typename MRTGMap>
-void UpdateMRTGData(const bdaddr_t& TheAddress, VictronType& TheValue, MRTGMap & TheMap)
-{
-	std::vector<VictronType> foo;
-	auto ret = TheMap.insert(std::pair<bdaddr_t, std::vector<VictronType>>(TheAddress, foo));
-	std::vector<VictronType>& FakeMRTGFile = ret.first->second;
+// Every device's history in one table. Each device holds a vector structure similar to MRTG Log Files of the sample type for the record type it sends,
+// so reading logs, writing the cache and drawing graphs each make one pass over all devices whatever their type.
+typedef std::variant<std::vector<VictronSmartLithium>, std::vector<VictronOrionXS>, std::vector<VictronSolarCharger>, std::vector<VictronBatteryMonitor>, std::vector<VictronDCDCConverter>, std::vector<VictronLynxSmartBMS>> VictronMRTGLog;
+bdaddr_map<VictronMRTGLog> VictronDevices;
+time_t GetMRTGTime(const VictronMRTGLog& TheLog)
+{
+	return(std::visit([](auto& FakeMRTGFile) { return(FakeMRTGFile.empty() ? time_t(0) : FakeMRTGFile.begin()->Time); }, TheLog));
+}
+bdaddr_map<std::string> VictronNames;
+std::mutex VictronNamesMutex; // names are learned on the receive thread and used for SVG titles on the processing thread
+std::string GetVictronTitle(const bdaddr_t& TheAddress, const std::string& btAddress)
+{
+	std::string ssTitle(btAddress);
+	std::lock_guard<std::mutex> NamesLock(VictronNamesMutex);
+	if (auto search = VictronNames.find(TheAddress); search != VictronNames.end())
+		ssTitle = search->second + " (" + ba2string(TheAddress) + ")";
+	return(ssTitle);
+}
+template <typename VictronType>
+void UpdateMRTGData(const bdaddr_t& TheAddress, VictronType& TheValue)
+{
+	auto ret = VictronDevices.insert(std::pair<bdaddr_t, VictronMRTGLog>(TheAddress, std::vector<VictronType>()));
+	if (!std::holds_alternative<std::vector<VictronType>>(ret.first->second)) // the device has started sending a different record type
+		ret.first->second = std::vector<VictronType>();
+	std::vector<VictronType>& FakeMRTGFile = std::get<std::vector<VictronType>>(ret.first->second);
 	if (FakeMRTGFile.empty())
 	{
 		FakeMRTGFile.resize(2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT);
@@ -1191,65 +2412,63 @@ void UpdateMRTGData(const bdaddr_t& TheAddress, VictronType& TheValue, MRTGMap &
 		FakeMRTGFile[1] = VictronType();
 }
 enum class GraphType { daily, weekly, monthly, yearly };
-// Returns a curated vector of data points specific to the requested graph type from the internal memory structure map keyed off the Bluetooth address.
-template <typename VictronType, typename MRTGMap>
-void ReadMRTGData(const bdaddr_t& TheAddress, std::vector<VictronType>& TheValues, MRTGMap& TheMap, const GraphType graph = GraphType::daily)
-{
-	auto it = TheMap.find(TheAddress);
-	if (it != TheMap.end())
-	{
-		if (it->second.size() > 0)
-		{
-			auto DaySampleFirst = it->second.begin() + 2;
-			auto DaySampleLast = it->second.begin() + 1 + DAY_COUNT;
-			auto WeekSampleFirst = it->second.begin() + 2 + DAY_COUNT;
-			auto WeekSampleLast = it->second.begin() + 1 + DAY_COUNT + WEEK_COUNT;
-			auto MonthSampleFirst = it->second.begin() + 2 + DAY_COUNT + WEEK_COUNT;
-			auto MonthSampleLast = it->second.begin() + 1 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT;
-			auto YearSampleFirst = it->second.begin() + 2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT;
-			auto YearSampleLast = it->second.begin() + 1 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT;
-			if (graph == GraphType::daily)
-			{
-				TheValues.resize(DAY_COUNT);
-				std::copy(DaySampleFirst, DaySampleLast, TheValues.begin());
-				auto iter = TheValues.begin();
-				while (iter->IsValid() && (iter != TheValues.end()))
-					iter++;
-				TheValues.resize(iter - TheValues.begin());
-				TheValues.begin()->Time = it->second.begin()->Time; //HACK: include the most recent time sample
-			}
-			else if (graph == GraphType::weekly)
-			{
-				TheValues.resize(WEEK_COUNT);
-				std::copy(WeekSampleFirst, WeekSampleLast, TheValues.begin());
-				auto iter = TheValues.begin();
-				while (iter->IsValid() && (iter != TheValues.end()))
-					iter++;
-				TheValues.resize(iter - TheValues.begin());
-			}
-			else if (graph == GraphType::monthly)
-			{
-				TheValues.resize(MONTH_COUNT);
-				std::copy(MonthSampleFirst, MonthSampleLast, TheValues.begin());
-				auto iter = TheValues.begin();
-				while (iter->IsValid() && (iter != TheValues.end()))
-					iter++;
-				TheValues.resize(iter - TheValues.begin());
-			}
-			else if (graph == GraphType::yearly)
-			{
-				TheValues.resize(YEAR_COUNT);
-				std::copy(YearSampleFirst, YearSampleLast, TheValues.begin());
-				auto iter = TheValues.begin();
-				while (iter->IsValid() && (iter != TheValues.end()))
-					iter++;
-				TheValues.resize(iter - TheValues.begin());
-			}
+// Returns a curated vector of data points specific to the requested graph type from a device's memory structure.
+template <typename VictronType>
+void ReadMRTGData(const std::vector<VictronType>& FakeMRTGFile, std::vector<VictronType>& TheValues, const GraphType graph = GraphType::daily)
+{
+	if (FakeMRTGFile.size() > 0)
+	{
+		auto DaySampleFirst = FakeMRTGFile.begin() + 2;
+		auto DaySampleLast = FakeMRTGFile.begin() + 1 + DAY_COUNT;
+		auto WeekSampleFirst = FakeMRTGFile.begin() + 2 + DAY_COUNT;
+		auto WeekSampleLast = FakeMRTGFile.begin() + 1 + DAY_COUNT + WEEK_COUNT;
+		auto MonthSampleFirst = FakeMRTGFile.begin() + 2 + DAY_COUNT + WEEK_COUNT;
+		auto MonthSampleLast = FakeMRTGFile.begin() + 1 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT;
+		auto YearSampleFirst = FakeMRTGFile.begin() + 2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT;
+		auto YearSampleLast = FakeMRTGFile.begin() + 1 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT;
+		if (graph == GraphType::daily)
+		{
+			TheValues.resize(DAY_COUNT);
+			std::copy(DaySampleFirst, DaySampleLast, TheValues.begin());
+			auto iter = TheValues.begin();
+			while (iter->IsValid() && (iter != TheValues.end()))
+				iter++;
+			TheValues.resize(iter - TheValues.begin());
+			TheValues.begin()->Time = FakeMRTGFile.begin()->Time; //HACK: include the most recent time sample
+		}
+		else if (graph == GraphType::weekly)
+		{
+			TheValues.resize(WEEK_COUNT);
+			std::copy(WeekSampleFirst, WeekSampleLast, TheValues.begin());
+			auto iter = TheValues.begin();
+			while (iter->IsValid() && (iter != TheValues.end()))
+				iter++;
+			TheValues.resize(iter - TheValues.begin());
+		}
+		else if (graph == GraphType::monthly)
+		{
+			TheValues.resize(MONTH_COUNT);
+			std::copy(MonthSampleFirst, MonthSampleLast, TheValues.begin());
+			auto iter = TheValues.begin();
+			while (iter->IsValid() && (iter != TheValues.end()))
+				iter++;
+			TheValues.resize(iter - TheValues.begin());
+		}
+		else if (graph == GraphType::yearly)
+		{
+			TheValues.resize(YEAR_COUNT);
+			std::copy(YearSampleFirst, YearSampleLast, TheValues.begin());
+			auto iter = TheValues.begin();
+			while (iter->IsValid() && (iter != TheValues.end()))
+				iter++;
+			TheValues.resize(iter - TheValues.begin());
 		}
 	}
 }
 /////////////////////////////////////////////////////////////////////////////
-void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem::path& SVGFileName, const std::string& Title = "", const GraphType graph = GraphType::daily, const bool Fahrenheit = true, const bool DarkStyle = false)
+// Draws every field the sample type keeps against the axis its stored field list gives it, temperatures in Fahrenheit if asked.
+template <typename VictronType>
+void WriteSVG(std::vector<VictronType>& TheValues, const std::filesystem::path& SVGFileName, const std::string& Title = "", const GraphType graph = GraphType::daily, const bool Fahrenheit = true, const bool DarkStyle = false)
 {
 	if (!TheValues.empty())
 	{
@@ -1272,54 +2491,73 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 					std::cout << "[" << getTimeISO8601(true) << "] Writing: " << SVGFileName.string() << " With Title: " << Title << std::endl;
 				else
 					std::cerr << "Writing: " << SVGFileName.string() << " With Title: " << Title << std::endl;
-				std::ostringstream tempOString;
-				tempOString << "Temperature (" << std::fixed << std::setprecision(1) << TheValues[0].GetTemperature(Fahrenheit) << "\u00B0" << (Fahrenheit ? "F)" : "C)");
-				std::string YLegendTemperature(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "Voltage (" << std::setprecision(4) << TheValues[0].GetVoltage() << "V)";
-				std::string YLegendVoltage(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "(" << std::setprecision(3) << TheValues[0].GetCellVoltage(0) << "V) (" << std::setprecision(3) << TheValues[0].GetCellVoltage(1) << "V)";
-				std::string YLegendCell12(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "(" << std::setprecision(3) << TheValues[0].GetCellVoltage(2) << "V) (" << std::setprecision(3) << TheValues[0].GetCellVoltage(3) << "V)";
-				std::string YLegendCell34(tempOString.str());
+				const size_t GraphPoints(std::min(size_t(GraphWidth), TheValues.size()));
+				// Optional fields that were never sent in the time the graph covers aren't drawn
+				bool Drawn[VictronType::StoredFieldCount];
+				for (size_t line = 0; line < VictronType::StoredFieldCount; line++)
+				{
+					Drawn[line] = !VictronType::StoredFields[line].Optional;
+					for (size_t index = 0; (index < GraphPoints) && !Drawn[line]; index++)
+						Drawn[line] = (TheValues[index].GetValue(line) != 0);
+				}
+				// A legend for each line with its latest value, the left axis first. Optional fields like the cells of a battery are too many to name, so they only show their value, two to a legend.
+				std::vector<std::pair<std::string, std::string>> YLegend; // text and color
+				bool Paired = true;
+				for (auto Axis = 0; Axis < 2; Axis++, Paired = true)
+					for (auto Optional : { false, true })
+						for (size_t line = 0; line < VictronType::StoredFieldCount; line++)
+							if (Drawn[line] && (VictronType::StoredFields[line].Axis == Axis) && (VictronType::StoredFields[line].Optional == Optional))
+							{
+								std::ostringstream tempOString;
+								if (!Optional)
+									tempOString << VictronType::GetField(line).Name << " ";
+								tempOString << "(" << std::fixed << std::setprecision(VictronType::GetPrecision(line)) << TheValues[0].GetValue(line, Fahrenheit) << VictronType::GetUnits(line, Fahrenheit) << ")";
+								if (Optional && !Paired)
+									YLegend.back().first += " " + tempOString.str();
+								else
+									YLegend.push_back(std::make_pair(tempOString.str(), std::string(VictronType::StoredFields[line].Color)));
+								Paired = !(Optional && Paired);
+							}
 				int GraphTop = FontSize + TickSize;
 				int GraphBottom = SVGHeight - GraphTop;
 				int GraphRight = SVGWidth - GraphTop - (FontSize + (FontSize / 2)) + (TickSize * 2);
 				int GraphLeft = GraphRight - GraphWidth;
 				int GraphVerticalDivision = (GraphBottom - GraphTop) / 4;
-				double TempMin = DBL_MAX;
-				double TempMax = -DBL_MAX;
-				double VoltMin = DBL_MAX;
-				double VoltMax = -DBL_MAX;
-				for (auto index = 0; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-				{
-					TempMin = std::min(TempMin, TheValues[index].GetTemperature(Fahrenheit));
-					TempMax = std::max(TempMax, TheValues[index].GetTemperature(Fahrenheit));
-					VoltMin = std::min(VoltMin, TheValues[index].GetVoltage());
-					for (auto cell = 0; cell < (TheValues[index].GetCellCount() - 1); cell++)
-						VoltMin = std::min(VoltMin, TheValues[index].GetCellVoltage(cell));
-					VoltMax = std::max(VoltMax, TheValues[index].GetVoltage());
-					for (auto cell = 0; cell < (TheValues[index].GetCellCount() - 1); cell++)
-						VoltMax = std::max(VoltMax, TheValues[index].GetCellVoltage(cell));
-				}
+				double ValueMin[2] = { DBL_MAX, DBL_MAX };
+				double ValueMax[2] = { -DBL_MAX, -DBL_MAX };
+				int Precision[2] = { 1, 1 };
+				for (size_t line = 0; line < VictronType::StoredFieldCount; line++)
+					if (Drawn[line])
+					{
+						const int Axis(VictronType::StoredFields[line].Axis);
+						Precision[Axis] = std::max(Precision[Axis], VictronType::GetPrecision(line));
+						for (size_t index = 0; index < GraphPoints; index++)
+						{
+							ValueMin[Axis] = std::min(ValueMin[Axis], TheValues[index].GetValue(line, Fahrenheit));
+							ValueMax[Axis] = std::max(ValueMax[Axis], TheValues[index].GetValue(line, Fahrenheit));
+						}
+					}
 
-				double TempVerticalDivision = (TempMax - TempMin) / 4;
-				double TempVerticalFactor = (GraphBottom - GraphTop) / (TempMax - TempMin);
-				double VoltVerticalDivision = (VoltMax - VoltMin) / 4;
-				double VoltVerticalFactor = (GraphBottom - GraphTop) / (VoltMax - VoltMin);
-				int FreezingLine = 0; // outside the range of the graph
-				if (Fahrenheit)
-				{
-					if ((TempMin < 32) && (32 < TempMax))
-						FreezingLine = ((TempMax - 32.0) * TempVerticalFactor) + GraphTop;
-				}
-				else
+				double ValueVerticalDivision[2] = { 0, 0 };
+				double ValueVerticalFactor[2] = { 0, 0 };
+				for (auto Axis = 0; Axis < 2; Axis++)
+					if (ValueMin[Axis] <= ValueMax[Axis]) // an axis without lines has no scale
+					{
+						// A value that never changed, the voltages of a DC/DC converter or a solar charger's current overnight, is drawn across the middle
+						if (!(ValueMax[Axis] > ValueMin[Axis]))
+						{
+							ValueMin[Axis] -= 1;
+							ValueMax[Axis] += 1;
+						}
+						ValueVerticalDivision[Axis] = (ValueMax[Axis] - ValueMin[Axis]) / 4;
+						ValueVerticalFactor[Axis] = (GraphBottom - GraphTop) / (ValueMax[Axis] - ValueMin[Axis]);
+					}
+				const std::string AxisColor[2] = { "blue", "green" };
+				auto AxisLabel = [&](const int Axis, const int y, const double Value)
 				{
-					if ((TempMin < 0) && (0 < TempMax))
-						FreezingLine = (TempMax * TempVerticalFactor) + GraphTop;
-				}
+					if (ValueMin[Axis] <= ValueMax[Axis])
+						SVGFile << "\t<text style=\"fill:" << AxisColor[Axis] << ((Axis == 0) ? ";text-anchor:end" : "") << ";dominant-baseline:middle\" x=\"" << ((Axis == 0) ? GraphLeft - TickSize : GraphRight + TickSize) << "\" y=\"" << y << "\">" << std::fixed << std::setprecision(Precision[Axis]) << Value << "</text>" << std::endl;
+				};
 
 				SVGFile << "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"no\"?>" << std::endl;
 				SVGFile << "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"" << SVGWidth << "\" height=\"" << SVGHeight << "\">" << std::endl;
@@ -1338,9 +2576,9 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 				}
 				SVGFile << "\t</style>" << std::endl;
 #ifdef DEBUG
-				SVGFile << "<!-- VoltMax: " << VoltMax << " -->" << std::endl;
-				SVGFile << "<!-- VoltMin: " << VoltMin << " -->" << std::endl;
-				SVGFile << "<!-- VoltVerticalFactor: " << VoltVerticalFactor << " -->" << std::endl;
+				SVGFile << "<!-- ValueMax: " << ValueMax[0] << " " << ValueMax[1] << " -->" << std::endl;
+				SVGFile << "<!-- ValueMin: " << ValueMin[0] << " " << ValueMin[1] << " -->" << std::endl;
+				SVGFile << "<!-- ValueVerticalFactor: " << ValueVerticalFactor[0] << " " << ValueVerticalFactor[1] << " -->" << std::endl;
 #endif // DEBUG
 				SVGFile << "\t<rect style=\"fill-opacity:0;stroke:grey;stroke-width:2\" width=\"" << SVGWidth << "\" height=\"" << SVGHeight << "\" />" << std::endl;
 
@@ -1348,23 +2586,21 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 				int LegendIndex = 1;
 				SVGFile << "\t<text x=\"" << GraphLeft << "\" y=\"" << GraphTop - 2 << "\">" << Title << "</text>" << std::endl;
 				SVGFile << "\t<text style=\"text-anchor:end\" x=\"" << GraphRight << "\" y=\"" << GraphTop - 2 << "\">" << timeToExcelLocal(TheValues[0].Time) << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendTemperature << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:green;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendVoltage << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:green;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendCell12 << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:green;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendCell34 << "</text>" << std::endl;
+				for (auto& [Legend, Color] : YLegend)
+				{
+					SVGFile << "\t<text style=\"fill:" << Color << ";text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << Legend << "</text>" << std::endl;
+					LegendIndex++;
+				}
 
 				// Top Line
 				SVGFile << "\t<line x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphTop << "\"/>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphTop << "\">" << std::fixed << std::setprecision(1) << TempMax << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphTop << "\">" << std::fixed << std::setprecision(1) << VoltMax << "</text>" << std::endl;
+				AxisLabel(0, GraphTop, ValueMax[0]);
+				AxisLabel(1, GraphTop, ValueMax[1]);
 
 				// Bottom Line
 				SVGFile << "\t<line x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphBottom << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphBottom << "\"/>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphBottom << "\">" << std::fixed << std::setprecision(1) << TempMin << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphBottom << "\">" << std::fixed << std::setprecision(1) << VoltMin << "</text>" << std::endl;
+				AxisLabel(0, GraphBottom, ValueMin[0]);
+				AxisLabel(1, GraphBottom, ValueMin[1]);
 
 				// Left Line
 				SVGFile << "\t<line x1=\"" << GraphLeft << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft << "\" y2=\"" << GraphBottom << "\"/>" << std::endl;
@@ -1376,12 +2612,12 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 				for (auto index = 1; index < 4; index++)
 				{
 					SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphTop + (GraphVerticalDivision * index) << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphTop + (GraphVerticalDivision * index) << "\" />" << std::endl;
-					SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphTop + (GraphVerticalDivision * index) << "\">" << std::fixed << std::setprecision(1) << TempMax - (TempVerticalDivision * index) << "</text>" << std::endl;
-					SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphTop + (GraphVerticalDivision * index) << "\">" << std::fixed << std::setprecision(1) << VoltMax - (VoltVerticalDivision * index) << "</text>" << std::endl;
+					AxisLabel(0, GraphTop + (GraphVerticalDivision * index), ValueMax[0] - (ValueVerticalDivision[0] * index));
+					AxisLabel(1, GraphTop + (GraphVerticalDivision * index), ValueMax[1] - (ValueVerticalDivision[1] * index));
 				}
 
 				// Horizontal Division Dashed Lines
-				for (auto index = 0; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
+				for (size_t index = 0; index < GraphPoints; index++)
 				{
 					struct tm UTC;
 					if (0 != localtime_r(&TheValues[index].Time, &UTC))
@@ -1436,29 +2672,17 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 				// Directional Arrow
 				SVGFile << "\t<polygon style=\"fill:red;stroke:red;fill-opacity:1;\" points=\"" << GraphLeft - 3 << "," << GraphBottom << " " << GraphLeft + 3 << "," << GraphBottom - 3 << " " << GraphLeft + 3 << "," << GraphBottom + 3 << "\" />" << std::endl;
 
-				// Temperature Values as a continuous line
-				SVGFile << "\t<!-- Temperature -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:none;stroke:blue;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((TempMax - TheValues[index].GetTemperature(Fahrenheit)) * TempVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				// Voltage Graphic as a continuous line
-				SVGFile << "\t<!-- Voltage -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:lime;stroke:green;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((VoltMax - TheValues[index].GetVoltage()) * VoltVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				for (auto cell = 0; cell < (TheValues.begin()->GetCellCount() - 1); cell++)
-				{
-					// Cell Voltage Graphic as a continuous line
-					SVGFile << "\t<!-- Cell " << cell << " Voltage -->" << std::endl;
-					SVGFile << "\t<polyline style=\"fill:lime;stroke:green;clip-path:url(#GraphRegion)\" points=\"";
-					for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-						SVGFile << index + GraphLeft << "," << int(((VoltMax - TheValues[index].GetCellVoltage(cell)) * VoltVerticalFactor) + GraphTop) << " ";
-					SVGFile << "\" />" << std::endl;
-				}
+				// Each field as a continuous line
+				for (size_t line = 0; line < VictronType::StoredFieldCount; line++)
+					if (Drawn[line])
+					{
+						const int Axis(VictronType::StoredFields[line].Axis);
+						SVGFile << "\t<!-- " << VictronType::GetField(line).Name << " -->" << std::endl;
+						SVGFile << "\t<polyline style=\"fill:none;stroke:" << VictronType::StoredFields[line].Color << ";clip-path:url(#GraphRegion)\" points=\"";
+						for (size_t index = 1; index < GraphPoints; index++)
+							SVGFile << index + GraphLeft << "," << int(((ValueMax[Axis] - TheValues[index].GetValue(line, Fahrenheit)) * ValueVerticalFactor[Axis]) + GraphTop) << " ";
+						SVGFile << "\" />" << std::endl;
+					}
 
 				SVGFile << "</svg>" << std::endl;
 				SVGFile.close();
@@ -1470,308 +2694,344 @@ void WriteSVG(std::vector<VictronSmartLithium>& TheValues, const std::filesystem
 		}
 	}
 }
-void WriteSVG(std::vector<VictronOrionXS>& TheValues, const std::filesystem::path& SVGFileName, const std::string& Title = "", const GraphType graph = GraphType::daily, const bool Fahrenheit = true, const bool DarkStyle = false)
+template <typename VictronType>
+void WriteAllSVG(const bdaddr_t& TheAddress, const std::vector<VictronType>& FakeMRTGFile)
 {
-	const bool DrawVoltage = true;
-	if (!TheValues.empty())
+	std::string btAddress(ba2string(TheAddress));
+	for (auto pos = btAddress.find(':'); pos != std::string::npos; pos = btAddress.find(':'))
+		btAddress.erase(pos, 1);
+	const std::string ssTitle(GetVictronTitle(TheAddress, btAddress));
+	std::filesystem::path OutputPath;
+	std::ostringstream OutputFilename;
+	OutputFilename.str("");
+	OutputFilename << "victron-";
+	OutputFilename << btAddress;
+	OutputFilename << "-day.svg";
+	OutputPath = SVGDirectory / OutputFilename.str();
+	std::vector<VictronType> TheValues;
+	ReadMRTGData(FakeMRTGFile, TheValues, GraphType::daily);
+	WriteSVG(TheValues, OutputPath, ssTitle, GraphType::daily, SVGFahrenheit);
+	OutputFilename.str("");
+	OutputFilename << "victron-";
+	OutputFilename << btAddress;
+	OutputFilename << "-week.svg";
+	OutputPath = SVGDirectory / OutputFilename.str();
+	ReadMRTGData(FakeMRTGFile, TheValues, GraphType::weekly);
+	WriteSVG(TheValues, OutputPath, ssTitle, GraphType::weekly, SVGFahrenheit);
+	OutputFilename.str("");
+	OutputFilename << "victron-";
+	OutputFilename << btAddress;
+	OutputFilename << "-month.svg";
+	OutputPath = SVGDirectory / OutputFilename.str();
+	ReadMRTGData(FakeMRTGFile, TheValues, GraphType::monthly);
+	WriteSVG(TheValues, OutputPath, ssTitle, GraphType::monthly, SVGFahrenheit);
+	OutputFilename.str("");
+	OutputFilename << "victron-";
+	OutputFilename << btAddress;
+	OutputFilename << "-year.svg";
+	OutputPath = SVGDirectory / OutputFilename.str();
+	ReadMRTGData(FakeMRTGFile, TheValues, GraphType::yearly);
+	WriteSVG(TheValues, OutputPath, ssTitle, GraphType::yearly, SVGFahrenheit);
+}
+void WriteAllSVG()
+{
+	for (auto& [TheAddress, TheLog] : VictronDevices)
+		std::visit([&TheAddress = TheAddress](auto& FakeMRTGFile) { WriteAllSVG(TheAddress, FakeMRTGFile); }, TheLog);
+}
+/////////////////////////////////////////////////////////////////////////////
+template <typename VictronType>
+bool StoreVictronRecord(const bdaddr_t& TheAddress, const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const time_t TheTime)
+{
+	VictronType TheValue;
+	bool rval(TheValue.ReadManufacturerData(ManufacturerData, ManufacturerDataLength, TheTime));
+	if (rval)
+		UpdateMRTGData(TheAddress, TheValue);	// puts the measurement in the fake MRTG data structure
+	return(rval);
+}
+// Decodes decrypted manufacturer data with the sample type for its record type and adds it to the device's history.
+// Every record is decoded from its field table for the console, stored or not, so the console shows every field that was sent.
+bool StoreVictronRecord(const bdaddr_t& TheAddress, const uint8_t* ManufacturerData, const size_t ManufacturerDataLength, const time_t TheTime, std::string* Console = nullptr)
+{
+	bool rval(false);
+	if (ManufacturerDataLength > 8)
 	{
-		// By declaring these items here, I'm then basing all my other dimensions on these
-		const int SVGWidth(500);
-		const int SVGHeight(135);
-		const int FontSize(12);
-		const int TickSize(2);
-		int GraphWidth = SVGWidth - (FontSize * 9);
-		struct stat64 SVGStat({ 0 });	// Zero the stat64 structure on allocation
-		if (-1 == stat64(SVGFileName.c_str(), &SVGStat))
-			if (ConsoleVerbosity > 3)
-				std::cout << "[" << getTimeISO8601(true) << "] " << std::strerror(errno) << ": " << SVGFileName << std::endl;
-		if (TheValues.begin()->Time > SVGStat.st_mtim.tv_sec)	// only write the file if we have new data
+		switch (ManufacturerData[4])
 		{
-			std::ofstream SVGFile(SVGFileName);
-			if (SVGFile.is_open())
+		case VictronSmartLithium::RecordType:
+			rval = StoreVictronRecord<VictronSmartLithium>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		case VictronOrionXS::RecordType:
+			rval = StoreVictronRecord<VictronOrionXS>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		case VictronSolarCharger::RecordType:
+			rval = StoreVictronRecord<VictronSolarCharger>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		case VictronBatteryMonitor::RecordType:
+			rval = StoreVictronRecord<VictronBatteryMonitor>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		case VictronDCDCConverter::RecordType:
+			rval = StoreVictronRecord<VictronDCDCConverter>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		case VictronLynxSmartBMS::RecordType:
+			rval = StoreVictronRecord<VictronLynxSmartBMS>(TheAddress, ManufacturerData, ManufacturerDataLength, TheTime);
+			break;
+		}
+		if (Console != nullptr)
+			*Console = VictronWriteConsole(ManufacturerData[4], ManufacturerData + 8, ManufacturerDataLength - 8);
+	}
+	return(rval);
+}
+// Maps a whole file read only and hands it to Reader. An empty file is handed over as nothing at all.
+bool ReadMappedFile(const std::filesystem::path& filename, const std::function<void(const char* Data, const size_t Size)>& Reader)
+{
+	bool rval = false;
+	int fd(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd >= 0)
+	{
+		struct stat64 FileStat;
+		if (0 == fstat64(fd, &FileStat))
+		{
+			const size_t FileSize(FileStat.st_size);
+			if (FileSize == 0)
 			{
-				if (ConsoleVerbosity > 0)
-					std::cout << "[" << getTimeISO8601(true) << "] Writing: " << SVGFileName.string() << " With Title: " << Title << std::endl;
-				else
-					std::cerr << "Writing: " << SVGFileName.string() << " With Title: " << Title << std::endl;
-				std::ostringstream tempOString;
-				tempOString << "Voltage In (" << std::fixed << std::setprecision(2) << TheValues[0].GetVoltageIn() << "V)";
-				std::string YLegendVoltageIn(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "Voltage Out (" << std::fixed << std::setprecision(2) << TheValues[0].GetVoltageOut() << "V)";
-				std::string YLegendVoltageOut(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "Current In (" << std::fixed << std::setprecision(1) << TheValues[0].GetCurrentIn() << "A)";
-				std::string YLegendCurrentIn(tempOString.str());
-				tempOString = std::ostringstream();
-				tempOString << "Current Out (" << std::fixed << std::setprecision(1) << TheValues[0].GetCurrentOut() << "A)";
-				std::string YLegendCurrentOut(tempOString.str());
-				int GraphTop = FontSize + TickSize;
-				int GraphBottom = SVGHeight - GraphTop;
-				int GraphRight = SVGWidth - GraphTop - (FontSize + (FontSize/2)) + (TickSize * 2);
-				int GraphLeft = GraphRight - GraphWidth;
-				int GraphVerticalDivision = (GraphBottom - GraphTop) / 4;
-				double AmpMin = DBL_MAX;
-				double AmpMax = -DBL_MAX;
-				double VoltMin = DBL_MAX;
-				double VoltMax = -DBL_MAX;
-				for (auto index = 0; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-				{
-					AmpMin = std::min(AmpMin, TheValues[index].GetCurrentIn());
-					AmpMin = std::min(AmpMin, TheValues[index].GetCurrentOut());
-					AmpMax = std::max(AmpMax, TheValues[index].GetCurrentIn());
-					AmpMax = std::max(AmpMax, TheValues[index].GetCurrentOut());
-					VoltMin = std::min(VoltMin, TheValues[index].GetVoltageIn());
-					VoltMin = std::min(VoltMin, TheValues[index].GetVoltageOut());
-					VoltMax = std::max(VoltMax, TheValues[index].GetVoltageIn());
-					VoltMax = std::max(VoltMax, TheValues[index].GetVoltageOut());
-				}
-
-				double AmpVerticalDivision = (AmpMax - AmpMin) / 4;
-				double AmpVerticalFactor = (GraphBottom - GraphTop) / (AmpMax - AmpMin);
-				double VoltVerticalDivision = (VoltMax - VoltMin) / 4;
-				double VoltVerticalFactor = (GraphBottom - GraphTop) / (VoltMax - VoltMin);
-
-				SVGFile << "<?xml version=\"1.0\" encoding=\"utf-8\" standalone=\"no\"?>" << std::endl;
-				SVGFile << "<svg xmlns=\"http://www.w3.org/2000/svg\" xmlns:xlink=\"http://www.w3.org/1999/xlink\" width=\"" << SVGWidth << "\" height=\"" << SVGHeight << "\">" << std::endl;
-				SVGFile << "\t<!-- Created by: " << ProgramVersionString << " -->" << std::endl;
-				SVGFile << "\t<clipPath id=\"GraphRegion\"><polygon points=\"" << GraphLeft << "," << GraphTop << " " << GraphRight << "," << GraphTop << " " << GraphRight << "," << GraphBottom << " " << GraphLeft << "," << GraphBottom << "\" /></clipPath>" << std::endl;
-				SVGFile << "\t<style>" << std::endl;
-				SVGFile << "\t\ttext { font-family: sans-serif; font-size: " << FontSize << "px; fill: dimgrey; }" << std::endl;
-				SVGFile << "\t\tline { stroke: dimgrey; }" << std::endl;
-				SVGFile << "\t\tpolygon { fill-opacity: 0.5; }" << std::endl;
-				if (DarkStyle)
-				{
-					SVGFile << "\t@media only screen and (prefers-color-scheme: dark) {" << std::endl;
-					SVGFile << "\t\ttext { fill: grey; }" << std::endl;
-					SVGFile << "\t\tline { stroke: grey; }" << std::endl;
-					SVGFile << "\t}" << std::endl;
-				}
-				SVGFile << "\t</style>" << std::endl;
-#ifdef DEBUG
-				SVGFile << "<!-- VoltMax: " << VoltMax << " -->" << std::endl;
-				SVGFile << "<!-- VoltMin: " << VoltMin << " -->" << std::endl;
-				SVGFile << "<!-- VoltVerticalFactor: " << VoltVerticalFactor << " -->" << std::endl;
-#endif // DEBUG
-				SVGFile << "\t<rect style=\"fill-opacity:0;stroke:grey;stroke-width:2\" width=\"" << SVGWidth << "\" height=\"" << SVGHeight << "\" />" << std::endl;
-
-				// Legend Text
-				int LegendIndex = 1;
-				SVGFile << "\t<text x=\"" << GraphLeft << "\" y=\"" << GraphTop - 2 << "\">" << Title << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"text-anchor:end\" x=\"" << GraphRight << "\" y=\"" << GraphTop - 2 << "\">" << timeToExcelLocal(TheValues[0].Time) << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendVoltageIn << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:aqua;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendVoltageOut << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:green;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendCurrentIn << "</text>" << std::endl;
-				LegendIndex++;
-				SVGFile << "\t<text style=\"fill:lime;text-anchor:middle\" x=\"" << FontSize * LegendIndex << "\" y=\"50%\" transform=\"rotate(270 " << FontSize * LegendIndex << "," << (GraphTop + GraphBottom) / 2 << ")\">" << YLegendCurrentOut << "</text>" << std::endl;
-				LegendIndex++;
-
-				// Top Line
-				SVGFile << "\t<line x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphTop << "\"/>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphTop << "\">" << std::fixed << std::setprecision(2) << VoltMax << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphTop << "\">" << std::fixed << std::setprecision(1) << AmpMax << "</text>" << std::endl;
-
-				// Bottom Line
-				SVGFile << "\t<line x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphBottom << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphBottom << "\"/>" << std::endl;
-				SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphBottom << "\">" << std::fixed << std::setprecision(2) << VoltMin << "</text>" << std::endl;
-				SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphBottom << "\">" << std::fixed << std::setprecision(1) << AmpMin << "</text>" << std::endl;
-
-				// Left Line
-				SVGFile << "\t<line x1=\"" << GraphLeft << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft << "\" y2=\"" << GraphBottom << "\"/>" << std::endl;
-
-				// Right Line
-				SVGFile << "\t<line x1=\"" << GraphRight << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphRight << "\" y2=\"" << GraphBottom << "\"/>" << std::endl;
-
-				// Vertical Division Dashed Lines
-				for (auto index = 1; index < 4; index++)
-				{
-					SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft - TickSize << "\" y1=\"" << GraphTop + (GraphVerticalDivision * index) << "\" x2=\"" << GraphRight + TickSize << "\" y2=\"" << GraphTop + (GraphVerticalDivision * index) << "\" />" << std::endl;
-					SVGFile << "\t<text style=\"fill:blue;text-anchor:end;dominant-baseline:middle\" x=\"" << GraphLeft - TickSize << "\" y=\"" << GraphTop + (GraphVerticalDivision * index) << "\">" << std::fixed << std::setprecision(2) << VoltMax - (VoltVerticalDivision * index) << "</text>" << std::endl; 
-					SVGFile << "\t<text style=\"fill:green;dominant-baseline:middle\" x=\"" << GraphRight + TickSize << "\" y=\"" << GraphTop + (GraphVerticalDivision * index) << "\">" << std::fixed << std::setprecision(1) << AmpMax - (AmpVerticalDivision * index) << "</text>" << std::endl;
-				}
-
-				// Horizontal Division Dashed Lines
-				for (auto index = 0; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
+				Reader(nullptr, 0);
+				rval = true;
+			}
+			else
+			{
+				void* Mapped(mmap(nullptr, FileSize, PROT_READ, MAP_PRIVATE, fd, 0));
+				if (Mapped != MAP_FAILED)
 				{
-					struct tm UTC;
-					if (0 != localtime_r(&TheValues[index].Time, &UTC))
-					{
-						if (graph == GraphType::daily)
-						{
-							if (UTC.tm_min == 0)
-							{
-								if (UTC.tm_hour == 0)
-									SVGFile << "\t<line style=\"stroke:red\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-								else
-									SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-								if (UTC.tm_hour % 2 == 0)
-									SVGFile << "\t<text style=\"text-anchor:middle\" x=\"" << GraphLeft + index << "\" y=\"" << SVGHeight - 2 << "\">" << UTC.tm_hour << "</text>" << std::endl;
-							}
-						}
-						else if (graph == GraphType::weekly)
-						{
-							const std::string Weekday[] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
-							if ((UTC.tm_hour == 0) && (UTC.tm_min == 0))
-							{
-								if (UTC.tm_wday == 0)
-									SVGFile << "\t<line style=\"stroke:red\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-								else
-									SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-							}
-							else if ((UTC.tm_hour == 12) && (UTC.tm_min == 0))
-								SVGFile << "\t<text style=\"text-anchor:middle\" x=\"" << GraphLeft + index << "\" y=\"" << SVGHeight - 2 << "\">" << Weekday[UTC.tm_wday] << "</text>" << std::endl;
-						}
-						else if (graph == GraphType::monthly)
-						{
-							if ((UTC.tm_mday == 1) && (UTC.tm_hour == 0) && (UTC.tm_min == 0))
-								SVGFile << "\t<line style=\"stroke:red\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-							if ((UTC.tm_wday == 0) && (UTC.tm_hour == 0) && (UTC.tm_min == 0))
-								SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-							else if ((UTC.tm_wday == 3) && (UTC.tm_hour == 12) && (UTC.tm_min == 0))
-								SVGFile << "\t<text style=\"text-anchor:middle\" x=\"" << GraphLeft + index << "\" y=\"" << SVGHeight - 2 << "\">Week " << UTC.tm_yday / 7 + 1 << "</text>" << std::endl;
-						}
-						else if (graph == GraphType::yearly)
-						{
-							const std::string Month[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
-							if ((UTC.tm_yday == 0) && (UTC.tm_mday == 1) && (UTC.tm_hour == 0) && (UTC.tm_min == 0))
-								SVGFile << "\t<line style=\"stroke:red\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-							else if ((UTC.tm_mday == 1) && (UTC.tm_hour == 0) && (UTC.tm_min == 0))
-								SVGFile << "\t<line style=\"stroke-dasharray:1\" x1=\"" << GraphLeft + index << "\" y1=\"" << GraphTop << "\" x2=\"" << GraphLeft + index << "\" y2=\"" << GraphBottom + TickSize << "\" />" << std::endl;
-							else if ((UTC.tm_mday == 15) && (UTC.tm_hour == 0) && (UTC.tm_min == 0))
-								SVGFile << "\t<text style=\"text-anchor:middle\" x=\"" << GraphLeft + index << "\" y=\"" << SVGHeight - 2 << "\">" << Month[UTC.tm_mon] << "</text>" << std::endl;
-						}
-					}
+					madvise(Mapped, FileSize, MADV_SEQUENTIAL);
+					Reader(static_cast<const char*>(Mapped), FileSize);
+					munmap(Mapped, FileSize);
+					rval = true;
 				}
-
-				// Directional Arrow
-				SVGFile << "\t<polygon style=\"fill:red;stroke:red;fill-opacity:1;\" points=\"" << GraphLeft - 3 << "," << GraphBottom << " " << GraphLeft + 3 << "," << GraphBottom - 3 << " " << GraphLeft + 3 << "," << GraphBottom + 3 << "\" />" << std::endl;
-
-				// Current Values as a continuous line
-				SVGFile << "\t<!-- Amperage -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:none;stroke:green;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((AmpMax - TheValues[index].GetCurrentIn()) * AmpVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				// Current Values as a continuous line
-				SVGFile << "\t<!-- Amperage -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:none;stroke:lime;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((AmpMax - TheValues[index].GetCurrentOut()) * AmpVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				// Voltage Graphic as a continuous line
-				SVGFile << "\t<!-- Voltage -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:none;stroke:blue;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((VoltMax - TheValues[index].GetVoltageIn()) * VoltVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				// Voltage Graphic as a continuous line
-				SVGFile << "\t<!-- Voltage -->" << std::endl;
-				SVGFile << "\t<polyline style=\"fill:none;stroke:aqua;clip-path:url(#GraphRegion)\" points=\"";
-				for (auto index = 1; index < (GraphWidth < TheValues.size() ? GraphWidth : TheValues.size()); index++)
-					SVGFile << index + GraphLeft << "," << int(((VoltMax - TheValues[index].GetVoltageOut()) * VoltVerticalFactor) + GraphTop) << " ";
-				SVGFile << "\" />" << std::endl;
-
-				SVGFile << "</svg>" << std::endl;
-				SVGFile.close();
-				struct utimbuf SVGut;
-				SVGut.actime = TheValues.begin()->Time;
-				SVGut.modtime = TheValues.begin()->Time;
-				utime(SVGFileName.c_str(), &SVGut);
 			}
 		}
+		close(fd);
 	}
+	return(rval);
 }
-void WriteAllSVG()
+// Hands the contents of a log file to Reader, decompressing it first if its month is over and it was compressed.
+// Whatever could be decompressed from a damaged file is still handed over, the readers skip what doesn't check.
+bool ReadLogFileData(const std::filesystem::path& filename, const std::function<void(const char* Data, const size_t Size)>& Reader)
 {
-	for (auto it = VictronSmartLithiumMRTGLogs.begin(); it != VictronSmartLithiumMRTGLogs.end(); it++)
-	{
-		const bdaddr_t TheAddress = it->first;
-		std::string btAddress(ba2string(TheAddress));
-		for (auto pos = btAddress.find(':'); pos != std::string::npos; pos = btAddress.find(':'))
-			btAddress.erase(pos, 1);
-		std::string ssTitle(btAddress);
-		if (VictronNames.find(TheAddress) != VictronNames.end())
-			ssTitle = VictronNames.find(TheAddress)->second + " (" + ba2string(TheAddress) + ")";
-		std::filesystem::path OutputPath;
-		std::ostringstream OutputFilename;
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-day.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		std::vector<VictronSmartLithium> TheValues;
-		ReadMRTGData(TheAddress, TheValues, VictronSmartLithiumMRTGLogs, GraphType::daily);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::daily, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-week.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronSmartLithiumMRTGLogs, GraphType::weekly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::weekly, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-month.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronSmartLithiumMRTGLogs, GraphType::monthly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::monthly, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-year.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronSmartLithiumMRTGLogs, GraphType::yearly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::yearly, SVGFahrenheit);
-	}
-	for (auto it = VictronOrionXSMRTGLogs.begin(); it != VictronOrionXSMRTGLogs.end(); it++)
-	{
-		const bdaddr_t TheAddress = it->first;
-		std::string btAddress(ba2string(TheAddress));
-		for (auto pos = btAddress.find(':'); pos != std::string::npos; pos = btAddress.find(':'))
-			btAddress.erase(pos, 1);
-		std::string ssTitle(btAddress);
-		if (VictronNames.find(TheAddress) != VictronNames.end())
-			ssTitle = VictronNames.find(TheAddress)->second + " (" + ba2string(TheAddress) + ")";
-		std::filesystem::path OutputPath;
-		std::ostringstream OutputFilename;
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-day.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		std::vector<VictronOrionXS> TheValues;
-		ReadMRTGData(TheAddress, TheValues, VictronOrionXSMRTGLogs, GraphType::daily);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::daily, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-week.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronOrionXSMRTGLogs, GraphType::weekly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::weekly, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-month.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronOrionXSMRTGLogs, GraphType::monthly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::monthly, SVGFahrenheit);
-		OutputFilename.str("");
-		OutputFilename << "victron-";
-		OutputFilename << btAddress;
-		OutputFilename << "-year.svg";
-		OutputPath = SVGDirectory / OutputFilename.str();
-		ReadMRTGData(TheAddress, TheValues, VictronOrionXSMRTGLogs, GraphType::yearly);
-		WriteSVG(TheValues, OutputPath, ssTitle, GraphType::yearly, SVGFahrenheit);
+	if (filename.extension() != ".gz")
+		return(ReadMappedFile(filename, Reader));
+	bool rval = false;
+	int fd(open(filename.c_str(), O_RDONLY | O_CLOEXEC));
+	if (fd >= 0)
+	{
+		// The last four bytes of a gzip file are the uncompressed size, so the whole file is decompressed into one allocation
+		struct stat64 FileStat;
+		uint32_t UncompressedSize(0);
+		if ((0 == fstat64(fd, &FileStat)) && (FileStat.st_size >= 4))
+			if (sizeof(UncompressedSize) == pread64(fd, &UncompressedSize, sizeof(UncompressedSize), FileStat.st_size - sizeof(UncompressedSize)))
+				UncompressedSize = le32toh(UncompressedSize);
+		gzFile Compressed(gzdopen(fd, "rb"));
+		if (Compressed != nullptr)
+		{
+			gzbuffer(Compressed, 128 * 1024);
+			std::string Data(std::min(size_t(UncompressedSize), size_t(FileStat.st_size) * 64) + 1, '\0'); // a spare byte so the end is seen without growing, and no more than a damaged size could ask for
+			size_t Used(0);
+			int BytesRead;
+			while ((BytesRead = gzread(Compressed, Data.data() + Used, unsigned(std::min(Data.size() - Used, size_t(1) << 30)))) > 0)
+			{
+				Used += BytesRead;
+				if (Used == Data.size())
+					Data.resize(2 * Data.size());
+			}
+			int ErrorNumber(Z_OK);
+			const std::string ErrorMessage(gzerror(Compressed, &ErrorNumber));
+			if ((BytesRead < 0) || (ErrorNumber != Z_OK)) // a file cut short reads to its end and then reports Z_BUF_ERROR
+			{
+				if (ConsoleVerbosity > 0)
+					std::cout << "[" << getTimeISO8601(true) << "] Error decompressing " << filename.string() << ": " << ErrorMessage << std::endl;
+				else
+					std::cerr << "Error decompressing " << filename.string() << ": " << ErrorMessage << std::endl;
+			}
+			gzclose(Compressed);
+			Reader(Data.data(), Used);
+			rval = true;
+		}
+		else
+			close(fd);
+	}
+	return(rval);
+}
+// Walks a text log file line by line and hands each good record to Callback. Returns the number of bad lines. ValidEnd is set to just past the last good line,
+// and bUnchecked is set if any good line had no checksum. Blank lines, and the NULs a crash during a write leaves in front of the next line, are passed over.
+size_t ScanTextLog(const char* Data, const size_t Size, const std::function<void(const VictronLogRecord&)>& Callback, size_t& ValidEnd, bool& bUnchecked)
+{
+	size_t BadRecords(0);
+	ValidEnd = 0;
+	bUnchecked = false;
+	for (size_t Offset = 0; Offset < Size; )
+	{
+		while ((Offset < Size) && (Data[Offset] == '\0'))
+			Offset++;
+		const char* LineEnd(static_cast<const char*>(memchr(Data + Offset, '\n', Size - Offset)));
+		const size_t Length(((LineEnd == nullptr) ? Data + Size : LineEnd) - (Data + Offset));
+		const size_t NextLine(Offset + Length + ((LineEnd == nullptr) ? 0 : 1));
+		if (std::any_of(Data + Offset, Data + Offset + Length, [](const char c) { return(!isspace(static_cast<unsigned char>(c))); }))
+		{
+			VictronLogRecord Record({ 0, 0, 0, { 0 } });
+			bool bChecksum(false);
+			if (ParseLogLine(Data + Offset, Length, Record, bChecksum))
+			{
+				if (!bChecksum)
+					bUnchecked = true;
+				Callback(Record);
+				ValidEnd = NextLine;
+			}
+			else
+			{
+				BadRecords++;
+				if (ConsoleVerbosity > 1)
+					std::cout << "[" << getTimeISO8601(true) << "] Bad line: " << std::string(Data + Offset, std::find(Data + Offset, Data + Offset + Length, '\0')) << std::endl;
+			}
+		}
+		Offset = NextLine;
+	}
+	return(BadRecords);
+}
+// Walks the frames of a binary log file and hands each good record to Callback. A frame that fails its length or checksum starts a damaged stretch,
+// which is stepped over a byte at a time until frames check again, so the file is read in one pass however it was damaged. Returns the number of damaged
+// stretches, and sets ValidEnd to just past the last good frame. Begin can start the walk at a frame the index points to.
+size_t ScanLogFrames(const char* Data, const size_t Size, const std::function<void(const VictronLogRecord&)>& Callback, size_t& ValidEnd, const size_t Begin = sizeof(VictronLogHeader))
+{
+	size_t BadRecords(0);
+	bool bDamaged(false);
+	size_t Offset(std::max(Begin, sizeof(VictronLogHeader)));
+	ValidEnd = Offset;
+	while (Offset < Size)
+	{
+		VictronLogFrame Frame;
+		bool bGood(Offset + sizeof(Frame) <= Size);
+		if (bGood)
+		{
+			memcpy(&Frame, Data + Offset, sizeof(Frame));
+			bGood = (le32toh(Frame.Length) == sizeof(VictronLogRecord)) &&
+				(le32toh(Frame.Checksum) == crc32c(0, reinterpret_cast<const uint8_t*>(Data + Offset + sizeof(Frame.Checksum)), sizeof(Frame) - sizeof(Frame.Checksum))) &&
+				(Frame.Record.Length > 4) && (Frame.Record.Length <= sizeof(Frame.Record.ManufacturerData)) && (Frame.Record.RecordType == Frame.Record.ManufacturerData[4]);
+		}
+		if (bGood)
+		{
+			Frame.Record.Time = le64toh(Frame.Record.Time);
+			Callback(Frame.Record);
+			Offset += sizeof(Frame);
+			ValidEnd = Offset;
+			bDamaged = false;
+		}
+		else
+		{
+			if (!bDamaged)
+				BadRecords++;
+			bDamaged = true;
+			Offset++;
+		}
+	}
+	return(BadRecords);
+}
+// Narrows a read of the records from Start to End to the part of a log file of LogSize bytes that its index says holds them.
+// Without an index, or when the whole file is wanted, that's everything.
+void LogIndexRange(const std::filesystem::path& filename, const size_t LogSize, const time_t Start, const time_t End, size_t& Begin, size_t& Finish)
+{
+	Begin = 0;
+	Finish = LogSize;
+	if ((Start > 0) || (End < std::numeric_limits<time_t>::max()))
+		for (auto& Entry : ReadLogIndex(GenerateLogIndexName(filename), LogSize))
+		{
+			if (Entry.Time <= Start)
+				Begin = Entry.Offset;
+			else if (Entry.Time > End)
+			{
+				Finish = Entry.Offset;
+				break;
+			}
+		}
+}
+// Text log files are read in one pass. Files with lines from before checksums were written are sorted by time if they need it.
+size_t ReadTextLogFile(const std::filesystem::path& filename, const std::function<void(const VictronLogRecord&)>& Callback, const time_t Start, const time_t End)
+{
+	size_t BadRecords(0);
+	ReadLogFileData(filename, [&](const char* Data, const size_t Size) {
+		std::vector<VictronLogRecord> Records;
+		size_t ValidEnd(0), Begin(0), Finish(Size);
+		bool bUnchecked(false);
+		LogIndexRange(filename, Size, Start, End, Begin, Finish);
+		BadRecords = ScanTextLog(Data + Begin, Finish - Begin, [&Records](const VictronLogRecord& Record) { Records.push_back(Record); }, ValidEnd, bUnchecked);
+		if (bUnchecked && !std::is_sorted(Records.begin(), Records.end(), [](const VictronLogRecord& a, const VictronLogRecord& b) { return(a.Time < b.Time); }))
+			std::stable_sort(Records.begin(), Records.end(), [](const VictronLogRecord& a, const VictronLogRecord& b) { return(a.Time < b.Time); });
+		for (auto& Record : Records)
+			Callback(Record);
+	});
+	return(BadRecords);
+}
+// Binary log files are mapped and read in one pass. Version 1 files have no checksums, so their records are checked for an impossible length,
+// a partial record at the end is counted and skipped, and they're copied and sorted if they aren't in time order.
+size_t ReadBinaryLogFile(const std::filesystem::path& filename, const std::function<void(const VictronLogRecord&)>& Callback, const time_t Start, const time_t End)
+{
+	size_t BadRecords(0);
+	ReadLogFileData(filename, [&](const char* Data, const size_t FileSize) {
+		if (FileSize == 0)
+			return;
+		const VictronLogHeader* Header(reinterpret_cast<const VictronLogHeader*>(Data));
+		if ((FileSize >= sizeof(VictronLogHeader)) && (0 == memcmp(Header->Magic, VictronLogMagic, sizeof(Header->Magic))) && (le32toh(Header->Version) == VictronLogVersion) && (le32toh(Header->RecordSize) == sizeof(VictronLogFrame)))
+		{
+			size_t ValidEnd(0), Begin(0), Finish(FileSize);
+			LogIndexRange(filename, FileSize, Start, End, Begin, Finish);
+			BadRecords = ScanLogFrames(Data, Finish, Callback, ValidEnd, Begin);
+		}
+		else if ((FileSize >= sizeof(VictronLogHeader)) && (0 == memcmp(Header->Magic, VictronLogMagic, sizeof(Header->Magic))) && (le32toh(Header->Version) == VictronLogVersionUnframed) && (le32toh(Header->RecordSize) == sizeof(VictronLogRecord)))
+		{
+			const VictronLogRecord* Records(reinterpret_cast<const VictronLogRecord*>(Header + 1));
+			const size_t Count((FileSize - sizeof(VictronLogHeader)) / sizeof(VictronLogRecord));
+			if ((FileSize - sizeof(VictronLogHeader)) % sizeof(VictronLogRecord) != 0)
+				BadRecords++;
+			std::vector<VictronLogRecord> Sorted;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+			Sorted.assign(Records, Records + Count);
+			for (auto& Record : Sorted)
+				Record.Time = le64toh(Record.Time);
+			Records = Sorted.data();
+#endif
+			if (!std::is_sorted(Records, Records + Count, [](const VictronLogRecord& a, const VictronLogRecord& b) { return(a.Time < b.Time); }))
+			{
+				if (Sorted.empty())
+					Sorted.assign(Records, Records + Count);
+				std::stable_sort(Sorted.begin(), Sorted.end(), [](const VictronLogRecord& a, const VictronLogRecord& b) { return(a.Time < b.Time); });
+				Records = Sorted.data();
+			}
+			for (size_t index = 0; index < Count; index++)
+				if ((Records[index].Length > 4) && (Records[index].Length <= sizeof(Records[index].ManufacturerData)) && (Records[index].RecordType == Records[index].ManufacturerData[4]))
+					Callback(Records[index]);
+				else
+					BadRecords++;
+		}
+		else if (ConsoleVerbosity > 0)
+			std::cout << "[" << getTimeISO8601(true) << "] Not a binary log file this version can read: " << filename.string() << std::endl;
+		else
+			std::cerr << "Not a binary log file this version can read: " << filename.string() << std::endl;
+	});
+	return(BadRecords);
+}
+// Calls Callback for every record from Start to End in a text or binary log file, in time order, and reports how many were skipped.
+// The log file's index keeps a narrow range from reading much more of the file than the range covers.
+void ForEachLogRecord(const std::filesystem::path& filename, const std::function<void(const VictronLogRecord&)>& Callback, const time_t Start = 0, const time_t End = std::numeric_limits<time_t>::max())
+{
+	std::function<void(const VictronLogRecord&)> InRange([&](const VictronLogRecord& Record) { if ((Record.Time >= Start) && (Record.Time <= End)) Callback(Record); });
+	const bool bWholeFile((Start <= 0) && (End == std::numeric_limits<time_t>::max()));
+	const size_t BadRecords(IsBinaryLogFile(filename) ? ReadBinaryLogFile(filename, bWholeFile ? Callback : InRange, Start, End) : ReadTextLogFile(filename, bWholeFile ? Callback : InRange, Start, End));
+	if (BadRecords > 0)
+	{
+		if (ConsoleVerbosity > 0)
+			std::cout << "[" << getTimeISO8601(true) << "] Skipped " << BadRecords << " bad records in " << filename.string() << std::endl;
+		else
+			std::cerr << "Skipped " << BadRecords << " bad records in " << filename.string() << std::endl;
 	}
 }
-/////////////////////////////////////////////////////////////////////////////
 void ReadLoggedData(const std::filesystem::path& filename)
 {
 	const std::regex BluetoothAddressRegex("[[:xdigit:]]{12}");
@@ -1784,17 +3044,20 @@ void ReadLoggedData(const std::filesystem::path& filename)
 			ssBTAddress.insert(index, ":");
 		bdaddr_t TheBlueToothAddress(string2ba(ssBTAddress));
 
-		// Only read the file if it's newer than what we may have cached
+		// Only read the file if it's newer than what we may have cached, and only from where the cache ends
 		bool bReadFile = true;
+		time_t Start(0);
 		struct stat64 FileStat;
 		FileStat.st_mtim.tv_sec = 0;
 		if (0 == stat64(filename.c_str(), &FileStat))	// returns 0 if the file-status information is obtained
 		{
-			auto it = VictronSmartLithiumMRTGLogs.find(TheBlueToothAddress);
-			if (it != VictronSmartLithiumMRTGLogs.end())
-				if (!it->second.empty())
-					if (FileStat.st_mtim.tv_sec < (it->second.begin()->Time))	// only read the file if it more recent than existing data
-						bReadFile = false;
+			auto it = VictronDevices.find(TheBlueToothAddress);
+			if (it != VictronDevices.end())
+			{
+				Start = GetMRTGTime(it->second); // UpdateMRTGData ignores anything that isn't newer
+				if (FileStat.st_mtim.tv_sec < Start)	// only read the file if it more recent than existing data
+					bReadFile = false;
+			}
 		}
 
 		if (bReadFile)
@@ -1803,35 +3066,15 @@ void ReadLoggedData(const std::filesystem::path& filename)
 				std::cout << "[" << getTimeISO8601(true) << "] Reading: " << filename.string() << std::endl;
 			else
 				std::cerr << "Reading: " << filename.string() << std::endl;
-			std::ifstream TheFile(filename);
-			if (TheFile.is_open())
-			{
-				std::vector<std::string> SortableFile;
-				std::string TheLine;
-				while (std::getline(TheFile, TheLine))
-					SortableFile.push_back(TheLine);
-				TheFile.close();
-				sort(SortableFile.begin(), SortableFile.end());
-				for (auto iter = SortableFile.begin(); iter != SortableFile.end(); iter++)
-				{
-					VictronSmartLithium TheValue(*iter);
-					if (TheValue.IsValid())
-						UpdateMRTGData(TheBlueToothAddress, TheValue, VictronSmartLithiumMRTGLogs);
-					else
-					{
-						VictronOrionXS TheValue(*iter);
-						if (TheValue.IsValid())
-							UpdateMRTGData(TheBlueToothAddress, TheValue, VictronOrionXSMRTGLogs);
-					}
-				}
-			}
+			ForEachLogRecord(filename, [&](const VictronLogRecord& Record) {
+				StoreVictronRecord(TheBlueToothAddress, Record.ManufacturerData, Record.Length, Record.Time); // the record type byte picks the sample type, so each record is decoded once
+			}, Start);
 		}
 	}
 }
 // Finds log files specific to this program then reads the contents into the memory mapped structure simulating MRTG log files.
 void ReadLoggedData(void)
 {
-	const std::regex LogFileRegex("victron-[[:xdigit:]]{12}-[[:digit:]]{4}-[[:digit:]]{2}.txt");
 	if (!LogDirectory.empty())
 	{
 		if (ConsoleVerbosity > 1)
@@ -1852,61 +3095,183 @@ void ReadLoggedData(void)
 		}
 	}
 }
-/////////////////////////////////////////////////////////////////////////////
-std::filesystem::path GenerateCacheFileName(const bdaddr_t& a)
-{
-	std::string btAddress(ba2string(a));
-	for (auto pos = btAddress.find(':'); pos != std::string::npos; pos = btAddress.find(':'))
-		btAddress.erase(pos, 1);
-	std::ostringstream OutputFilename;
-	OutputFilename << "victron-";
-	OutputFilename << btAddress;
-	OutputFilename << "-cache.txt";
-	std::filesystem::path CacheFileName(CacheDirectory / OutputFilename.str());
-	return(CacheFileName);
-}
-template <typename VictronType>
-bool GenerateCacheFile(const bdaddr_t& a, const std::vector<VictronType>& MRTGLog)
+// Writes a copy of a log file in the other format next to it, text to binary or binary to text, with the same modification time so it isn't mistaken for newer data.
+// The original is left in place, and an existing file is never appended to.
+bool ConvertLogFile(const std::filesystem::path& filename)
 {
-	bool rval(false);
-	if (!MRTGLog.empty())
+	bool rval = false;
+	std::filesystem::path NewFilename(filename);
+	if (NewFilename.extension() == ".gz") // the copy isn't compressed
+		NewFilename.replace_extension();
+	NewFilename.replace_extension(IsBinaryLogFile(filename) ? ".txt" : ".bin");
+	if (std::filesystem::exists(NewFilename))
 	{
-		std::filesystem::path MRTGCacheFile(GenerateCacheFileName(a));
-		struct stat64 Stat({ 0 });	// Zero the stat64 structure when it's allocated
-		stat64(MRTGCacheFile.c_str(), &Stat);	// This shouldn't change Stat if the file doesn't exist.
-		if (difftime(MRTGLog[0].Time, Stat.st_mtim.tv_sec) > 60 * 60) // If Cache File has data older than 60 minutes, write it
+		if (ConsoleVerbosity > 0)
+			std::cout << "[" << getTimeISO8601(true) << "] Not converting " << filename.string() << ", " << NewFilename.string() << " already exists" << std::endl;
+		else
+			std::cerr << "Not converting " << filename.string() << ", " << NewFilename.string() << " already exists" << std::endl;
+	}
+	else
+	{
+		std::queue<VictronLogRecord> Records;
+		ForEachLogRecord(filename, [&Records](const VictronLogRecord& Record) { Records.push(Record); });
+		const size_t Count(Records.size());
+		if (AppendLogFile(NewFilename, Records))
 		{
-			std::ofstream CacheFile(MRTGCacheFile, std::ios_base::out | std::ios_base::trunc);
-			if (CacheFile.is_open())
+			struct stat64 FileStat;
+			if (0 == stat64(filename.c_str(), &FileStat))
 			{
-				if (ConsoleVerbosity > 0)
-					std::cout << "[" << getTimeISO8601(true) << "] Writing: " << MRTGCacheFile.string() << std::endl;
-				else
-					std::cerr << "Writing: " << MRTGCacheFile.string() << std::endl;
-				CacheFile << "Cache: " << ba2string(a) << " " << ProgramVersionString << std::endl;
-				for (auto i : MRTGLog)
-					CacheFile << i.WriteCache() << std::endl;
-				CacheFile.close();
 				struct utimbuf ut;
-				ut.actime = MRTGLog[0].Time;
-				ut.modtime = MRTGLog[0].Time;
-				utime(MRTGCacheFile.c_str(), &ut);
-				rval = true;
+				ut.actime = FileStat.st_atim.tv_sec;
+				ut.modtime = FileStat.st_mtim.tv_sec;
+				utime(NewFilename.c_str(), &ut);
 			}
+			if (ConsoleVerbosity > 0)
+				std::cout << "[" << getTimeISO8601(true) << "] Converted " << Count << " records: " << filename.string() << " -> " << NewFilename.string() << std::endl;
+			else
+				std::cerr << "Converted " << Count << " records: " << filename.string() << " -> " << NewFilename.string() << std::endl;
+			rval = true;
+		}
+	}
+	return(rval);
+}
+// Cuts off whatever follows the last good record in a log file, which is what a crash part way through a write leaves behind.
+// Damage with good records after it is left in place for the readers to step over. A text file without a single good line is left alone,
+// it has no header to say it is a log file at all.
+bool RepairLogFile(const std::filesystem::path& filename)
+{
+	bool rval = false;
+	bool bReadable(false);
+	size_t FileSize(0), ValidEnd(0), GoodRecords(0);
+	if (filename.extension() != ".gz")
+		ReadMappedFile(filename, [&](const char* Data, const size_t Size) {
+			FileSize = Size;
+			if (filename.extension() == ".bin")
+			{
+				const VictronLogHeader* Header(reinterpret_cast<const VictronLogHeader*>(Data));
+				if ((Size >= sizeof(VictronLogHeader)) && (0 == memcmp(Header->Magic, VictronLogMagic, sizeof(Header->Magic))))
+				{
+					if ((le32toh(Header->Version) == VictronLogVersion) && (le32toh(Header->RecordSize) == sizeof(VictronLogFrame)))
+					{
+						ScanLogFrames(Data, Size, [](const VictronLogRecord&) {}, ValidEnd);
+						bReadable = true;
+					}
+					else if ((le32toh(Header->Version) == VictronLogVersionUnframed) && (le32toh(Header->RecordSize) == sizeof(VictronLogRecord)))
+					{
+						ValidEnd = Size - (Size - sizeof(VictronLogHeader)) % sizeof(VictronLogRecord);
+						bReadable = true;
+					}
+				}
+			}
+			else
+			{
+				bool bUnchecked(false);
+				ScanTextLog(Data, Size, [&GoodRecords](const VictronLogRecord&) { GoodRecords++; }, ValidEnd, bUnchecked);
+				bReadable = (GoodRecords > 0) || (Size == 0);
+			}
+		});
+	std::ostringstream ssOutput;
+	if (filename.extension() == ".gz") // only closed months are compressed, after they were written in full
+	{
+		ssOutput << "Nothing to repair in a compressed file: " << filename.string();
+		rval = true;
+	}
+	else if (!bReadable)
+		ssOutput << "Not a log file this version can repair: " << filename.string();
+	else if (ValidEnd == FileSize)
+	{
+		ssOutput << "Nothing to repair: " << filename.string();
+		rval = true;
+	}
+	else if (0 == truncate64(filename.c_str(), ValidEnd))
+	{
+		const std::filesystem::path IndexFilename(GenerateLogIndexName(filename));
+		int IndexFile(open(IndexFilename.c_str(), O_RDWR | O_CLOEXEC));
+		if (IndexFile >= 0)
+		{
+			TrimLogIndex(IndexFile, IndexFilename, ValidEnd);
+			close(IndexFile);
 		}
+		ssOutput << "Truncated " << FileSize - ValidEnd << " damaged bytes: " << filename.string();
+		rval = true;
 	}
+	else
+		ssOutput << "Can't truncate " << filename.string() << ": " << strerror(errno);
+	if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] " << ssOutput.str() << std::endl;
+	else
+		std::cerr << ssOutput.str() << std::endl;
 	return(rval);
 }
+/////////////////////////////////////////////////////////////////////////////
+std::filesystem::path GenerateCacheFileName(const bdaddr_t& a)
+{
+	std::string btAddress(ba2string(a));
+	for (auto pos = btAddress.find(':'); pos != std::string::npos; pos = btAddress.find(':'))
+		btAddress.erase(pos, 1);
+	std::ostringstream OutputFilename;
+	OutputFilename << "victron-";
+	OutputFilename << btAddress;
+	OutputFilename << "-cache.txt";
+	std::filesystem::path CacheFileName(CacheDirectory / OutputFilename.str());
+	return(CacheFileName);
+}
 template <typename VictronType>
-void GenerateCacheFile(std::map<bdaddr_t, std::vector<VictronType>>& MRTGLogMap)
+bool GenerateCacheFile(const bdaddr_t& a, const std::vector<VictronType>& MRTGLog)
+{
+	bool rval(false);
+	if (!MRTGLog.empty())
+	{
+		std::filesystem::path MRTGCacheFile(GenerateCacheFileName(a));
+		struct stat64 Stat({ 0 });	// Zero the stat64 structure when it's allocated
+		stat64(MRTGCacheFile.c_str(), &Stat);	// This shouldn't change Stat if the file doesn't exist.
+		if (difftime(MRTGLog[0].Time, Stat.st_mtim.tv_sec) > 60 * 60) // If Cache File has data older than 60 minutes, write it
+		{
+			std::ofstream CacheFile(MRTGCacheFile, std::ios_base::out | std::ios_base::trunc);
+			if (CacheFile.is_open())
+			{
+				if (ConsoleVerbosity > 0)
+					std::cout << "[" << getTimeISO8601(true) << "] Writing: " << MRTGCacheFile.string() << std::endl;
+				else
+					std::cerr << "Writing: " << MRTGCacheFile.string() << std::endl;
+				CacheFile << "Cache: " << ba2string(a) << " " << ProgramVersionString << " RecordType: " << std::hex << std::setfill('0') << std::setw(2) << int(VictronType::RecordType) << std::dec << " Sums" << std::endl;
+				for (auto i : MRTGLog)
+					CacheFile << i.WriteCache() << std::endl;
+				CacheFile.close();
+				struct utimbuf ut;
+				ut.actime = MRTGLog[0].Time;
+				ut.modtime = MRTGLog[0].Time;
+				utime(MRTGCacheFile.c_str(), &ut);
+				rval = true;
+			}
+		}
+	}
+	return(rval);
+}
+void GenerateCacheFile(void)
 {
 	if (!CacheDirectory.empty())
 	{
 		if (ConsoleVerbosity > 1)
 			std::cout << "[" << getTimeISO8601() << "] GenerateCacheFile: " << CacheDirectory << std::endl;
-		for (auto it = MRTGLogMap.begin(); it != MRTGLogMap.end(); ++it)
-			GenerateCacheFile(it->first, it->second);
+		for (auto& [TheAddress, TheLog] : VictronDevices)
+			std::visit([&TheAddress = TheAddress](auto& FakeMRTGFile) { GenerateCacheFile(TheAddress, FakeMRTGFile); }, TheLog);
+	}
+}
+template <typename VictronType>
+void ReadCacheFile(std::ifstream& TheFile, const bdaddr_t& TheBlueToothAddress, const bool Sums)
+{
+	std::vector<VictronType> FakeMRTGFile;
+	FakeMRTGFile.reserve(2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT); // this might speed things up slightly
+	std::string TheLine;
+	while (std::getline(TheFile, TheLine))
+	{
+		VictronType value;
+		value.ReadCache(TheLine, Sums);
+		FakeMRTGFile.push_back(value);
 	}
+	if (FakeMRTGFile.size() == (2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT)) // simple check to see if we are the right size
+		VictronDevices.insert(std::pair<bdaddr_t, VictronMRTGLog>(TheBlueToothAddress, FakeMRTGFile));
 }
 void ReadCacheDirectory(void)
 {
@@ -1945,16 +3310,32 @@ void ReadCacheDirectory(void)
 							if (std::regex_search(TheLine, BluetoothAddress, BluetoothAddressRegex))
 							{
 								bdaddr_t TheBlueToothAddress(string2ba(BluetoothAddress.str()));
-								std::vector<VictronSmartLithium> FakeMRTGFile;
-								FakeMRTGFile.reserve(2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT); // this might speed things up slightly
-								while (std::getline(TheFile, TheLine))
+								// Cache files written before the record type was added only ever held SmartLithium data, and ones written before samples were stored as sums hold averages
+								const std::regex RecordTypeRegex("RecordType: ([[:xdigit:]]{2})( Sums)?$");
+								std::smatch RecordType;
+								const bool bRecordType(std::regex_search(TheLine, RecordType, RecordTypeRegex));
+								const bool bSums(bRecordType && RecordType[2].matched);
+								switch (bRecordType ? std::stoi(RecordType[1].str(), nullptr, 16) : VictronSmartLithium::RecordType)
 								{
-									VictronSmartLithium value;
-									value.ReadCache(TheLine);
-									FakeMRTGFile.push_back(value);
+								case VictronSmartLithium::RecordType:
+									ReadCacheFile<VictronSmartLithium>(TheFile, TheBlueToothAddress, bSums);
+									break;
+								case VictronOrionXS::RecordType:
+									ReadCacheFile<VictronOrionXS>(TheFile, TheBlueToothAddress, bSums);
+									break;
+								case VictronSolarCharger::RecordType:
+									ReadCacheFile<VictronSolarCharger>(TheFile, TheBlueToothAddress, bSums);
+									break;
+								case VictronBatteryMonitor::RecordType:
+									ReadCacheFile<VictronBatteryMonitor>(TheFile, TheBlueToothAddress, bSums);
+									break;
+								case VictronDCDCConverter::RecordType:
+									ReadCacheFile<VictronDCDCConverter>(TheFile, TheBlueToothAddress, bSums);
+									break;
+								case VictronLynxSmartBMS::RecordType:
+									ReadCacheFile<VictronLynxSmartBMS>(TheFile, TheBlueToothAddress, bSums);
+									break;
 								}
-								if (FakeMRTGFile.size() == (2 + DAY_COUNT + WEEK_COUNT + MONTH_COUNT + YEAR_COUNT)) // simple check to see if we are the right size
-									VictronSmartLithiumMRTGLogs.insert(std::pair<bdaddr_t, std::vector<VictronSmartLithium>>(TheBlueToothAddress, FakeMRTGFile));
 							}
 						}
 					}
@@ -1966,338 +3347,1071 @@ void ReadCacheDirectory(void)
 	}
 }
 /////////////////////////////////////////////////////////////////////////////
-std::string bluez_dbus_msg_iter(DBusMessageIter& array_iter, const bdaddr_t& dbusBTAddress)
+// The D-Bus receive thread does nothing more than copy Victron manufacturer data into this queue.
+// Decrypting, decoding, logging and graphing happen on the processing thread, so file I/O never stops us reading D-Bus.
+const size_t VictronManufacturerDataMax(32); // Victron manufacturer data is 8 header bytes plus at most 20 bytes of extra data, buffers are rounded up to whole AES blocks
+const size_t VictronManufacturerDataLogged(sizeof(VictronLogRecord::ManufacturerData)); // longer frames are counted and thrown away when they are received, the log couldn't hold them
+static_assert(VictronManufacturerDataLogged <= VictronManufacturerDataMax, "every frame that can be logged fits in the receive buffers");
+std::atomic<size_t> VictronOversizeFrames(0);
+const uint16_t VictronManufacturerID(0x02E1); // 'Victron Energy BV' https://bitbucket.org/bluetooth-SIG/public/src/main/assigned_numbers/company_identifiers/company_identifiers.yaml
+struct VictronRawFrame {
+	bdaddr_t Address;
+	time_t Time;
+	uint16_t ManufacturerID;
+	uint8_t Length;
+	bool bDropped = false; // set on the processing thread when the frame is inside --interval, so it is neither decrypted nor stored
+	uint8_t ManufacturerData[VictronManufacturerDataMax];
+};
+// Bounded lock free queue with exactly one producer thread and one consumer thread.
+template <typename T>
+class SPSCRingBuffer
 {
-	std::ostringstream ssOutput;
-	time_t TimeNow;
-	time(&TimeNow);
-	auto Device = VictronEncryptionKeys.find(dbusBTAddress);
-	if (Device != VictronEncryptionKeys.end())
-	do
+public:
+	SPSCRingBuffer(const size_t MinimumCapacity);
+	bool Push(const T& value);	// only call from the producer thread
+	bool Pop(T& value);			// only call from the consumer thread
+	size_t Size(void) const { return(Tail.load(std::memory_order_acquire) - Head.load(std::memory_order_acquire)); };
+	size_t Capacity(void) const { return(Buffer.size()); };
+	size_t Dropped(void) const { return(DroppedCount.load(std::memory_order_relaxed)); };
+	size_t HighWater(void) const { return(HighWaterMark.load(std::memory_order_relaxed)); };
+protected:
+	std::vector<T> Buffer;
+	size_t Mask;
+	alignas(64) std::atomic<size_t> Head;	// next element to be read, only written by the consumer
+	alignas(64) std::atomic<size_t> Tail;	// next element to be written, only written by the producer
+	alignas(64) std::atomic<size_t> DroppedCount;
+	std::atomic<size_t> HighWaterMark;
+};
+template <typename T>
+SPSCRingBuffer<T>::SPSCRingBuffer(const size_t MinimumCapacity) : Head(0), Tail(0), DroppedCount(0), HighWaterMark(0)
+{
+	size_t TheCapacity(1);
+	while (TheCapacity < MinimumCapacity) // round up to a power of two so indexes can be masked instead of divided
+		TheCapacity <<= 1;
+	Buffer.resize(TheCapacity);
+	Mask = TheCapacity - 1;
+}
+template <typename T>
+bool SPSCRingBuffer<T>::Push(const T& value)
+{
+	const size_t tail(Tail.load(std::memory_order_relaxed));
+	const size_t head(Head.load(std::memory_order_acquire));
+	if (tail - head > Mask)
 	{
-		DBusMessageIter dict2_iter;
-		dbus_message_iter_recurse(&array_iter, &dict2_iter);
-		DBusBasicValue value;
-		dbus_message_iter_get_basic(&dict2_iter, &value);
-		std::string Key(value.str);
-		dbus_message_iter_next(&dict2_iter);
-		DBusMessageIter variant_iter;
-		dbus_message_iter_recurse(&dict2_iter, &variant_iter);
-		auto dbus_message_Type = dbus_message_iter_get_arg_type(&variant_iter);
-		if (!Key.compare("RSSI"))
+		DroppedCount.fetch_add(1, std::memory_order_relaxed);
+		return(false);
+	}
+	Buffer[tail & Mask] = value;
+	Tail.store(tail + 1, std::memory_order_release);
+	if (tail + 1 - head > HighWaterMark.load(std::memory_order_relaxed))
+		HighWaterMark.store(tail + 1 - head, std::memory_order_relaxed);
+	return(true);
+}
+template <typename T>
+bool SPSCRingBuffer<T>::Pop(T& value)
+{
+	const size_t head(Head.load(std::memory_order_relaxed));
+	if (head == Tail.load(std::memory_order_acquire))
+		return(false);
+	value = Buffer[head & Mask];
+	Head.store(head + 1, std::memory_order_release);
+	return(true);
+}
+size_t VictronFrameQueueSize(1024);
+std::unique_ptr<SPSCRingBuffer<VictronRawFrame>> VictronFrameQueue;
+int VictronFrameEvent(-1); // eventfd used to wake the processing thread when frames are queued
+// Reception counts for each adapter, so we can tell which antenna is doing the work when several are scanning.
+// Received counts everything the adapter reported, Unique counts the frames it delivered before any other adapter.
+struct BlueZAdapterStats {
+	std::atomic<size_t> Received{ 0 };
+	std::atomic<size_t> Unique{ 0 };
+};
+std::map<std::string, BlueZAdapterStats> BlueZAdapterStatistics; // keyed by adapter object path, entries are never erased so pointers to them stay valid
+std::mutex BlueZAdapterStatisticsMutex; // held while adding entries on the receive thread or listing them on the processing thread
+BlueZAdapterStats* GetAdapterStats(const std::string& AdapterPath)
+{
+	std::lock_guard<std::mutex> StatsLock(BlueZAdapterStatisticsMutex);
+	return(&BlueZAdapterStatistics[AdapterPath]);
+}
+// Victron devices repeat each advertisement several times with the same IV, BlueZ reports every repeat because of DuplicateData,
+// and with several adapters scanning each one reports the same advertisement. The last few frames from each device are kept here
+// so repeats are thrown away before they are queued or decrypted. More than one is kept because adapters don't report in lock step.
+const size_t VictronRecentFramesMax(4);
+struct VictronRecentFrames {
+	VictronRawFrame Frames[VictronRecentFramesMax];
+	size_t Count = 0;
+};
+bdaddr_map<VictronRecentFrames> VictronLastFrames; // only used on the receive thread
+std::atomic<size_t> VictronDuplicateFrames(0);
+bool QueueVictronFrame(const VictronRawFrame& TheFrame, BlueZAdapterStats* Stats = nullptr)
+{
+	if (Stats != nullptr)
+		Stats->Received++;
+	VictronRecentFrames& Recent(VictronLastFrames[TheFrame.Address]);
+	for (size_t index = 0; (index < Recent.Count) && (index < VictronRecentFramesMax); index++)
+		if ((Recent.Frames[index].Length == TheFrame.Length) && (0 == memcmp(Recent.Frames[index].ManufacturerData, TheFrame.ManufacturerData, TheFrame.Length)))
 		{
-			if (DBUS_TYPE_INT16 == dbus_message_Type)
-			{
-				dbus_message_iter_get_basic(&variant_iter, &value);
-				ssOutput << "[                   ] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << value.i16 << std::endl;
-			}
+			VictronDuplicateFrames++;
+			return(false);
 		}
-		else if (!Key.compare("ManufacturerData"))
+	Recent.Frames[Recent.Count++ % VictronRecentFramesMax] = TheFrame;
+	if (Stats != nullptr)
+		Stats->Unique++;
+	bool rval(VictronFrameQueue->Push(TheFrame));
+	if (rval)
+	{
+		const uint64_t one(1);
+		[[maybe_unused]] const ssize_t written = write(VictronFrameEvent, &one, sizeof(one)); // The eventfd counter can only fail to increment if it would overflow, in which case the consumer is already awake
+	}
+	return(rval);
+}
+// Frames that arrive sooner than this many seconds after the last stored frame from the same device are dropped without being decrypted.
+time_t VictronMinimumInterval(0);
+bdaddr_map<time_t> VictronLastStored; // only used on the processing thread
+size_t VictronIntervalFrames(0);
+// True, and counted, if the frame arrived too soon after the last record stored from its device.
+bool VictronWithinInterval(const VictronRawFrame& TheFrame)
+{
+	bool rval(false);
+	if (VictronMinimumInterval > 0)
+	{
+		auto LastStored = VictronLastStored.find(TheFrame.Address);
+		rval = (LastStored != VictronLastStored.end()) && (TheFrame.Time - LastStored->second < VictronMinimumInterval);
+		if (rval)
+			VictronIntervalFrames++;
+	}
+	return(rval);
+}
+/////////////////////////////////////////////////////////////////////////////
+// Victron payloads are at most two AES blocks, so the cost of going through EVP dominates the actual encryption.
+// When the CPU has AES instructions (AES-NI on x86, the ARMv8 Crypto Extensions on a 64 bit Raspberry Pi) we run CTR mode ourselves
+// and only use EVP_aes_128_ctr() when they are missing. VictronAESSelfTest() checks the fast path against OpenSSL before it is used.
+const uint8_t AESSBox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+// FIPS-197 key expansion, both instruction sets take the round keys in this byte order.
+void aes128_expand_key(const VictronEncryptionKey_t& TheKey, uint8_t RoundKeys[176])
+{
+	memcpy(RoundKeys, TheKey.data(), TheKey.size());
+	uint8_t rcon(0x01);
+	for (auto index = 16; index < 176; index += 4)
+	{
+		uint8_t temp[4] = { RoundKeys[index - 4], RoundKeys[index - 3], RoundKeys[index - 2], RoundKeys[index - 1] };
+		if (0 == (index % 16))
 		{
-			if (DBUS_TYPE_ARRAY == dbus_message_Type)
+			const uint8_t first(temp[0]);
+			temp[0] = AESSBox[temp[1]] ^ rcon;
+			temp[1] = AESSBox[temp[2]];
+			temp[2] = AESSBox[temp[3]];
+			temp[3] = AESSBox[first];
+			rcon = uint8_t((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0));
+		}
+		for (auto byte = 0; byte < 4; byte++)
+			RoundKeys[index + byte] = RoundKeys[index - 16 + byte] ^ temp[byte];
+	}
+}
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("aes,sse2"))) void aes128_encrypt_block_aesni(const uint8_t* RoundKeys, const uint8_t* In, uint8_t* Out)
+{
+	__m128i state = _mm_xor_si128(_mm_loadu_si128((const __m128i*)In), _mm_loadu_si128((const __m128i*)RoundKeys));
+	for (auto round = 1; round < 10; round++)
+		state = _mm_aesenc_si128(state, _mm_loadu_si128((const __m128i*)(RoundKeys + 16 * round)));
+	state = _mm_aesenclast_si128(state, _mm_loadu_si128((const __m128i*)(RoundKeys + 16 * 10)));
+	_mm_storeu_si128((__m128i*)Out, state);
+}
+#elif defined(__aarch64__)
+__attribute__((target("+crypto"))) void aes128_encrypt_block_armv8(const uint8_t* RoundKeys, const uint8_t* In, uint8_t* Out)
+{
+	// AESE does AddRoundKey before SubBytes and ShiftRows, so the last round key is added on its own
+	uint8x16_t state = vld1q_u8(In);
+	for (auto round = 0; round < 9; round++)
+		state = vaesmcq_u8(vaeseq_u8(state, vld1q_u8(RoundKeys + 16 * round)));
+	state = vaeseq_u8(state, vld1q_u8(RoundKeys + 16 * 9));
+	state = veorq_u8(state, vld1q_u8(RoundKeys + 16 * 10));
+	vst1q_u8(Out, state);
+}
+#endif
+// Multi-buffer versions: up to AESLanes independent blocks, each with its own round keys, go through every round together
+// so the pipelined AES unit always has another block to work on while the previous one finishes.
+const size_t AESLanes(8);
+#if defined(__x86_64__) || defined(__i386__)
+template <size_t Lanes>
+__attribute__((target("aes,sse2"))) inline void aes128_encrypt_lanes_aesni(const uint8_t* const* RoundKeys, const uint8_t* In, uint8_t* Out)
+{
+	// Lanes is a constant and the lane loops are unrolled so that every state stays in a register
+	__m128i state[Lanes];
+	#pragma GCC unroll 8
+	for (size_t lane = 0; lane < Lanes; lane++)
+		state[lane] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(In + 16 * lane)), _mm_loadu_si128((const __m128i*)RoundKeys[lane]));
+	for (auto round = 1; round < 10; round++)
+	{
+		#pragma GCC unroll 8
+		for (size_t lane = 0; lane < Lanes; lane++)
+			state[lane] = _mm_aesenc_si128(state[lane], _mm_loadu_si128((const __m128i*)(RoundKeys[lane] + 16 * round)));
+	}
+	#pragma GCC unroll 8
+	for (size_t lane = 0; lane < Lanes; lane++)
+		_mm_storeu_si128((__m128i*)(Out + 16 * lane), _mm_aesenclast_si128(state[lane], _mm_loadu_si128((const __m128i*)(RoundKeys[lane] + 16 * 10))));
+}
+__attribute__((target("aes,sse2"))) void aes128_encrypt_blocks_aesni(const uint8_t* const* RoundKeys, const uint8_t* In, uint8_t* Out, const size_t Count)
+{
+	size_t first(0);
+	for (; first + AESLanes <= Count; first += AESLanes)
+		aes128_encrypt_lanes_aesni<AESLanes>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+	if (first + 4 <= Count)
+	{
+		aes128_encrypt_lanes_aesni<4>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+		first += 4;
+	}
+	for (; first < Count; first++)
+		aes128_encrypt_lanes_aesni<1>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+}
+#elif defined(__aarch64__)
+template <size_t Lanes>
+__attribute__((target("+crypto"))) inline void aes128_encrypt_lanes_armv8(const uint8_t* const* RoundKeys, const uint8_t* In, uint8_t* Out)
+{
+	uint8x16_t state[Lanes];
+	#pragma GCC unroll 8
+	for (size_t lane = 0; lane < Lanes; lane++)
+		state[lane] = vld1q_u8(In + 16 * lane);
+	for (auto round = 0; round < 9; round++)
+	{
+		#pragma GCC unroll 8
+		for (size_t lane = 0; lane < Lanes; lane++)
+			state[lane] = vaesmcq_u8(vaeseq_u8(state[lane], vld1q_u8(RoundKeys[lane] + 16 * round)));
+	}
+	#pragma GCC unroll 8
+	for (size_t lane = 0; lane < Lanes; lane++)
+		vst1q_u8(Out + 16 * lane, veorq_u8(vaeseq_u8(state[lane], vld1q_u8(RoundKeys[lane] + 16 * 9)), vld1q_u8(RoundKeys[lane] + 16 * 10)));
+}
+__attribute__((target("+crypto"))) void aes128_encrypt_blocks_armv8(const uint8_t* const* RoundKeys, const uint8_t* In, uint8_t* Out, const size_t Count)
+{
+	size_t first(0);
+	for (; first + AESLanes <= Count; first += AESLanes)
+		aes128_encrypt_lanes_armv8<AESLanes>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+	if (first + 4 <= Count)
+	{
+		aes128_encrypt_lanes_armv8<4>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+		first += 4;
+	}
+	for (; first < Count; first++)
+		aes128_encrypt_lanes_armv8<1>(RoundKeys + first, In + 16 * first, Out + 16 * first);
+}
+#endif
+typedef void (*AES128EncryptBlocks_t)(const uint8_t* const* RoundKeys, const uint8_t* In, uint8_t* Out, const size_t Count);
+AES128EncryptBlocks_t AES128EncryptBlocks(nullptr); // set along with AES128EncryptBlock
+typedef void (*AES128EncryptBlock_t)(const uint8_t* RoundKeys, const uint8_t* In, uint8_t* Out);
+AES128EncryptBlock_t AES128EncryptBlock(nullptr); // nullptr until VictronAESSelfTest() has checked the instructions are there and give the same answers as OpenSSL
+std::string AES128EncryptBlockName("OpenSSL EVP");
+// The initialization vector is only the 16 bit nonce from the advertisement, so a device has at most 65536 keystreams.
+// With --keystream each device keeps the keystreams for the nonces it is about to use, and decrypting becomes an XOR.
+typedef std::array<uint8_t, VictronManufacturerDataMax> VictronKeyStream_t; // enough for the longest payload
+size_t VictronKeyStreamBudget(0); // bytes of keystream to keep across all devices, zero to turn the cache off
+size_t VictronKeyStreamHits(0);
+size_t VictronKeyStreamMisses(0);
+// One cipher per device, only used on the processing thread.
+// The key schedule is expanded when the cipher is created, each advertisement only sets a new initialization vector.
+struct VictronCipher {
+	VictronEncryptionKey_t Key; // so a reloaded key file can tell which ciphers are out of date
+	EVP_CIPHER_CTX* ctx;
+	uint8_t RoundKeys[176];
+	std::unordered_map<uint16_t, VictronKeyStream_t> KeyStreams; // keyed by nonce
+	std::deque<uint16_t> KeyStreamOrder; // oldest first, so the cache can be kept within its share of the budget
+	uint16_t LastNonce = 0;
+};
+bool VictronCipherInit(VictronCipher& Cipher, const VictronEncryptionKey_t& TheKey)
+{
+	Cipher.Key = TheKey;
+	aes128_expand_key(TheKey, Cipher.RoundKeys);
+	Cipher.ctx = EVP_CIPHER_CTX_new();
+	if ((Cipher.ctx != nullptr) && (1 != EVP_DecryptInit_ex(Cipher.ctx, EVP_aes_128_ctr(), NULL, TheKey.data(), NULL))) // https://docs.openssl.org/3.0/man3/EVP_EncryptInit/
+	{
+		EVP_CIPHER_CTX_free(Cipher.ctx);
+		Cipher.ctx = nullptr;
+	}
+	return(Cipher.ctx != nullptr);
+}
+bool VictronDecryptEVP(VictronCipher& Cipher, const uint8_t* InitializationVector, const uint8_t* In, uint8_t* Out, const int Length)
+{
+	int len(0);
+	return((1 == EVP_DecryptInit_ex(Cipher.ctx, NULL, NULL, NULL, InitializationVector)) && // keeps the cipher and key schedule, only resets the counter
+		(1 == EVP_DecryptUpdate(Cipher.ctx, Out, &len, In, Length)) &&
+		(1 == EVP_DecryptFinal_ex(Cipher.ctx, Out + len, &len)));
+}
+void VictronDecryptFast(const AES128EncryptBlock_t EncryptBlock, const VictronCipher& Cipher, const uint8_t* InitializationVector, const uint8_t* In, uint8_t* Out, const int Length)
+{
+	uint8_t Counter[16];
+	uint8_t KeyStream[16];
+	memcpy(Counter, InitializationVector, sizeof(Counter));
+	for (auto offset = 0; offset < Length; offset += sizeof(KeyStream))
+	{
+		EncryptBlock(Cipher.RoundKeys, Counter, KeyStream);
+		for (auto index = 0; (index < int(sizeof(KeyStream))) && (offset + index < Length); index++)
+			Out[offset + index] = In[offset + index] ^ KeyStream[index];
+		for (auto index = int(sizeof(Counter)) - 1; (index >= 0) && (0 == ++Counter[index]); index--); // the whole block is a big endian counter, the same as OpenSSL
+	}
+}
+bool VictronDecrypt(VictronCipher& Cipher, const uint8_t* InitializationVector, const uint8_t* In, uint8_t* Out, const int Length)
+{
+	if (AES128EncryptBlock == nullptr)
+		return(VictronDecryptEVP(Cipher, InitializationVector, In, Out, Length));
+	VictronDecryptFast(AES128EncryptBlock, Cipher, InitializationVector, In, Out, Length);
+	return(true);
+}
+// One payload of a batch. The payloads can be from any mix of devices and keys.
+struct VictronDecryptJob {
+	VictronCipher* Cipher;
+	uint8_t InitializationVector[16];
+	const uint8_t* In;
+	uint8_t* Out;
+	int Length; // at most VictronManufacturerDataMax
+	bool bDecrypted;
+};
+const size_t VictronDecryptBatchMax(AESLanes);
+const size_t VictronDecryptBlocksMax((VictronManufacturerDataMax + 15) / 16);
+void VictronDecryptBatchFast(const AES128EncryptBlocks_t EncryptBlocks, VictronDecryptJob* Jobs, const size_t Count)
+{
+	// Lay out the counter blocks of every payload, encrypt them all together, then XOR each payload with its part of the keystream
+	for (size_t first = 0; first < Count; first += VictronDecryptBatchMax)
+	{
+		const size_t Last(std::min(Count, first + VictronDecryptBatchMax));
+		const uint8_t* RoundKeys[VictronDecryptBatchMax * VictronDecryptBlocksMax];
+		uint8_t Counters[VictronDecryptBatchMax * VictronDecryptBlocksMax][16];
+		uint8_t KeyStream[VictronDecryptBatchMax * VictronDecryptBlocksMax][16];
+		size_t Blocks(0);
+		for (auto job = first; job < Last; job++)
+		{
+			memcpy(Counters[Blocks], Jobs[job].InitializationVector, sizeof(Counters[Blocks]));
+			RoundKeys[Blocks++] = Jobs[job].Cipher->RoundKeys;
+			for (auto offset = 16; offset < Jobs[job].Length; offset += 16)
 			{
-				DBusMessageIter array3_iter;
-				dbus_message_iter_recurse(&variant_iter, &array3_iter);
-				do
-				{
-					if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&array3_iter))
-					{
-						DBusMessageIter dict1_iter;
-						dbus_message_iter_recurse(&array3_iter, &dict1_iter);
-						if (DBUS_TYPE_UINT16 == dbus_message_iter_get_arg_type(&dict1_iter))
-						{
-							DBusBasicValue value;
-							dbus_message_iter_get_basic(&dict1_iter, &value);
-							uint16_t ManufacturerID(value.u16);
-							dbus_message_iter_next(&dict1_iter);
-							if (DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(&dict1_iter))
-							{
-								DBusMessageIter variant2_iter;
-								dbus_message_iter_recurse(&dict1_iter, &variant2_iter);
-								if (DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&variant2_iter))
-								{
-									std::vector<uint8_t> ManufacturerData;
-									DBusMessageIter array4_iter;
-									dbus_message_iter_recurse(&variant2_iter, &array4_iter);
-									do
-									{
-										if (DBUS_TYPE_BYTE == dbus_message_iter_get_arg_type(&array4_iter))
-										{
-											dbus_message_iter_get_basic(&array4_iter, &value);
-											ManufacturerData.push_back(value.byt);
-										}
-									} while (dbus_message_iter_next(&array4_iter));
-
-									ssOutput << "[" << timeToISO8601(TimeNow, true) << "] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << std::setfill('0') << std::hex << std::setw(4) << ManufacturerID << ":";
-									for (auto& Data : ManufacturerData)
-										ssOutput << std::setw(2) << int(Data);
-									if (ConsoleVerbosity > 4)
-									{
-										// https://bitbucket.org/bluetooth-SIG/public/src/main/assigned_numbers/company_identifiers/company_identifiers.yaml
-										ssOutput << " ";
-										if (0x0001 == ManufacturerID)
-											ssOutput << "'Nokia Mobile Phones'";
-										if (0x0006 == ManufacturerID)
-											ssOutput << "'Microsoft'";
-										if (0x004c == ManufacturerID)
-											ssOutput << "'Apple, Inc.'";
-										if (0x058e == ManufacturerID)
-											ssOutput << "'Meta Platforms Technologies, LLC'";
-										if (0x02E1 == ManufacturerID)
-											ssOutput << "'Victron Energy BV'";
-									}
-									std::vector<uint8_t> EncryptionKey;
-									for (size_t i = 0; i < Device->second.length(); i += 2)
-									{
-										std::string byteString(Device->second.substr(i, 2));
-										uint8_t byteValue(static_cast<uint8_t>(std::stoi(byteString, nullptr, 16)));
-										EncryptionKey.push_back(byteValue);
-									}
-									if (ManufacturerData[7] == EncryptionKey[0]) // if stored key doesnt start with this data, we need to update stored key
-									{
-										uint8_t DecryptedData[32]{ 0 };
-										if (sizeof(DecryptedData) >= (ManufacturerData.size() - 8)) // simple check to make sure we don't buffer overflow
-										{
-											//[2024-09-04T04:47:30] [CE:A5:D7:7B:CD:81] Name: S/V Sola Batt 1
-											//                                                                 0 1 2 3  4  5 6  7  8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 
-											//[2024-09-03T21:47:30] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 35a2 d9 2d331d1ab2f30574993493ead132be09 'Victron Energy BV'
-											//[2024-09-03T21:47:37] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 3ba2 d9 53fefc2f4ce0fac5905e13b24c6ef6c2 'Victron Energy BV'
-											//[2024-09-03T21:47:37] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 3ba2 d9 53fefc2f4ce0fac5905e13b24c6ef6c2 'Victron Energy BV'										
-											//                                                                          0  1 2  3  4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9     
-											//[2024-09-04T16:56:06] [D3:D1:90:54:EB:F0] Name: S/V Sola Orion XS
-											//[2024-09-04T09:56:06] [D3:D1:90:54:EB:F0] ManufacturerData: 02e1:1000f0a3 0f 526d 4a 75a80473b5ec702716a85f2db193 'Victron Energy BV'
-											// https://community.victronenergy.com/questions/187303/victron-bluetooth-advertising-protocol.html
-											//Byte [0] is the Manufacturer Data Record type and is always 0x10.
-											//Byte [1] and [2] are the model id. In my case the 0x02 0x57 means I have the MPPT 100/50 (I forget where I found this info but it's always 2 bytes and it's not really needed for decryption)
-											//Byte [3] is the "read out type" which was always 0xA0 in my case but i didn't use this byte at all
-											//
-											//The first 4 bytes aren't mentioned in the provided documentation so it was difficult to figure out where the "extra data" started. Now we get into the bytes documented:
-											//Byte [4] is the record type. In my case it was always 0x01 because I have a "Solar Charger"
-											//Byte [5] and [6] are the Nonce/Data Counter used for decryption (more on this later)
-											//Byte [7] should match the first byte of your devices encryption key. In my case this was 0x20.
-											//
-											//The rest of the bytes are the encrypted data of which there are 12 bytes for my Victron device.
-											EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-											if (ctx != 0)
-											{
-												uint8_t InitializationVector[16]{ ManufacturerData[5], ManufacturerData[6], 0 }; // The first two bytes are assigned, the rest of the 16 are padded with zero
-
-												if (1 == EVP_DecryptInit_ex(ctx, EVP_aes_128_ctr(), NULL, EncryptionKey.data(), InitializationVector))
-												{
-													int len(0);
-													if (1 == EVP_DecryptUpdate(ctx, DecryptedData, &len, ManufacturerData.data() + 8, ManufacturerData.size() - 8))
-													{
-														if (1 == EVP_DecryptFinal_ex(ctx, DecryptedData + len, &len))
-														{
-															// We have decrypted data!
-															ManufacturerData[5] = ManufacturerData[6] = ManufacturerData[7] = 0; // I'm writing a zero here to remind myself I've decoded the data already
-															for (auto index = 0; index < ManufacturerData.size() - 8; index++) // copy the decoded data over the original data
-																ManufacturerData[index + 8] = DecryptedData[index];
-															std::ostringstream ssLogEntry;
-															ssLogEntry << timeToISO8601(TimeNow) << "\t";
-															for (auto& a : ManufacturerData)
-																ssLogEntry << std::setfill('0') << std::hex << std::setw(2) << int(a);
-															std::queue<std::string> foo;
-															auto ret = VictronVirtualLog.insert(std::pair<bdaddr_t, std::queue<std::string>>(dbusBTAddress, foo)); // Either get the existing record or insert a new one
-															ret.first->second.push(ssLogEntry.str());	// puts the measurement in the queue to be written to the log file
-															//UpdateMRTGData(localBTAddress, localTemp);	// puts the measurement in the fake MRTG data structure
-															//GoveeLastDownload.insert(std::pair<bdaddr_t, time_t>(localBTAddress, 0));	// Makes sure the Bluetooth Address is in the list to get downloaded historical data
-															if (ManufacturerData[4] == 0x01) // Solar Charger
-															{
-																if (ConsoleVerbosity > 0)
-																{
-																	VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-																	ssOutput << std::dec;
-																	ssOutput << " (Solar)";
-																	ssOutput << " battery_current:" << float(ExtraDataPtr->SolarCharger.battery_current) * 0.01 << "V";
-																	ssOutput << " battery_voltage:" << float(ExtraDataPtr->SolarCharger.battery_voltage) * 0.01 << "V";
-																	ssOutput << " load_current:" << float(ExtraDataPtr->SolarCharger.load_current) * 0.01 << "V";
-																}
-															}
-															else if (ManufacturerData[4] == 0x04) // DC/DC converter
-															{
-																if (ConsoleVerbosity > 0)
-																{
-																	VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-																	ssOutput << std::dec;
-																	ssOutput << " (DC/DC)";
-																	ssOutput << " input_voltage:" << float(ExtraDataPtr->DCDCConverter.input_voltage) * 0.01 + 2.60 << "V";
-																	ssOutput << " output_voltage:" << float(ExtraDataPtr->DCDCConverter.output_voltage) * 0.01 + 2.60 << "V";
-																}
-															}
-															else if (ManufacturerData[4] == 0x05) // SmartLithium
-															{
-																VictronSmartLithium local;
-																if (local.ReadManufacturerData(ManufacturerData, TimeNow))
-																{
-																	UpdateMRTGData(dbusBTAddress, local, VictronSmartLithiumMRTGLogs);	// puts the measurement in the fake MRTG data structure
-																	if (ConsoleVerbosity > 0)
-																		ssOutput << local.WriteConsole();
-																}
-																else if (ConsoleVerbosity > 0)
-																{
-																	VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-																	ssOutput << std::dec;
-																	ssOutput << " (SmartLithium)";
-																	ssOutput << " cell_1:" << float(ExtraDataPtr->SmartLithium.cell_1) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_2:" << float(ExtraDataPtr->SmartLithium.cell_2) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_3:" << float(ExtraDataPtr->SmartLithium.cell_3) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_4:" << float(ExtraDataPtr->SmartLithium.cell_4) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_5:" << float(ExtraDataPtr->SmartLithium.cell_5) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_6:" << float(ExtraDataPtr->SmartLithium.cell_6) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_7:" << float(ExtraDataPtr->SmartLithium.cell_7) * 0.01 + 2.60 << "V";
-																	ssOutput << " cell_8:" << float(ExtraDataPtr->SmartLithium.cell_8) * 0.01 + 2.60 << "V";
-																	ssOutput << " battery_voltage:" << float(ExtraDataPtr->SmartLithium.battery_voltage) * 0.01 << "V";
-																	ssOutput << " battery_temperature:" << ExtraDataPtr->SmartLithium.battery_temperature - 40 << "\u00B0" << "C";
-																}
-															}
-															else if (ManufacturerData[4] == 0x0F) // OrionXS
-															{
-																VictronOrionXS local;
-																if (local.ReadManufacturerData(ManufacturerData, TimeNow))
-																{
-																	UpdateMRTGData(dbusBTAddress, local, VictronOrionXSMRTGLogs);	// puts the measurement in the fake MRTG data structure
-																	if (ConsoleVerbosity > 0)
-																		ssOutput << local.WriteConsole();
-																}
-																else if (ConsoleVerbosity > 0)
-																{
-																	VictronExtraData_t* ExtraDataPtr = (VictronExtraData_t*)(ManufacturerData.data() + 8);
-																	ssOutput << std::dec;
-																	ssOutput << " (Orion XS)";
-																	ssOutput << " output_voltage:" << float(ExtraDataPtr->OrionXS.output_voltage) * 0.01 << "V";
-																	ssOutput << " output_current:" << float(ExtraDataPtr->OrionXS.output_current) * 0.1 << "A";
-																	ssOutput << " input_voltage:" << float(ExtraDataPtr->OrionXS.input_voltage) * 0.01 << "V";
-																	ssOutput << " input_current:" << float(ExtraDataPtr->OrionXS.input_current) * 0.1 << "A";
-																}
-															}
-														}
-													}
-												}
-												EVP_CIPHER_CTX_free(ctx);
-											}
-										}
-										ssOutput << std::endl;
-									}
-								}
-							}
-						}
-					}
-				} while (dbus_message_iter_next(&array3_iter));
+				memcpy(Counters[Blocks], Counters[Blocks - 1], sizeof(Counters[Blocks]));
+				for (auto index = int(sizeof(Counters[Blocks])) - 1; (index >= 0) && (0 == ++Counters[Blocks][index]); index--); // the whole block is a big endian counter, the same as OpenSSL
+				RoundKeys[Blocks++] = Jobs[job].Cipher->RoundKeys;
 			}
 		}
-		else if (!Key.compare("Name"))
+		EncryptBlocks(RoundKeys, Counters[0], KeyStream[0], Blocks);
+		const uint8_t* Stream(KeyStream[0]);
+		for (auto job = first; job < Last; job++)
 		{
-			if ((DBUS_TYPE_STRING == dbus_message_Type) || (DBUS_TYPE_OBJECT_PATH == dbus_message_Type))
+			// XOR a word at a time, the payloads are at most a couple of blocks long
+			auto index = 0;
+			for (; index + int(sizeof(uint64_t)) <= Jobs[job].Length; index += sizeof(uint64_t))
 			{
-				dbus_message_iter_get_basic(&variant_iter, &value);
-				std::string Name(value.str);
-				auto ElementInserted = VictronNames.insert(std::make_pair(dbusBTAddress, Name)); // Either get the existing record or insert a new one
-				if (!ElementInserted.second) // true if inserted, false if already exists
-					ElementInserted.first->second = Name;
-				ssOutput << "[" << timeToISO8601(TimeNow, true) << "] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << Name << std::endl;
+				uint64_t Word, Key;
+				memcpy(&Word, Jobs[job].In + index, sizeof(Word));
+				memcpy(&Key, Stream + index, sizeof(Key));
+				Word ^= Key;
+				memcpy(Jobs[job].Out + index, &Word, sizeof(Word));
 			}
+			for (; index < Jobs[job].Length; index++)
+				Jobs[job].Out[index] = Jobs[job].In[index] ^ Stream[index];
+			Stream += 16 * ((Jobs[job].Length + 15) / 16);
+			Jobs[job].bDecrypted = true;
 		}
-		else if (!Key.compare("UUIDs"))
+	}
+}
+void VictronDecryptBatch(VictronDecryptJob* Jobs, const size_t Count)
+{
+	if (AES128EncryptBlocks != nullptr)
+		VictronDecryptBatchFast(AES128EncryptBlocks, Jobs, Count);
+	else
+		for (size_t job = 0; job < Count; job++)
+			Jobs[job].bDecrypted = VictronDecrypt(*Jobs[job].Cipher, Jobs[job].InitializationVector, Jobs[job].In, Jobs[job].Out, Jobs[job].Length);
+}
+uint16_t VictronNonce(const uint8_t* InitializationVector)
+{
+	return(uint16_t(InitializationVector[0] | (InitializationVector[1] << 8))); // the nonce is sent least significant byte first
+}
+// Each device gets an equal share of the budget
+size_t VictronKeyStreamLimit(void)
+{
+	return(std::max(size_t(1), VictronKeyStreamBudget / sizeof(VictronKeyStream_t) / std::max(size_t(1), VictronEncryptionKeys->size())));
+}
+// Returns nullptr if the cipher failed, nothing is cached for the nonce then
+const VictronKeyStream_t* VictronKeyStreamAdd(VictronCipher& Cipher, const uint16_t Nonce)
+{
+	const size_t Limit(VictronKeyStreamLimit());
+	while (Cipher.KeyStreams.size() >= Limit)
+	{
+		Cipher.KeyStreams.erase(Cipher.KeyStreamOrder.front());
+		Cipher.KeyStreamOrder.pop_front();
+	}
+	// In CTR mode decrypting zeros gives the keystream
+	const uint8_t Zeros[sizeof(VictronKeyStream_t)]{ 0 };
+	const uint8_t InitializationVector[16]{ uint8_t(Nonce & 0xff), uint8_t(Nonce >> 8), 0 };
+	VictronKeyStream_t KeyStream;
+	if (!VictronDecrypt(Cipher, InitializationVector, Zeros, KeyStream.data(), int(KeyStream.size())))
+		return(nullptr);
+	Cipher.KeyStreamOrder.push_back(Nonce);
+	return(&(Cipher.KeyStreams[Nonce] = KeyStream));
+}
+bool VictronDecryptCached(VictronCipher& Cipher, const uint8_t* InitializationVector, const uint8_t* In, uint8_t* Out, const int Length)
+{
+	if ((VictronKeyStreamBudget == 0) || (Length > int(sizeof(VictronKeyStream_t))))
+		return(VictronDecrypt(Cipher, InitializationVector, In, Out, Length));
+	const uint16_t Nonce(VictronNonce(InitializationVector));
+	auto Cached = Cipher.KeyStreams.find(Nonce);
+	if (Cached != Cipher.KeyStreams.end())
+		VictronKeyStreamHits++;
+	else
+		VictronKeyStreamMisses++;
+	const VictronKeyStream_t* KeyStream((Cached != Cipher.KeyStreams.end()) ? &Cached->second : VictronKeyStreamAdd(Cipher, Nonce));
+	if (KeyStream == nullptr)
+		return(false);
+	for (auto index = 0; index < Length; index++)
+		Out[index] = In[index] ^ (*KeyStream)[index];
+	Cipher.LastNonce = Nonce;
+	return(true);
+}
+// Known answer test of the fast path against OpenSSL, over every payload length up to two blocks and a counter that carries.
+// The fast path is only switched on if every answer matches. The benchmark build also times both paths.
+void VictronAESSelfTest(void)
+{
+	AES128EncryptBlock_t Candidate(nullptr);
+	AES128EncryptBlocks_t CandidateBlocks(nullptr);
+	std::string CandidateName;
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax(0), ebx(0), ecx(0), edx(0);
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES))
+	{
+		Candidate = aes128_encrypt_block_aesni;
+		CandidateBlocks = aes128_encrypt_blocks_aesni;
+		CandidateName = "AES-NI";
+	}
+#elif defined(__aarch64__)
+	if (getauxval(AT_HWCAP) & HWCAP_AES)
+	{
+		Candidate = aes128_encrypt_block_armv8;
+		CandidateBlocks = aes128_encrypt_blocks_armv8;
+		CandidateName = "ARMv8 Crypto Extensions";
+	}
+#endif
+	if (Candidate == nullptr)
+		return;
+	bool bMatch(true);
+	for (auto test = 0; bMatch && (test < 4); test++)
+	{
+		VictronEncryptionKey_t TestKey;
+		for (auto index = 0; index < int(TestKey.size()); index++)
+			TestKey[index] = uint8_t(test * 0x3b + index * 0x11);
+		VictronCipher Cipher;
+		if (!VictronCipherInit(Cipher, TestKey))
+			return;
+		uint8_t InitializationVector[16]{ uint8_t(test * 0x45), uint8_t(0xff - test), 0 };
+		if (test == 3)
+			memset(InitializationVector + 8, 0xff, 8); // carries out of the low 64 bits on the second block
+		uint8_t Plain[32], Expected[32], Actual[32];
+		for (auto index = 0; index < int(sizeof(Plain)); index++)
+			Plain[index] = uint8_t(index * 7 + test);
+		for (auto Length = 1; bMatch && (Length <= int(sizeof(Plain))); Length++)
 		{
-			DBusMessageIter array3_iter;
-			dbus_message_iter_recurse(&variant_iter, &array3_iter);
-			do
-			{
-				if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&array3_iter))
-				{
-					dbus_message_iter_get_basic(&array3_iter, &value);
-					ssOutput << "[                   ] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << value.str << std::endl;
-				}
-			} while (dbus_message_iter_next(&array3_iter));
+			memset(Expected, 0, sizeof(Expected));
+			memset(Actual, 0, sizeof(Actual));
+			bMatch = VictronDecryptEVP(Cipher, InitializationVector, Plain, Expected, Length);
+			VictronDecryptFast(Candidate, Cipher, InitializationVector, Plain, Actual, Length);
+			bMatch = bMatch && (0 == memcmp(Expected, Actual, sizeof(Actual)));
 		}
-		else if (!Key.compare("Connected"))
+#ifdef VICTRON_BENCHMARK
+		if (bMatch && (test == 0))
 		{
-			if (DBUS_TYPE_BOOLEAN == dbus_message_Type)
+			// Microbenchmark, one typical 16 byte payload through each path
+			const int Iterations(100000);
+			auto Start(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
 			{
-				dbus_message_iter_get_basic(&variant_iter, &value);
-				ssOutput << "[                   ] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << std::boolalpha << bool(value.bool_val) << std::endl;
+				InitializationVector[0] = uint8_t(iteration);
+				VictronDecryptEVP(Cipher, InitializationVector, Plain, Actual, 16);
 			}
-		}
-		else if (!Key.compare("ServicesResolved"))
-		{
-			if (DBUS_TYPE_BOOLEAN == dbus_message_Type)
+			auto Middle(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
 			{
-				dbus_message_iter_get_basic(&variant_iter, &value);
-				ssOutput << "[                   ] [" << ba2string(dbusBTAddress) << "] " << Key << ": " << std::boolalpha << bool(value.bool_val) << std::endl;
+				InitializationVector[0] = uint8_t(iteration);
+				VictronDecryptFast(Candidate, Cipher, InitializationVector, Plain, Actual, 16);
 			}
+			auto Finish(std::chrono::steady_clock::now());
+			std::cout << "[                   ] AES-128-CTR OpenSSL EVP: " << std::chrono::duration_cast<std::chrono::nanoseconds>(Middle - Start).count() / Iterations << " ns/packet, "
+				<< CandidateName << ": " << std::chrono::duration_cast<std::chrono::nanoseconds>(Finish - Middle).count() / Iterations << " ns/packet" << std::endl;
 		}
-		else
-			ssOutput << "[                   ] [" << ba2string(dbusBTAddress) << "] " << Key << std::endl;
-	} while (dbus_message_iter_next(&array_iter));
-	return(ssOutput.str());
-}
-void bluez_dbus_FindExistingDevices(DBusConnection* dbus_conn)
-{
-	// This function is mainly useful after a rapid restart of the program. BlueZ keeps around information on devices for three minutes after scanning has been stopped.
-	std::ostringstream ssOutput;
-	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects");
-	if (dbus_msg)
+#endif // VICTRON_BENCHMARK
+		EVP_CIPHER_CTX_free(Cipher.ctx);
+	}
+	if (bMatch)
 	{
-		// Initialize D-Bus error
-		DBusError dbus_error;
-		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_USE_DEFAULT, &dbus_error);
-		dbus_message_unref(dbus_msg);
-		if (dbus_reply)
+		// A batch that mixes keys and lengths and doesn't fill the last group of lanes must give the same answers as OpenSSL one at a time
+		const size_t TestCiphers(3);
+		VictronCipher Ciphers[TestCiphers];
+		for (size_t cipher = 0; cipher < TestCiphers; cipher++)
+		{
+			VictronEncryptionKey_t TestKey;
+			for (auto index = 0; index < int(TestKey.size()); index++)
+				TestKey[index] = uint8_t(cipher * 0x5d + index * 0x07);
+			if (!VictronCipherInit(Ciphers[cipher], TestKey))
+				bMatch = false;
+		}
+		const size_t TestJobs(VictronDecryptBatchMax + 3);
+		uint8_t Plain[VictronManufacturerDataMax];
+		for (auto index = 0; index < int(sizeof(Plain)); index++)
+			Plain[index] = uint8_t(index * 13);
+		uint8_t Expected[TestJobs][VictronManufacturerDataMax]{ { 0 } };
+		uint8_t Actual[TestJobs][VictronManufacturerDataMax]{ { 0 } };
+		VictronDecryptJob Jobs[TestJobs];
+		for (size_t job = 0; bMatch && (job < TestJobs); job++)
+		{
+			Jobs[job] = VictronDecryptJob({ &Ciphers[job % TestCiphers], { uint8_t(job), uint8_t(job * 3), 0 }, Plain, Actual[job], int(1 + (job * 7) % VictronManufacturerDataMax), false });
+			bMatch = VictronDecryptEVP(*Jobs[job].Cipher, Jobs[job].InitializationVector, Plain, Expected[job], Jobs[job].Length);
+		}
+		if (bMatch)
+		{
+			VictronDecryptBatchFast(CandidateBlocks, Jobs, TestJobs);
+			bMatch = (0 == memcmp(Expected, Actual, sizeof(Actual)));
+		}
+#ifdef VICTRON_BENCHMARK
+		if (bMatch)
+		{
+			// Microbenchmark, batches of typical 16 byte payloads against the same payloads one at a time
+			const int Iterations(100000 / int(VictronDecryptBatchMax));
+			for (size_t job = 0; job < VictronDecryptBatchMax; job++)
+				Jobs[job].Length = 16;
+			auto Start(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
+				for (size_t job = 0; job < VictronDecryptBatchMax; job++)
+					VictronDecryptFast(Candidate, *Jobs[job].Cipher, Jobs[job].InitializationVector, Plain, Actual[job], 16);
+			auto Middle(std::chrono::steady_clock::now());
+			for (auto iteration = 0; iteration < Iterations; iteration++)
+				VictronDecryptBatchFast(CandidateBlocks, Jobs, VictronDecryptBatchMax);
+			auto Finish(std::chrono::steady_clock::now());
+			const int Packets(Iterations * int(VictronDecryptBatchMax));
+			std::cout << "[                   ] AES-128-CTR " << CandidateName << " one at a time: " << std::chrono::duration_cast<std::chrono::nanoseconds>(Middle - Start).count() / Packets << " ns/packet, "
+				<< VictronDecryptBatchMax << " lanes: " << std::chrono::duration_cast<std::chrono::nanoseconds>(Finish - Middle).count() / Packets << " ns/packet" << std::endl;
+		}
+#endif // VICTRON_BENCHMARK
+		for (auto& Cipher : Ciphers)
+			EVP_CIPHER_CTX_free(Cipher.ctx);
+	}
+	if (bMatch)
+	{
+		AES128EncryptBlocks = CandidateBlocks;
+		AES128EncryptBlock = Candidate;
+		AES128EncryptBlockName = CandidateName;
+	}
+	else if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] " << CandidateName << " does not match OpenSSL, using OpenSSL EVP" << std::endl;
+	else
+		std::cerr << CandidateName << " does not match OpenSSL, using OpenSSL EVP" << std::endl;
+}
+bdaddr_map<std::unique_ptr<VictronCipher>> VictronCiphers; // held by pointer because a batch of decrypt jobs keeps pointers to ciphers while more are added
+VictronCipher* GetVictronCipher(const bdaddr_t& TheAddress, const VictronEncryptionKey_t& TheKey)
+{
+	auto Cipher = VictronCiphers.find(TheAddress);
+	if (Cipher != VictronCiphers.end())
+		return(Cipher->second.get());
+	auto NewCipher(std::make_unique<VictronCipher>());
+	if (!VictronCipherInit(*NewCipher, TheKey))
+		return(nullptr);
+	return(VictronCiphers.insert(std::make_pair(TheAddress, std::move(NewCipher))).first->second.get());
+}
+// Called when the processing thread is idle. Devices step their nonce forward, so work out the next few keystreams ahead of time.
+void VictronKeyStreamLookahead(void)
+{
+	if (VictronKeyStreamBudget > 0)
+	{
+		const size_t Lookahead(std::min(size_t(16), std::max(size_t(1), VictronKeyStreamLimit() / 2))); // leave room for the ones already seen
+		for (auto& [TheAddress, Cipher] : VictronCiphers)
+			if (!Cipher->KeyStreams.empty())
+				for (size_t index = 1; index <= Lookahead; index++)
+					if (Cipher->KeyStreams.find(uint16_t(Cipher->LastNonce + index)) == Cipher->KeyStreams.end())
+						if (VictronKeyStreamAdd(*Cipher, uint16_t(Cipher->LastNonce + index)) == nullptr)
+							break; // the cipher failed, the frame itself will report it
+	}
+}
+// Called after the key file is reloaded. Ciphers for devices whose key changed or was removed are dropped, along with their keystream cache,
+// and GetVictronCipher builds new ones the next time the device is heard.
+void RefreshVictronCiphers(void)
+{
+	std::vector<bdaddr_t> Stale;
+	for (auto& [TheAddress, Cipher] : VictronCiphers)
+	{
+		auto Device = VictronEncryptionKeys->find(TheAddress);
+		if ((Device == VictronEncryptionKeys->end()) || !(Device->second == Cipher->Key))
 		{
-			if (dbus_message_get_type(dbus_reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
+			EVP_CIPHER_CTX_free(Cipher->ctx);
+			Stale.push_back(TheAddress);
+		}
+	}
+	for (auto& TheAddress : Stale)
+		VictronCiphers.erase(TheAddress);
+}
+void FreeVictronCiphers(void)
+{
+	for (auto& [TheAddress, Cipher] : VictronCiphers)
+		EVP_CIPHER_CTX_free(Cipher->ctx);
+	VictronCiphers.clear();
+}
+// Decrypts the frames taken off the queue together. Payloads[index] is left nullptr for any frame ProcessVictronFrame should decrypt itself,
+// which includes every frame when the keystream cache is on since that already makes decrypting a single XOR.
+// Frames inside --interval are marked as dropped here, before any of them are decrypted.
+void VictronDecryptFrames(VictronRawFrame* Frames, const size_t Count, uint8_t (*Plain)[VictronManufacturerDataMax], const uint8_t** Payloads)
+{
+	VictronDecryptJob Jobs[VictronDecryptBatchMax];
+	size_t JobFrame[VictronDecryptBatchMax];
+	size_t JobCount(0);
+	for (size_t index = 0; index < Count; index++)
+	{
+		Payloads[index] = nullptr;
+		Frames[index].bDropped = VictronWithinInterval(Frames[index]);
+		if (!Frames[index].bDropped && (VictronKeyStreamBudget == 0) && (AES128EncryptBlocks != nullptr) && (JobCount < VictronDecryptBatchMax) && (Frames[index].Length > 8))
+		{
+			auto Device = VictronEncryptionKeys->find(Frames[index].Address);
+			if ((Device != VictronEncryptionKeys->end()) && (Frames[index].ManufacturerData[7] == Device->second[0]))
 			{
-				const std::string dbus_reply_Signature(dbus_message_get_signature(dbus_reply));
-				int indent(16);
-				if (!dbus_reply_Signature.compare("a{oa{sa{sv}}}"))
+				VictronCipher* Cipher = GetVictronCipher(Frames[index].Address, Device->second);
+				if (Cipher != nullptr)
 				{
-					DBusMessageIter root_iter;
-					dbus_message_iter_init(dbus_reply, &root_iter);
-					do {
-						DBusMessageIter array1_iter;
-						dbus_message_iter_recurse(&root_iter, &array1_iter);
-						do {
-							indent += 4;
-							DBusMessageIter dict1_iter;
-							dbus_message_iter_recurse(&array1_iter, &dict1_iter);
+					Jobs[JobCount] = VictronDecryptJob({ Cipher, { Frames[index].ManufacturerData[5], Frames[index].ManufacturerData[6], 0 }, Frames[index].ManufacturerData + 8, Plain[index], Frames[index].Length - 8, false });
+					JobFrame[JobCount++] = index;
+				}
+			}
+		}
+	}
+	VictronDecryptBatch(Jobs, JobCount);
+	for (size_t job = 0; job < JobCount; job++)
+		if (Jobs[job].bDecrypted)
+			Payloads[JobFrame[job]] = Plain[JobFrame[job]];
+}
+// Decrypts and decodes a frame queued by the receive thread, queues it for the log file and updates the graph data. The frame is decrypted in place.
+// Returns true if the record was added to the graph data. The text for the console is only put together when Console is given,
+// otherwise nothing here allocates once a device has been seen.
+bool ProcessVictronFrame(VictronRawFrame& TheFrame, const uint8_t* DecryptedPayload = nullptr, std::string* Console = nullptr)
+{
+	bool rval(false);
+	if (TheFrame.bDropped || VictronWithinInterval(TheFrame)) // checked again because an earlier frame from the same batch may have been stored since
+		return(rval);
+	auto Device = VictronEncryptionKeys->find(TheFrame.Address);
+	if ((Device != VictronEncryptionKeys->end()) && (TheFrame.Length > 8))
+	{
+		if (Console != nullptr)
+		{
+			std::ostringstream ssOutput;
+			ssOutput << "[" << timeToISO8601(TheFrame.Time, true) << "] [" << ba2string_cached(TheFrame.Address) << "] ManufacturerData: " << std::setfill('0') << std::hex << std::setw(4) << TheFrame.ManufacturerID << ":";
+			ssOutput << hex_string(TheFrame.ManufacturerData, TheFrame.Length);
+			if (ConsoleVerbosity > 4)
+			{
+				// https://bitbucket.org/bluetooth-SIG/public/src/main/assigned_numbers/company_identifiers/company_identifiers.yaml
+				ssOutput << " ";
+				if (0x0001 == TheFrame.ManufacturerID)
+					ssOutput << "'Nokia Mobile Phones'";
+				if (0x0006 == TheFrame.ManufacturerID)
+					ssOutput << "'Microsoft'";
+				if (0x004c == TheFrame.ManufacturerID)
+					ssOutput << "'Apple, Inc.'";
+				if (0x058e == TheFrame.ManufacturerID)
+					ssOutput << "'Meta Platforms Technologies, LLC'";
+				if (0x02E1 == TheFrame.ManufacturerID)
+					ssOutput << "'Victron Energy BV'";
+			}
+			*Console = ssOutput.str();
+		}
+		uint8_t* ManufacturerData(TheFrame.ManufacturerData);
+		const size_t ManufacturerDataLength(TheFrame.Length);
+		const time_t TimeNow(TheFrame.Time);
+		const bdaddr_t dbusBTAddress(TheFrame.Address);
+		const VictronEncryptionKey_t& EncryptionKey(Device->second);
+		if (ManufacturerData[7] == EncryptionKey[0]) // if stored key doesnt start with this data, we need to update stored key
+		{
+			uint8_t DecryptedData[32]{ 0 };
+			if ((sizeof(DecryptedData) >= (ManufacturerDataLength - 8)) && (ManufacturerDataLength <= VictronManufacturerDataLogged)) // simple check to make sure we don't buffer overflow
+			{
+				//[2024-09-04T04:47:30] [CE:A5:D7:7B:CD:81] Name: S/V Sola Batt 1
+				//                                                                 0 1 2 3  4  5 6  7  8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 
+				//[2024-09-03T21:47:30] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 35a2 d9 2d331d1ab2f30574993493ead132be09 'Victron Energy BV'
+				//[2024-09-03T21:47:37] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 3ba2 d9 53fefc2f4ce0fac5905e13b24c6ef6c2 'Victron Energy BV'
+				//[2024-09-03T21:47:37] [CE:A5:D7:7B:CD:81] ManufacturerData: 02e1:1000eba0 05 3ba2 d9 53fefc2f4ce0fac5905e13b24c6ef6c2 'Victron Energy BV'										
+				//                                                                          0  1 2  3  4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9     
+				//[2024-09-04T16:56:06] [D3:D1:90:54:EB:F0] Name: S/V Sola Orion XS
+				//[2024-09-04T09:56:06] [D3:D1:90:54:EB:F0] ManufacturerData: 02e1:1000f0a3 0f 526d 4a 75a80473b5ec702716a85f2db193 'Victron Energy BV'
+				// https://community.victronenergy.com/questions/187303/victron-bluetooth-advertising-protocol.html
+				//Byte [0] is the Manufacturer Data Record type and is always 0x10.
+				//Byte [1] and [2] are the model id. In my case the 0x02 0x57 means I have the MPPT 100/50 (I forget where I found this info but it's always 2 bytes and it's not really needed for decryption)
+				//Byte [3] is the "read out type" which was always 0xA0 in my case but i didn't use this byte at all
+				//
+				//The first 4 bytes aren't mentioned in the provided documentation so it was difficult to figure out where the "extra data" started. Now we get into the bytes documented:
+				//Byte [4] is the record type. In my case it was always 0x01 because I have a "Solar Charger"
+				//Byte [5] and [6] are the Nonce/Data Counter used for decryption (more on this later)
+				//Byte [7] should match the first byte of your devices encryption key. In my case this was 0x20.
+				//
+				//The rest of the bytes are the encrypted data of which there are 12 bytes for my Victron device.
+				bool bDecrypted(DecryptedPayload != nullptr); // already done along with the rest of its batch
+				if (bDecrypted)
+					memcpy(DecryptedData, DecryptedPayload, ManufacturerDataLength - 8);
+				else
+				{
+					VictronCipher* Cipher = GetVictronCipher(dbusBTAddress, EncryptionKey);
+					uint8_t InitializationVector[16]{ ManufacturerData[5], ManufacturerData[6], 0 }; // The first two bytes are assigned, the rest of the 16 are padded with zero
+					bDecrypted = (Cipher != nullptr) && VictronDecryptCached(*Cipher, InitializationVector, ManufacturerData + 8, DecryptedData, int(ManufacturerDataLength - 8));
+				}
+				if (bDecrypted)
+				{
+					// We have decrypted data!
+					ManufacturerData[5] = ManufacturerData[6] = ManufacturerData[7] = 0; // I'm writing a zero here to remind myself I've decoded the data already
+					memcpy(ManufacturerData + 8, DecryptedData, ManufacturerDataLength - 8); // copy the decoded data over the original data
+					VictronLogRecord LogEntry({ TimeNow, ManufacturerData[4], uint8_t(ManufacturerDataLength), { 0 } });
+					memcpy(LogEntry.ManufacturerData, ManufacturerData, LogEntry.Length);
+					VictronVirtualLog[dbusBTAddress].push_back(LogEntry);	// puts the measurement in the queue to be written to the log file
+					//UpdateMRTGData(localBTAddress, localTemp);	// puts the measurement in the fake MRTG data structure
+					//GoveeLastDownload.insert(std::pair<bdaddr_t, time_t>(localBTAddress, 0));	// Makes sure the Bluetooth Address is in the list to get downloaded historical data
+					std::string ssRecord;
+					rval = StoreVictronRecord(dbusBTAddress, ManufacturerData, ManufacturerDataLength, TimeNow, (Console != nullptr) ? &ssRecord : nullptr);
+					if (rval && (VictronMinimumInterval > 0))
+						VictronLastStored[dbusBTAddress] = TimeNow; // only once it's stored, a frame with the wrong key or that didn't decode doesn't hold back the next one
+					if (Console != nullptr)
+						Console->append(ssRecord);
+				}
+			}
+		}
+		if (Console != nullptr)
+			Console->append("\n");
+	}
+	return(rval);
+}
+/////////////////////////////////////////////////////////////////////////////
+// BlueZ object paths look like /org/bluez/hci0/dev_XX_XX_XX_XX_XX_XX and the same few paths arrive on every signal.
+// Each path is parsed once and remembered along with whether we have a key for the device, so the common case is a single hash lookup.
+struct BlueZObjectPath {
+	bdaddr_t Address;
+	bool Known; // true if the address is in BlueZEncryptionKeys
+	BlueZAdapterStats* Stats; // reception counts for the adapter in the path
+};
+std::shared_ptr<const VictronEncryptionKeyTable_t> BlueZEncryptionKeys(std::make_shared<const VictronEncryptionKeyTable_t>()); // the receive thread's reference to the published keys
+size_t BlueZEncryptionKeysGeneration(0);
+const size_t BlueZObjectPathCacheMax(4096); // devices with random addresses create new paths forever, so start over when the cache gets this big
+std::deque<std::string> BlueZObjectPathStrings; // owns the text the cache keys point at, deque never moves existing elements
+std::unordered_map<std::string_view, BlueZObjectPath> BlueZObjectPathCache;
+// Parses the address out of "dev_XX_XX_XX_XX_XX_XX" anywhere in the path, returns false if there isn't one.
+bool bluez_path2ba(const char* ObjectPath, bdaddr_t& TheBlueToothAddress)
+{
+	bool rval(false);
+	const char* dev = (ObjectPath == nullptr) ? nullptr : strstr(ObjectPath, "/dev_");
+	if (dev != nullptr)
+	{
+		dev += 5;
+		bdaddr_t localAddress({ 0 });
+		rval = true;
+		for (auto index = 5; rval && (index >= 0); index--)
+		{
+			const int high(hexvalue(dev[0]));
+			const int low((high < 0) ? -1 : hexvalue(dev[1]));
+			if ((low < 0) || ((index > 0) && (dev[2] != '_')))
+				rval = false;
+			else
+				localAddress.b[index] = uint8_t((high << 4) | low);
+			dev += 3;
+		}
+		if (rval)
+			TheBlueToothAddress = localAddress;
+	}
+	return(rval);
+}
+const BlueZObjectPath& bluez_path_lookup(const char* ObjectPath)
+{
+	static const BlueZObjectPath NotADevice({ { 0 }, false, nullptr });
+	if (ObjectPath == nullptr)
+		return(NotADevice);
+	auto search = BlueZObjectPathCache.find(std::string_view(ObjectPath));
+	if (search != BlueZObjectPathCache.end())
+		return(search->second);
+	if (BlueZObjectPathCache.size() >= BlueZObjectPathCacheMax)
+	{
+		BlueZObjectPathCache.clear();
+		BlueZObjectPathStrings.clear();
+	}
+	BlueZObjectPath NewEntry({ { 0 }, false, nullptr });
+	if (bluez_path2ba(ObjectPath, NewEntry.Address))
+	{
+		NewEntry.Known = BlueZEncryptionKeys->find(NewEntry.Address) != BlueZEncryptionKeys->end();
+		if (NewEntry.Known)
+			NewEntry.Stats = GetAdapterStats(std::string(ObjectPath, strstr(ObjectPath, "/dev_")));
+	}
+	BlueZObjectPathStrings.emplace_back(ObjectPath);
+	return(BlueZObjectPathCache.insert(std::make_pair(std::string_view(BlueZObjectPathStrings.back()), NewEntry)).first->second);
+}
+// Must be called whenever BlueZEncryptionKeys changes, since the cache remembers which devices are known.
+void bluez_path_cache_clear(void)
+{
+	BlueZObjectPathCache.clear();
+	BlueZObjectPathStrings.clear();
+}
+// Picks up the key table if the processing thread has published a new one, returns true if it changed.
+bool bluez_refresh_keys(void)
+{
+	bool rval(false);
+	const size_t Generation(VictronEncryptionKeysGeneration);
+	if (Generation != BlueZEncryptionKeysGeneration)
+	{
+		BlueZEncryptionKeys = std::atomic_load(&VictronEncryptionKeysPublished);
+		BlueZEncryptionKeysGeneration = Generation;
+		bluez_path_cache_clear();
+		rval = true;
+	}
+	return(rval);
+}
+// The org.bluez.Device1 objects BlueZ currently holds for devices we have keys for.
+// Seeded from the GetManagedObjects reply when we connect and kept current from InterfacesAdded and InterfacesRemoved,
+// so cleaning up when we disconnect doesn't need another walk of every object BlueZ knows about.
+std::set<std::string> BlueZDevicePaths;
+// With --discover the broad match rules are installed beside the per-device ones, so devices without keys are shown on the console.
+bool bDiscoverMode(false);
+/////////////////////////////////////////////////////////////////////////////
+std::string bluez_dbus_msg_iter(DBusMessageIter& array_iter, const BlueZObjectPath& Device)
+{
+	// Callers only get here for devices in BlueZEncryptionKeys, the object path lookup has already checked.
+	const bdaddr_t& dbusBTAddress(Device.Address);
+	std::ostringstream ssOutput;
+	time_t TimeNow;
+	time(&TimeNow);
+	do
+	{
+		DBusMessageIter dict2_iter;
+		dbus_message_iter_recurse(&array_iter, &dict2_iter);
+		DBusBasicValue value;
+		dbus_message_iter_get_basic(&dict2_iter, &value);
+		const char* Key(value.str); // points into the message, compared with strcmp so nothing is allocated for every property
+		dbus_message_iter_next(&dict2_iter);
+		DBusMessageIter variant_iter;
+		dbus_message_iter_recurse(&dict2_iter, &variant_iter);
+		auto dbus_message_Type = dbus_message_iter_get_arg_type(&variant_iter);
+		if (0 == strcmp(Key, "RSSI"))
+		{
+			if ((DBUS_TYPE_INT16 == dbus_message_Type) && (ConsoleVerbosity > 0))
+			{
+				dbus_message_iter_get_basic(&variant_iter, &value);
+				ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << value.i16 << std::endl;
+			}
+		}
+		else if (0 == strcmp(Key, "ManufacturerData"))
+		{
+			if (DBUS_TYPE_ARRAY == dbus_message_Type)
+			{
+				DBusMessageIter array3_iter;
+				dbus_message_iter_recurse(&variant_iter, &array3_iter);
+				do
+				{
+					if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&array3_iter))
+					{
+						DBusMessageIter dict1_iter;
+						dbus_message_iter_recurse(&array3_iter, &dict1_iter);
+						if (DBUS_TYPE_UINT16 == dbus_message_iter_get_arg_type(&dict1_iter))
+						{
 							DBusBasicValue value;
 							dbus_message_iter_get_basic(&dict1_iter, &value);
-							std::string dict1_object_path(value.str);
+							const uint16_t ManufacturerID(value.u16);
 							dbus_message_iter_next(&dict1_iter);
-							DBusMessageIter array2_iter;
-							dbus_message_iter_recurse(&dict1_iter, &array2_iter);
-							do
+							if ((VictronManufacturerID == ManufacturerID) && (DBUS_TYPE_VARIANT == dbus_message_iter_get_arg_type(&dict1_iter)))
 							{
-								DBusMessageIter dict2_iter;
-								dbus_message_iter_recurse(&array2_iter, &dict2_iter);
-								dbus_message_iter_get_basic(&dict2_iter, &value);
-								std::string dict2_string(value.str);
-								if (!dict2_string.compare("org.bluez.Device1"))
+								DBusMessageIter variant2_iter;
+								dbus_message_iter_recurse(&dict1_iter, &variant2_iter);
+								if ((DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&variant2_iter)) && (DBUS_TYPE_BYTE == dbus_message_iter_get_element_type(&variant2_iter)))
 								{
-									if (ConsoleVerbosity > 1)
-										ssOutput << "[" << getTimeISO8601() << "] " << std::right << std::setw(indent) << "Object Path: " << dict1_object_path << std::endl;
-									dbus_message_iter_next(&dict2_iter);
-									DBusMessageIter array3_iter;
-									dbus_message_iter_recurse(&dict2_iter, &array3_iter);
-									bdaddr_t localBTAddress({ 0 });
-									const std::regex BluetoothAddressRegex("((([[:xdigit:]]{2}_){5}))[[:xdigit:]]{2}");
-									std::smatch AddressMatch;
-									if (std::regex_search(dict1_object_path, AddressMatch, BluetoothAddressRegex))
+									// Read the whole byte array straight out of the message buffer and copy it once into the fixed size frame
+									DBusMessageIter array4_iter;
+									dbus_message_iter_recurse(&variant2_iter, &array4_iter);
+									const uint8_t* ManufacturerData(nullptr);
+									int ManufacturerDataLength(0);
+									dbus_message_iter_get_fixed_array(&array4_iter, &ManufacturerData, &ManufacturerDataLength); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html
+									if ((ManufacturerData != nullptr) && (ManufacturerDataLength > int(VictronManufacturerDataLogged)))
+										VictronOversizeFrames++;
+									else if ((ManufacturerData != nullptr) && (ManufacturerDataLength > 8))
 									{
-										std::string BluetoothAddress(AddressMatch.str());
-										std::replace(BluetoothAddress.begin(), BluetoothAddress.end(), '_', ':');
-										localBTAddress = string2ba(BluetoothAddress);
+										VictronRawFrame TheFrame;
+										TheFrame.Address = dbusBTAddress;
+										TheFrame.Time = TimeNow;
+										TheFrame.ManufacturerID = ManufacturerID;
+										TheFrame.Length = uint8_t(ManufacturerDataLength);
+										memcpy(TheFrame.ManufacturerData, ManufacturerData, ManufacturerDataLength);
+										QueueVictronFrame(TheFrame, Device.Stats); // decrypting and decoding happen on the processing thread
 									}
-									ssOutput << bluez_dbus_msg_iter(array3_iter, localBTAddress);
 								}
-							} while (dbus_message_iter_next(&array2_iter));
-							indent -= 4;
-						} while (dbus_message_iter_next(&array1_iter));
-					} while (dbus_message_iter_next(&root_iter));
+							}
+						}
+					}
+				} while (dbus_message_iter_next(&array3_iter));
+			}
+		}
+		else if (0 == strcmp(Key, "Name"))
+		{
+			if ((DBUS_TYPE_STRING == dbus_message_Type) || (DBUS_TYPE_OBJECT_PATH == dbus_message_Type))
+			{
+				dbus_message_iter_get_basic(&variant_iter, &value);
+				std::lock_guard<std::mutex> NamesLock(VictronNamesMutex);
+				auto ElementInserted = VictronNames.find(dbusBTAddress);
+				if (ElementInserted == VictronNames.end())
+					VictronNames.insert(std::make_pair(dbusBTAddress, std::string(value.str)));
+				else if (ElementInserted->second.compare(value.str)) // only copy the name when it has changed
+					ElementInserted->second.assign(value.str);
+				if (ConsoleVerbosity > 0)
+					ssOutput << "[" << timeToISO8601(TimeNow, true) << "] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << value.str << std::endl;
+			}
+		}
+		else if ((ConsoleVerbosity > 0) && (0 == strcmp(Key, "UUIDs"))) // the remaining properties are only of interest on the console
+		{
+			DBusMessageIter array3_iter;
+			dbus_message_iter_recurse(&variant_iter, &array3_iter);
+			do
+			{
+				if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&array3_iter))
+				{
+					dbus_message_iter_get_basic(&array3_iter, &value);
+					ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << value.str << std::endl;
 				}
+			} while (dbus_message_iter_next(&array3_iter));
+		}
+		else if ((ConsoleVerbosity > 0) && (0 == strcmp(Key, "Connected")))
+		{
+			if (DBUS_TYPE_BOOLEAN == dbus_message_Type)
+			{
+				dbus_message_iter_get_basic(&variant_iter, &value);
+				ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << std::boolalpha << bool(value.bool_val) << std::endl;
 			}
-			dbus_message_unref(dbus_reply);
+		}
+		else if ((ConsoleVerbosity > 0) && (0 == strcmp(Key, "ServicesResolved")))
+		{
+			if (DBUS_TYPE_BOOLEAN == dbus_message_Type)
+			{
+				dbus_message_iter_get_basic(&variant_iter, &value);
+				ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << std::boolalpha << bool(value.bool_val) << std::endl;
+			}
+		}
+		else if (ConsoleVerbosity > 0)
+			ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Key << std::endl;
+	} while (dbus_message_iter_next(&array_iter));
+	return(ssOutput.str());
+}
+// Devices without keys only get here with --discover. Nothing is decrypted or stored for them, their name and manufacturer data are shown
+// so the address can be matched with a key from the VictronConnect App.
+std::string bluez_dbus_msg_discovered(DBusMessageIter& array_iter, const bdaddr_t& dbusBTAddress)
+{
+	std::ostringstream ssOutput;
+	do
+	{
+		DBusMessageIter dict2_iter;
+		dbus_message_iter_recurse(&array_iter, &dict2_iter);
+		DBusBasicValue value;
+		dbus_message_iter_get_basic(&dict2_iter, &value);
+		const char* Key(value.str);
+		dbus_message_iter_next(&dict2_iter);
+		DBusMessageIter variant_iter;
+		dbus_message_iter_recurse(&dict2_iter, &variant_iter);
+		auto dbus_message_Type = dbus_message_iter_get_arg_type(&variant_iter);
+		if ((0 == strcmp(Key, "Name")) && (DBUS_TYPE_STRING == dbus_message_Type))
+		{
+			dbus_message_iter_get_basic(&variant_iter, &value);
+			ssOutput << "[" << getTimeISO8601(true) << "] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << value.str << " (no key)" << std::endl;
+		}
+		else if ((0 == strcmp(Key, "ManufacturerData")) && (DBUS_TYPE_ARRAY == dbus_message_Type))
+		{
+			DBusMessageIter array3_iter;
+			dbus_message_iter_recurse(&variant_iter, &array3_iter);
+			do
+			{
+				if (DBUS_TYPE_DICT_ENTRY == dbus_message_iter_get_arg_type(&array3_iter))
+				{
+					DBusMessageIter dict1_iter;
+					dbus_message_iter_recurse(&array3_iter, &dict1_iter);
+					if (DBUS_TYPE_UINT16 == dbus_message_iter_get_arg_type(&dict1_iter))
+					{
+						dbus_message_iter_get_basic(&dict1_iter, &value);
+						const uint16_t ManufacturerID(value.u16);
+						dbus_message_iter_next(&dict1_iter);
+						DBusMessageIter variant2_iter;
+						dbus_message_iter_recurse(&dict1_iter, &variant2_iter);
+						if ((DBUS_TYPE_ARRAY == dbus_message_iter_get_arg_type(&variant2_iter)) && (DBUS_TYPE_BYTE == dbus_message_iter_get_element_type(&variant2_iter)))
+						{
+							DBusMessageIter array4_iter;
+							dbus_message_iter_recurse(&variant2_iter, &array4_iter);
+							const uint8_t* ManufacturerData(nullptr);
+							int ManufacturerDataLength(0);
+							dbus_message_iter_get_fixed_array(&array4_iter, &ManufacturerData, &ManufacturerDataLength);
+							ssOutput << "[" << getTimeISO8601(true) << "] [" << ba2string_cached(dbusBTAddress) << "] " << Key << ": " << std::setfill('0') << std::hex << std::setw(4) << ManufacturerID << ":" << std::dec;
+							if (ManufacturerData != nullptr)
+								ssOutput << hex_string(ManufacturerData, ManufacturerDataLength);
+							if (VictronManufacturerID == ManufacturerID)
+								ssOutput << " 'Victron Energy BV' (no key)";
+							ssOutput << std::endl;
+						}
+					}
+				}
+			} while (dbus_message_iter_next(&array3_iter));
+		}
+	} while (dbus_message_iter_next(&array_iter));
+	return(ssOutput.str());
+}
+void bluez_dbus_FindExistingDevices(DBusMessage* dbus_reply)
+{
+	// This function is mainly useful after a rapid restart of the program. BlueZ keeps around information on devices for three minutes after scanning has been stopped.
+	// dbus_reply is the reply to GetManagedObjects, it is also where the device mirror starts from
+	std::ostringstream ssOutput;
+	BlueZDevicePaths.clear();
+	if (dbus_message_get_type(dbus_reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
+	{
+		const std::string dbus_reply_Signature(dbus_message_get_signature(dbus_reply));
+		int indent(16);
+		if (!dbus_reply_Signature.compare("a{oa{sa{sv}}}"))
+		{
+			DBusMessageIter root_iter;
+			dbus_message_iter_init(dbus_reply, &root_iter);
+			do {
+				DBusMessageIter array1_iter;
+				dbus_message_iter_recurse(&root_iter, &array1_iter);
+				do {
+					indent += 4;
+					DBusMessageIter dict1_iter;
+					dbus_message_iter_recurse(&array1_iter, &dict1_iter);
+					DBusBasicValue value;
+					dbus_message_iter_get_basic(&dict1_iter, &value);
+					const char* dict1_object_path(value.str);
+					dbus_message_iter_next(&dict1_iter);
+					DBusMessageIter array2_iter;
+					dbus_message_iter_recurse(&dict1_iter, &array2_iter);
+					do
+					{
+						DBusMessageIter dict2_iter;
+						dbus_message_iter_recurse(&array2_iter, &dict2_iter);
+						dbus_message_iter_get_basic(&dict2_iter, &value);
+						if (0 == strcmp(value.str, "org.bluez.Device1"))
+						{
+							if (ConsoleVerbosity > 1)
+								ssOutput << "[" << getTimeISO8601() << "] " << std::right << std::setw(indent) << "Object Path: " << dict1_object_path << std::endl;
+							dbus_message_iter_next(&dict2_iter);
+							DBusMessageIter array3_iter;
+							dbus_message_iter_recurse(&dict2_iter, &array3_iter);
+							const BlueZObjectPath& Device(bluez_path_lookup(dict1_object_path));
+							if (Device.Known)
+							{
+								BlueZDevicePaths.insert(dict1_object_path);
+								ssOutput << bluez_dbus_msg_iter(array3_iter, Device);
+							}
+							else if (bDiscoverMode)
+								ssOutput << bluez_dbus_msg_discovered(array3_iter, Device.Address);
+						}
+					} while (dbus_message_iter_next(&array2_iter));
+					indent -= 4;
+				} while (dbus_message_iter_next(&array1_iter));
+			} while (dbus_message_iter_next(&root_iter));
 		}
 	}
 	if (ConsoleVerbosity > 0)
@@ -2306,7 +4420,7 @@ void bluez_dbus_FindExistingDevices(DBusConnection* dbus_conn)
 void bluez_dbus_msg_InterfacesAdded(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddress)
 {
 	std::ostringstream ssOutput;
-	if (std::string(dbus_message_get_signature(dbus_msg)).compare("oa{sa{sv}}"))
+	if (strcmp(dbus_message_get_signature(dbus_msg), "oa{sa{sv}}"))
 		ssOutput << "Invalid Signature: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
 	else
 	{
@@ -2314,17 +4428,9 @@ void bluez_dbus_msg_InterfacesAdded(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddre
 		dbus_message_iter_init(dbus_msg, &root_iter);
 		DBusBasicValue value;
 		dbus_message_iter_get_basic(&root_iter, &value);
-		std::string root_object_path(value.str);
-
-		std::string BluetoothAddress;
-		const std::regex BluetoothAddressRegex("((([[:xdigit:]]{2}_){5}))[[:xdigit:]]{2}");
-		std::smatch AddressMatch;
-		if (std::regex_search(root_object_path, AddressMatch, BluetoothAddressRegex))
-		{
-			BluetoothAddress = AddressMatch.str();
-			std::replace(BluetoothAddress.begin(), BluetoothAddress.end(), '_', ':');
-			dbusBTAddress = string2ba(BluetoothAddress);
-		}
+		const char* Device_Path(value.str);
+		const BlueZObjectPath& Device(bluez_path_lookup(Device_Path));
+		dbusBTAddress = Device.Address;
 		dbus_message_iter_next(&root_iter);
 		DBusMessageIter array1_iter;
 		dbus_message_iter_recurse(&root_iter, &array1_iter);
@@ -2334,157 +4440,963 @@ void bluez_dbus_msg_InterfacesAdded(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddre
 			dbus_message_iter_recurse(&array1_iter, &dict1_iter);
 			DBusBasicValue value;
 			dbus_message_iter_get_basic(&dict1_iter, &value);
-			std::string val(value.str);
-			if (!val.compare("org.bluez.Device1"))
+			if (Device.Known && (0 == strcmp(value.str, "org.bluez.Device1")))
 			{
+				BlueZDevicePaths.insert(Device_Path);
 				dbus_message_iter_next(&dict1_iter);
 				DBusMessageIter array2_iter;
 				dbus_message_iter_recurse(&dict1_iter, &array2_iter);
-				ssOutput << bluez_dbus_msg_iter(array2_iter, dbusBTAddress);
+				ssOutput << bluez_dbus_msg_iter(array2_iter, Device);
+			}
+			else if (bDiscoverMode && (ConsoleVerbosity > 0) && (0 == strcmp(value.str, "org.bluez.Device1")))
+			{
+				dbus_message_iter_next(&dict1_iter);
+				DBusMessageIter array2_iter;
+				dbus_message_iter_recurse(&dict1_iter, &array2_iter);
+				std::cout << bluez_dbus_msg_discovered(array2_iter, Device.Address);
 			}
 		} while (dbus_message_iter_next(&array1_iter));
 	}
-	if (ConsoleVerbosity > 1)
-		std::cout << ssOutput.str();
-}
-void bluez_dbus_msg_PropertiesChanged(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddress)
-{
-	std::ostringstream ssOutput;
-	if (std::string(dbus_message_get_signature(dbus_msg)).compare("sa{sv}as"))
-		ssOutput << "Invalid Signature: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
-	else
+	if (ConsoleVerbosity > 1)
+		std::cout << ssOutput.str();
+}
+void bluez_dbus_msg_InterfacesRemoved(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddress)
+{
+	std::ostringstream ssOutput;
+	if (strcmp(dbus_message_get_signature(dbus_msg), "oas"))
+		ssOutput << "Invalid Signature: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
+	else
+	{
+		DBusMessageIter root_iter;
+		dbus_message_iter_init(dbus_msg, &root_iter);
+		DBusBasicValue value;
+		dbus_message_iter_get_basic(&root_iter, &value);
+		const char* Device_Path(value.str);
+		const BlueZObjectPath& Device(bluez_path_lookup(Device_Path));
+		dbusBTAddress = Device.Address;
+		dbus_message_iter_next(&root_iter);
+		DBusMessageIter array_iter;
+		dbus_message_iter_recurse(&root_iter, &array_iter);
+		do
+		{
+			if (DBUS_TYPE_STRING == dbus_message_iter_get_arg_type(&array_iter))
+			{
+				dbus_message_iter_get_basic(&array_iter, &value);
+				if (0 == strcmp(value.str, "org.bluez.Device1"))
+				{
+					if (BlueZDevicePaths.erase(Device_Path) > 0)
+						ssOutput << "[                   ] [" << ba2string_cached(dbusBTAddress) << "] " << Device_Path << " removed by BlueZ" << std::endl;
+				}
+			}
+		} while (dbus_message_iter_next(&array_iter));
+	}
+	if (ConsoleVerbosity > 1)
+		std::cout << ssOutput.str();
+}
+void bluez_dbus_msg_PropertiesChanged(DBusMessage* dbus_msg, bdaddr_t& dbusBTAddress)
+{
+	std::ostringstream ssOutput;
+	if (strcmp(dbus_message_get_signature(dbus_msg), "sa{sv}as"))
+		ssOutput << "Invalid Signature: " << __FILE__ << "(" << __LINE__ << ")" << std::endl;
+	else
+	{
+		const BlueZObjectPath& Device(bluez_path_lookup(dbus_message_get_path(dbus_msg))); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga18adf731bb42d324fe2624407319e4af
+		dbusBTAddress = Device.Address;
+		if (Device.Known)
+		{
+			DBusMessageIter root_iter;
+			dbus_message_iter_init(dbus_msg, &root_iter); // first argument is the interface name, which our match rules already restrict
+			dbus_message_iter_next(&root_iter);
+			DBusMessageIter array_iter;
+			dbus_message_iter_recurse(&root_iter, &array_iter);
+			ssOutput << bluez_dbus_msg_iter(array_iter, Device);
+		}
+		else if (bDiscoverMode && (ConsoleVerbosity > 0) && bluez_path2ba(dbus_message_get_path(dbus_msg), dbusBTAddress))
+		{
+			DBusMessageIter root_iter;
+			dbus_message_iter_init(dbus_msg, &root_iter);
+			DBusBasicValue value;
+			dbus_message_iter_get_basic(&root_iter, &value);
+			if (0 == strcmp(value.str, "org.bluez.Device1")) // the broad rules also bring changes to the adapters
+			{
+				dbus_message_iter_next(&root_iter);
+				DBusMessageIter array_iter;
+				dbus_message_iter_recurse(&root_iter, &array_iter);
+				std::cout << bluez_dbus_msg_discovered(array_iter, dbusBTAddress);
+			}
+		}
+	}
+	if ((ConsoleVerbosity > 1) && (ssOutput.tellp() > 0))
+		std::cout << ssOutput.str();
+}
+#ifdef VICTRON_BENCHMARK
+// Microbenchmark of advertisements from PropertiesChanged signals through the receive queue, decryption and decoding into the graph data,
+// the way they go when the console isn't showing each one, along with how many allocations they took once the device was known.
+// A made up battery with a made up key is added for the run and everything it left behind is taken out again, so it has to run before the threads start.
+void VictronAdvertisementBenchmark(void)
+{
+	const bdaddr_t TheAddress({ { 0x01, 0x00, 0x00, 0xEE, 0xFF, 0xC0 } });
+	const char* ObjectPath("/org/bluez/benchmark/dev_C0_FF_EE_00_00_01");
+	if ((VictronFrameQueue != nullptr) || (VictronEncryptionKeys->count(TheAddress) > 0))
+		return;
+	VictronEncryptionKey_t TheKey;
+	for (auto index = 0; index < int(TheKey.size()); index++)
+		TheKey[index] = uint8_t(index * 0x11 + 0x5a);
+	auto Keys(std::make_shared<VictronEncryptionKeyTable_t>(*VictronEncryptionKeys));
+	(*Keys)[TheAddress] = TheKey;
+	const std::shared_ptr<const VictronEncryptionKeyTable_t> SavedKeys(VictronEncryptionKeys);
+	const std::shared_ptr<const VictronEncryptionKeyTable_t> SavedBlueZKeys(BlueZEncryptionKeys);
+	VictronEncryptionKeys = BlueZEncryptionKeys = Keys;
+	bluez_path_cache_clear();
+	const time_t SavedInterval(VictronMinimumInterval);
+	VictronMinimumInterval = 0;
+	const size_t SavedHits(VictronKeyStreamHits), SavedMisses(VictronKeyStreamMisses);
+	VictronFrameQueue = std::make_unique<SPSCRingBuffer<VictronRawFrame>>(VictronDecryptBatchMax);
+	// Signals as BlueZ sends them for a SmartLithium battery, each with its own nonce so none of them are thrown away as repeats
+	const int Signals(64);
+	DBusMessage* PropertiesChanged[Signals];
+	for (auto signal = 0; signal < Signals; signal++)
+	{
+		uint8_t ManufacturerData[24] = { 0x10, 0x00, 0xeb, 0xa0, VictronSmartLithium::RecordType, uint8_t(signal), uint8_t(signal >> 8), TheKey[0] };
+		for (auto index = 8; index < int(sizeof(ManufacturerData)); index++)
+			ManufacturerData[index] = uint8_t(index * 0x1d + signal);
+		const uint8_t* Bytes(ManufacturerData);
+		const char* Interface("org.bluez.Device1");
+		const char* Property("ManufacturerData");
+		PropertiesChanged[signal] = dbus_message_new_signal(ObjectPath, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+		DBusMessageIter root_iter, array_iter, dict1_iter, variant_iter, array2_iter, dict2_iter, variant2_iter, array3_iter;
+		dbus_message_iter_init_append(PropertiesChanged[signal], &root_iter);
+		dbus_message_iter_append_basic(&root_iter, DBUS_TYPE_STRING, &Interface);
+		dbus_message_iter_open_container(&root_iter, DBUS_TYPE_ARRAY, "{sv}", &array_iter);
+		dbus_message_iter_open_container(&array_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &dict1_iter);
+		dbus_message_iter_append_basic(&dict1_iter, DBUS_TYPE_STRING, &Property);
+		dbus_message_iter_open_container(&dict1_iter, DBUS_TYPE_VARIANT, "a{qv}", &variant_iter);
+		dbus_message_iter_open_container(&variant_iter, DBUS_TYPE_ARRAY, "{qv}", &array2_iter);
+		dbus_message_iter_open_container(&array2_iter, DBUS_TYPE_DICT_ENTRY, nullptr, &dict2_iter);
+		dbus_message_iter_append_basic(&dict2_iter, DBUS_TYPE_UINT16, &VictronManufacturerID);
+		dbus_message_iter_open_container(&dict2_iter, DBUS_TYPE_VARIANT, "ay", &variant2_iter);
+		dbus_message_iter_open_container(&variant2_iter, DBUS_TYPE_ARRAY, "y", &array3_iter);
+		dbus_message_iter_append_fixed_array(&array3_iter, DBUS_TYPE_BYTE, &Bytes, sizeof(ManufacturerData));
+		dbus_message_iter_close_container(&variant2_iter, &array3_iter);
+		dbus_message_iter_close_container(&dict2_iter, &variant2_iter);
+		dbus_message_iter_close_container(&array2_iter, &dict2_iter);
+		dbus_message_iter_close_container(&variant_iter, &array2_iter);
+		dbus_message_iter_close_container(&dict1_iter, &variant_iter);
+		dbus_message_iter_close_container(&array_iter, &dict1_iter);
+		dbus_message_iter_close_container(&root_iter, &array_iter);
+		dbus_message_iter_open_container(&root_iter, DBUS_TYPE_ARRAY, "s", &array_iter); // no invalidated properties
+		dbus_message_iter_close_container(&root_iter, &array_iter);
+	}
+	// The same steps BlueZReceiveThread and the processing loop in main take, a batch at a time
+	auto Advertisements = [&PropertiesChanged](const int Iterations) {
+		VictronRawFrame Frames[VictronDecryptBatchMax];
+		uint8_t Plain[VictronDecryptBatchMax][VictronManufacturerDataMax];
+		const uint8_t* Payloads[VictronDecryptBatchMax];
+		bdaddr_t dbusBTAddress;
+		for (auto iteration = 0; iteration < Iterations; iteration += int(VictronDecryptBatchMax))
+		{
+			for (auto signal = iteration; signal < iteration + int(VictronDecryptBatchMax); signal++)
+				bluez_dbus_msg_PropertiesChanged(PropertiesChanged[signal % Signals], dbusBTAddress);
+			size_t FrameCount(0);
+			while ((FrameCount < VictronDecryptBatchMax) && VictronFrameQueue->Pop(Frames[FrameCount]))
+				FrameCount++;
+			VictronDecryptFrames(Frames, FrameCount, Plain, Payloads);
+			for (size_t index = 0; index < FrameCount; index++)
+				ProcessVictronFrame(Frames[index], Payloads[index]);
+		}
+	};
+	const int Iterations(20000);
+	Advertisements(Iterations); // grows the tables for the device to what it needs, the log queue to as many records as a run
+	VictronVirtualLog[TheAddress].clear();
+	const size_t AllocationsBefore(HeapAllocations);
+	auto Start(std::chrono::steady_clock::now());
+	Advertisements(Iterations);
+	auto Finish(std::chrono::steady_clock::now());
+	const size_t Allocations(HeapAllocations - AllocationsBefore);
+	const size_t Stored(VictronVirtualLog[TheAddress].size());
+	std::cout << "[                   ] Advertisement from D-Bus to graph data: " << std::chrono::duration_cast<std::chrono::nanoseconds>(Finish - Start).count() / Iterations << " ns/advertisement, "
+		<< Allocations << " allocations in " << Stored << " advertisements" << std::endl;
+	for (auto& Signal : PropertiesChanged)
+		dbus_message_unref(Signal);
+	VictronFrameQueue.reset();
+	VictronKeyStreamHits = SavedHits;
+	VictronKeyStreamMisses = SavedMisses;
+	VictronMinimumInterval = SavedInterval;
+	VictronEncryptionKeys = SavedKeys;
+	BlueZEncryptionKeys = SavedBlueZKeys;
+	bluez_path_cache_clear();
+	auto Cipher = VictronCiphers.find(TheAddress);
+	if (Cipher != VictronCiphers.end())
+		EVP_CIPHER_CTX_free(Cipher->second->ctx);
+	VictronCiphers.erase(TheAddress);
+	VictronVirtualLog.erase(TheAddress);
+	VictronDevices.erase(TheAddress);
+	VictronLastFrames.erase(TheAddress);
+	VictronLastStored.erase(TheAddress);
+	std::lock_guard<std::mutex> StatsLock(BlueZAdapterStatisticsMutex);
+	BlueZAdapterStatistics.erase(std::string(ObjectPath, strstr(ObjectPath, "/dev_")));
+}
+#endif // VICTRON_BENCHMARK
+void bluez_dbus_RemoveKnownDevices(DBusConnection* dbus_conn, const char* adapter_path)
+{
+	// RemoveDevice is sent for each of our devices on this adapter without waiting for the replies
+	// This link helped figure out how to remove a device
+	// https://www.linumiz.com/bluetooth-removedevice-to-remove-the-device/
+	// https://www.mankier.com/5/org.bluez.Adapter#Interface-void_RemoveDevice(object_device)
+	std::queue<std::string> ObjectsToDelete;
+	const std::string AdapterPrefix(std::string(adapter_path) + "/");
+	for (auto DevicePath = BlueZDevicePaths.lower_bound(AdapterPrefix); (DevicePath != BlueZDevicePaths.end()) && (0 == DevicePath->compare(0, AdapterPrefix.length(), AdapterPrefix)); )
+	{
+		ObjectsToDelete.push(*DevicePath);
+		DevicePath = BlueZDevicePaths.erase(DevicePath);
+	}
+	while (!ObjectsToDelete.empty())
+	{
+		DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.bluez.Adapter1", "RemoveDevice");
+		if (dbus_msg)
+		{
+			DBusMessageIter iterParameter;
+			dbus_message_iter_init_append(dbus_msg, &iterParameter); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf733047c467ce21f4a53b65a388f1e9d
+			const char* Object = ObjectsToDelete.front().c_str();
+			dbus_message_iter_append_basic(&iterParameter, DBUS_TYPE_OBJECT_PATH, &Object); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga17491f3b75b3203f6fc47dcc2e3b221b
+		}
+		dbus_call_async(dbus_conn, dbus_msg, nullptr, " " + ObjectsToDelete.front());
+		ObjectsToDelete.pop();
+	}
+}
+/////////////////////////////////////////////////////////////////////////////
+// With --monitor we ask BlueZ to pass on only the advertisements carrying Victron's company ID instead of running general discovery,
+// so the controller does the filtering and a crowded neighborhood no longer wakes us up for every advertisement it sends.
+// https://git.kernel.org/pub/scm/bluetooth/bluez.git/tree/doc/org.bluez.AdvertisementMonitor.rst
+// https://git.kernel.org/pub/scm/bluetooth/bluez.git/tree/doc/org.bluez.AdvertisementMonitorManager.rst
+// BlueZ reads the monitor from an object tree we export, so we answer its GetManagedObjects and Properties calls ourselves.
+bool bMonitorMode(false);
+const char BlueZMonitorAppPath[] = "/org/victronbtlelogger";
+const char BlueZMonitorPath[] = "/org/victronbtlelogger/monitor0";
+const char* BlueZMonitorProperties[] = { "Type", "Patterns" };
+// Appends the value of a monitor property as a variant, returns false if there's no such property.
+bool bluez_monitor_append_property(DBusMessageIter& iterParent, const char* Property)
+{
+	bool rval(true);
+	DBusMessageIter iterVariant;
+	if (0 == strcmp(Property, "Type"))
+	{
+		dbus_message_iter_open_container(&iterParent, DBUS_TYPE_VARIANT, DBUS_TYPE_STRING_AS_STRING, &iterVariant);
+		const char* cpType = "or_patterns";
+		dbus_message_iter_append_basic(&iterVariant, DBUS_TYPE_STRING, &cpType);
+		dbus_message_iter_close_container(&iterParent, &iterVariant);
+	}
+	else if (0 == strcmp(Property, "Patterns"))
+	{
+		// One pattern: Manufacturer Specific Data (AD type 0xFF) starting with the company ID in little endian order
+		dbus_message_iter_open_container(&iterParent, DBUS_TYPE_VARIANT, "a(yyay)", &iterVariant);
+		DBusMessageIter iterArray;
+		dbus_message_iter_open_container(&iterVariant, DBUS_TYPE_ARRAY, "(yyay)", &iterArray);
+		DBusMessageIter iterStruct;
+		dbus_message_iter_open_container(&iterArray, DBUS_TYPE_STRUCT, NULL, &iterStruct);
+		const uint8_t StartPosition(0);
+		dbus_message_iter_append_basic(&iterStruct, DBUS_TYPE_BYTE, &StartPosition);
+		const uint8_t ADType(0xFF);
+		dbus_message_iter_append_basic(&iterStruct, DBUS_TYPE_BYTE, &ADType);
+		DBusMessageIter iterContent;
+		dbus_message_iter_open_container(&iterStruct, DBUS_TYPE_ARRAY, DBUS_TYPE_BYTE_AS_STRING, &iterContent);
+		const uint8_t Content[] = { uint8_t(VictronManufacturerID & 0xFF), uint8_t(VictronManufacturerID >> 8) };
+		const uint8_t* pContent(Content);
+		dbus_message_iter_append_fixed_array(&iterContent, DBUS_TYPE_BYTE, &pContent, sizeof(Content));
+		dbus_message_iter_close_container(&iterStruct, &iterContent);
+		dbus_message_iter_close_container(&iterArray, &iterStruct);
+		dbus_message_iter_close_container(&iterVariant, &iterArray);
+		dbus_message_iter_close_container(&iterParent, &iterVariant);
+	}
+	else
+		rval = false;
+	return(rval);
+}
+void bluez_monitor_append_properties(DBusMessageIter& iterParent)
+{
+	DBusMessageIter iterArray;
+	dbus_message_iter_open_container(&iterParent, DBUS_TYPE_ARRAY, "{sv}", &iterArray);
+	for (auto& Property : BlueZMonitorProperties)
+	{
+		DBusMessageIter iterDict;
+		dbus_message_iter_open_container(&iterArray, DBUS_TYPE_DICT_ENTRY, NULL, &iterDict);
+		dbus_message_iter_append_basic(&iterDict, DBUS_TYPE_STRING, &Property);
+		bluez_monitor_append_property(iterDict, Property);
+		dbus_message_iter_close_container(&iterArray, &iterDict);
+	}
+	dbus_message_iter_close_container(&iterParent, &iterArray);
+}
+// Registered as the handler for everything below BlueZMonitorAppPath on our connection.
+DBusHandlerResult bluez_monitor_message(DBusConnection* dbus_conn, DBusMessage* dbus_msg, void* user_data)
+{
+	DBusMessage* dbus_reply(nullptr);
+	const char* ObjectPath(dbus_message_get_path(dbus_msg));
+	const bool bMonitorObject((ObjectPath != nullptr) && (0 == strcmp(ObjectPath, BlueZMonitorPath)));
+	if (dbus_message_is_method_call(dbus_msg, "org.freedesktop.DBus.ObjectManager", "GetManagedObjects") && (ObjectPath != nullptr) && (0 == strcmp(ObjectPath, BlueZMonitorAppPath)))
+	{
+		dbus_reply = dbus_message_new_method_return(dbus_msg);
+		if (dbus_reply)
+		{
+			DBusMessageIter iterParameter;
+			dbus_message_iter_init_append(dbus_reply, &iterParameter);
+			DBusMessageIter iterObjects;
+			dbus_message_iter_open_container(&iterParameter, DBUS_TYPE_ARRAY, "{oa{sa{sv}}}", &iterObjects);
+			DBusMessageIter iterObject;
+			dbus_message_iter_open_container(&iterObjects, DBUS_TYPE_DICT_ENTRY, NULL, &iterObject);
+			const char* cpPath = BlueZMonitorPath;
+			dbus_message_iter_append_basic(&iterObject, DBUS_TYPE_OBJECT_PATH, &cpPath);
+			DBusMessageIter iterInterfaces;
+			dbus_message_iter_open_container(&iterObject, DBUS_TYPE_ARRAY, "{sa{sv}}", &iterInterfaces);
+			DBusMessageIter iterInterface;
+			dbus_message_iter_open_container(&iterInterfaces, DBUS_TYPE_DICT_ENTRY, NULL, &iterInterface);
+			const char* cpInterface = "org.bluez.AdvertisementMonitor1";
+			dbus_message_iter_append_basic(&iterInterface, DBUS_TYPE_STRING, &cpInterface);
+			bluez_monitor_append_properties(iterInterface);
+			dbus_message_iter_close_container(&iterInterfaces, &iterInterface);
+			dbus_message_iter_close_container(&iterObject, &iterInterfaces);
+			dbus_message_iter_close_container(&iterObjects, &iterObject);
+			dbus_message_iter_close_container(&iterParameter, &iterObjects);
+		}
+	}
+	else if (bMonitorObject && dbus_message_is_method_call(dbus_msg, "org.freedesktop.DBus.Properties", "GetAll"))
+	{
+		dbus_reply = dbus_message_new_method_return(dbus_msg);
+		if (dbus_reply)
+		{
+			DBusMessageIter iterParameter;
+			dbus_message_iter_init_append(dbus_reply, &iterParameter);
+			bluez_monitor_append_properties(iterParameter);
+		}
+	}
+	else if (bMonitorObject && dbus_message_is_method_call(dbus_msg, "org.freedesktop.DBus.Properties", "Get"))
+	{
+		const char* Interface(nullptr);
+		const char* Property(nullptr);
+		if (dbus_message_get_args(dbus_msg, nullptr, DBUS_TYPE_STRING, &Interface, DBUS_TYPE_STRING, &Property, DBUS_TYPE_INVALID)) // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html
+		{
+			dbus_reply = dbus_message_new_method_return(dbus_msg);
+			if (dbus_reply)
+			{
+				DBusMessageIter iterParameter;
+				dbus_message_iter_init_append(dbus_reply, &iterParameter);
+				if (!bluez_monitor_append_property(iterParameter, Property))
+				{
+					dbus_message_unref(dbus_reply);
+					dbus_reply = dbus_message_new_error(dbus_msg, DBUS_ERROR_UNKNOWN_PROPERTY, Property);
+				}
+			}
+		}
+	}
+	else if (bMonitorObject && (DBUS_MESSAGE_TYPE_METHOD_CALL == dbus_message_get_type(dbus_msg)) && dbus_message_has_interface(dbus_msg, "org.bluez.AdvertisementMonitor1"))
+	{
+		// Release, Activate, DeviceFound and DeviceLost need no more than an acknowledgement
+		if (ConsoleVerbosity > 1)
+		{
+			std::ostringstream ssOutput;
+			ssOutput << "[                   ] " << ObjectPath << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg);
+			const char* Device(nullptr);
+			if (dbus_message_get_args(dbus_msg, nullptr, DBUS_TYPE_OBJECT_PATH, &Device, DBUS_TYPE_INVALID))
+				ssOutput << " " << Device;
+			std::cout << ssOutput.str() << std::endl;
+		}
+		dbus_reply = dbus_message_new_method_return(dbus_msg);
+	}
+	if (dbus_reply == nullptr)
+		return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+	dbus_connection_send(dbus_conn, dbus_reply, nullptr); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html
+	dbus_message_unref(dbus_reply);
+	return(DBUS_HANDLER_RESULT_HANDLED);
+}
+const DBusObjectPathVTable BlueZMonitorVTable = { nullptr, bluez_monitor_message, nullptr, nullptr, nullptr, nullptr }; // no unregister function, the rest is padding
+bool bluez_register_monitor(DBusConnection* dbus_conn, const char* adapter_path, DBusReplyHandler Handler, const bool bRegister = true)
+{
+	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.bluez.AdvertisementMonitorManager1", bRegister ? "RegisterMonitor" : "UnregisterMonitor");
+	if (dbus_msg)
+	{
+		const char* cpPath = BlueZMonitorAppPath;
+		dbus_message_append_args(dbus_msg, DBUS_TYPE_OBJECT_PATH, &cpPath, DBUS_TYPE_INVALID);
+	}
+	return(dbus_call_async(dbus_conn, dbus_msg, Handler));
+}
+/////////////////////////////////////////////////////////////////////////////
+// Event driven D-Bus main loop.
+// libdbus tells us which file descriptors and timers it needs through the watch and timeout callbacks.
+// We wait on all of them with a single epoll_wait() and dispatch every queued message on each wakeup.
+struct DBusEventLoop
+{
+	int epoll_fd = -1;
+	std::vector<DBusWatch*> Watches;
+	std::map<DBusTimeout*, std::chrono::steady_clock::time_point> Timeouts; // enabled timeouts and when they next expire
+	std::map<int, std::function<void()>> Handlers; // file descriptors that are not owned by D-Bus, and what to do when they are readable
+};
+// A read watch and a write watch can share a file descriptor, but epoll only allows it to be registered once, so we recompute the combined event mask.
+void dbus_event_loop_update_fd(DBusEventLoop& Loop, const int fd)
+{
+	uint32_t events(0);
+	for (auto& watch : Loop.Watches)
+		if ((dbus_watch_get_unix_fd(watch) == fd) && dbus_watch_get_enabled(watch))
+		{
+			const unsigned int flags(dbus_watch_get_flags(watch));
+			if (flags & DBUS_WATCH_READABLE)
+				events |= EPOLLIN;
+			if (flags & DBUS_WATCH_WRITABLE)
+				events |= EPOLLOUT;
+		}
+	struct epoll_event ev({ 0 });
+	ev.events = events;
+	ev.data.fd = fd;
+	if (events == 0)
+		epoll_ctl(Loop.epoll_fd, EPOLL_CTL_DEL, fd, &ev);
+	else if ((0 != epoll_ctl(Loop.epoll_fd, EPOLL_CTL_MOD, fd, &ev)) && (errno == ENOENT))
+		epoll_ctl(Loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+}
+dbus_bool_t dbus_event_loop_add_watch(DBusWatch* watch, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	Loop.Watches.push_back(watch);
+	dbus_event_loop_update_fd(Loop, dbus_watch_get_unix_fd(watch));
+	return(TRUE);
+}
+void dbus_event_loop_remove_watch(DBusWatch* watch, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	Loop.Watches.erase(std::remove(Loop.Watches.begin(), Loop.Watches.end(), watch), Loop.Watches.end());
+	dbus_event_loop_update_fd(Loop, dbus_watch_get_unix_fd(watch));
+}
+void dbus_event_loop_toggle_watch(DBusWatch* watch, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	dbus_event_loop_update_fd(Loop, dbus_watch_get_unix_fd(watch));
+}
+dbus_bool_t dbus_event_loop_add_timeout(DBusTimeout* timeout, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	if (dbus_timeout_get_enabled(timeout))
+		Loop.Timeouts[timeout] = std::chrono::steady_clock::now() + std::chrono::milliseconds(dbus_timeout_get_interval(timeout));
+	return(TRUE);
+}
+void dbus_event_loop_remove_timeout(DBusTimeout* timeout, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	Loop.Timeouts.erase(timeout);
+}
+void dbus_event_loop_toggle_timeout(DBusTimeout* timeout, void* data)
+{
+	DBusEventLoop& Loop(*static_cast<DBusEventLoop*>(data));
+	Loop.Timeouts.erase(timeout);
+	dbus_event_loop_add_timeout(timeout, data);
+}
+bool dbus_event_loop_init(DBusConnection* dbus_conn, DBusEventLoop& Loop)
+{
+	bool rval(false);
+	Loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (Loop.epoll_fd >= 0)
+		if (dbus_connection_set_watch_functions(dbus_conn, dbus_event_loop_add_watch, dbus_event_loop_remove_watch, dbus_event_loop_toggle_watch, &Loop, nullptr))
+			if (dbus_connection_set_timeout_functions(dbus_conn, dbus_event_loop_add_timeout, dbus_event_loop_remove_timeout, dbus_event_loop_toggle_timeout, &Loop, nullptr))
+				rval = true;
+	return(rval);
+}
+// Adds a file descriptor that is not part of the D-Bus connection to the loop. Handler is called whenever it is readable.
+bool dbus_event_loop_add_fd(DBusEventLoop& Loop, const int fd, std::function<void()> Handler)
+{
+	struct epoll_event ev({ 0 });
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	bool rval(0 == epoll_ctl(Loop.epoll_fd, EPOLL_CTL_ADD, fd, &ev));
+	if (rval)
+		Loop.Handlers[fd] = Handler;
+	return(rval);
+}
+// Waits at most MaxWaitMilliseconds for the D-Bus connection to need attention, handles it, and dispatches every message that has been queued.
+// Returns false once the connection has been closed.
+bool dbus_event_loop_iterate(DBusConnection* dbus_conn, DBusEventLoop& Loop, const int MaxWaitMilliseconds)
+{
+	if (DBUS_DISPATCH_DATA_REMAINS == dbus_connection_get_dispatch_status(dbus_conn)) // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html
+	{
+		// Messages were queued while we were making blocking method calls. Their handlers may have changed what the caller wants to wait for, so return without waiting.
+		while (DBUS_DISPATCH_DATA_REMAINS == dbus_connection_dispatch(dbus_conn));
+		return(dbus_connection_get_is_connected(dbus_conn));
+	}
+	int WaitMilliseconds(MaxWaitMilliseconds);
+	auto TimeNow(std::chrono::steady_clock::now());
+	for (auto& [timeout, expiry] : Loop.Timeouts)
+		WaitMilliseconds = std::min(WaitMilliseconds, int(std::max(std::chrono::milliseconds::zero(), std::chrono::duration_cast<std::chrono::milliseconds>(expiry - TimeNow)).count()));
+	struct epoll_event events[8];
+	int nfds = epoll_wait(Loop.epoll_fd, events, sizeof(events) / sizeof(events[0]), WaitMilliseconds);
+	for (auto index = 0; index < nfds; index++)
+	{
+		if (auto Handler = Loop.Handlers.find(events[index].data.fd); Handler != Loop.Handlers.end())
+		{
+			Handler->second();
+			continue;
+		}
+		// Handling one watch may remove another, so work from a copy and make sure each watch still exists before handling it
+		std::vector<DBusWatch*> FdWatches;
+		for (auto& watch : Loop.Watches)
+			if (dbus_watch_get_unix_fd(watch) == events[index].data.fd)
+				FdWatches.push_back(watch);
+		for (auto& watch : FdWatches)
+			if (std::find(Loop.Watches.begin(), Loop.Watches.end(), watch) != Loop.Watches.end())
+				if (dbus_watch_get_enabled(watch))
+				{
+					const unsigned int WatchFlags(dbus_watch_get_flags(watch));
+					unsigned int flags(0);
+					if ((events[index].events & EPOLLIN) && (WatchFlags & DBUS_WATCH_READABLE))
+						flags |= DBUS_WATCH_READABLE;
+					if ((events[index].events & EPOLLOUT) && (WatchFlags & DBUS_WATCH_WRITABLE))
+						flags |= DBUS_WATCH_WRITABLE;
+					if (events[index].events & EPOLLERR)
+						flags |= DBUS_WATCH_ERROR;
+					if (events[index].events & EPOLLHUP)
+						flags |= DBUS_WATCH_HANGUP;
+					if (flags != 0)
+						dbus_watch_handle(watch, flags);
+				}
+	}
+	TimeNow = std::chrono::steady_clock::now();
+	std::vector<DBusTimeout*> Expired;
+	for (auto& [timeout, expiry] : Loop.Timeouts)
+		if (expiry <= TimeNow)
+			Expired.push_back(timeout);
+	for (auto& timeout : Expired)
+	{
+		auto it = Loop.Timeouts.find(timeout);
+		if (it != Loop.Timeouts.end())
+		{
+			it->second = TimeNow + std::chrono::milliseconds(dbus_timeout_get_interval(timeout));
+			dbus_timeout_handle(timeout);
+		}
+	}
+	while (DBUS_DISPATCH_DATA_REMAINS == dbus_connection_dispatch(dbus_conn));
+	return(dbus_connection_get_is_connected(dbus_conn));
+}
+// Signals are only routed to us for the devices we have keys for, so the dbus-daemon drops the rest of a crowded neighborhood before we ever see it.
+// With --discover the broad rules are added as well, so devices that aren't in the key file yet are shown on the console.
+std::set<std::string> bluez_match_rules(const std::string& AdapterPath)
+{
+	std::set<std::string> MatchRules;
+	for (auto& [TheAddress, TheKey] : *BlueZEncryptionKeys)
+	{
+		std::string DevicePath(AdapterPath + "/dev_" + ba2string(TheAddress));
+		std::replace(DevicePath.begin(), DevicePath.end(), ':', '_');
+		MatchRules.insert("type='signal',sender='org.bluez',interface='org.freedesktop.DBus.Properties',member='PropertiesChanged',path='" + DevicePath + "'");
+		MatchRules.insert("type='signal',sender='org.bluez',interface='org.freedesktop.DBus.ObjectManager',member='InterfacesAdded',arg0path='" + DevicePath + "'");
+		MatchRules.insert("type='signal',sender='org.bluez',interface='org.freedesktop.DBus.ObjectManager',member='InterfacesRemoved',arg0path='" + DevicePath + "'");
+	}
+	if (bDiscoverMode)
+	{
+		MatchRules.insert("type='signal',sender='org.bluez',member='InterfacesAdded'");
+		MatchRules.insert("type='signal',sender='org.bluez',member='InterfacesRemoved'");
+		MatchRules.insert("type='signal',sender='org.bluez',member='PropertiesChanged'");
+	}
+	return(MatchRules);
+}
+// Adds and removes match rules so that the installed set matches the desired set. Only the differences are sent to the bus.
+void bluez_update_match_rules(DBusConnection* dbus_conn, std::set<std::string>& InstalledRules, const std::set<std::string>& DesiredRules)
+{
+	std::vector<std::pair<std::string, bool>> Changes; // rule, and true to add or false to remove
+	for (auto& MatchRule : InstalledRules)
+		if (DesiredRules.find(MatchRule) == DesiredRules.end())
+			Changes.push_back(std::make_pair(MatchRule, false));
+	for (auto& MatchRule : DesiredRules)
+		if (InstalledRules.find(MatchRule) == InstalledRules.end())
+			Changes.push_back(std::make_pair(MatchRule, true));
+	for (auto& [MatchRule, bAdd] : Changes)
+	{
+		std::ostringstream ssOutput;
+		if (ConsoleVerbosity > 0)
+			ssOutput << "[                   ] ";
+		ssOutput << (bAdd ? "Add" : "Remove") << " Match Rule: \"" << MatchRule << "\"";
+		bool MatchRuleError(false);
+		DBusError dbus_error;
+		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
+		if (bAdd)
+			dbus_bus_add_match(dbus_conn, MatchRule.c_str(), &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga4eb6401ba014da3dbe3dc4e2a8e5b3ef
+		else
+			dbus_bus_remove_match(dbus_conn, MatchRule.c_str(), &dbus_error);
+		if (dbus_error_is_set(&dbus_error))
+		{
+			ssOutput << " Error: " << dbus_error.message;
+			dbus_error_free(&dbus_error);
+			MatchRuleError = true;
+		}
+		else if (bAdd)
+			InstalledRules.insert(MatchRule);
+		if (!bAdd)
+			InstalledRules.erase(MatchRule); // even on error, there's nothing more we can do with it
+		if (ConsoleVerbosity > 1)
+			std::cout << ssOutput.str() << std::endl;
+		else if (MatchRuleError)
+			std::cerr << ssOutput.str() << std::endl;
+	}
+}
+// Every signal that passes our match rules comes through here when the connection is dispatched.
+DBusHandlerResult bluez_dbus_signal_filter(DBusConnection* dbus_conn, DBusMessage* dbus_msg, void* user_data)
+{
+	if (DBUS_MESSAGE_TYPE_SIGNAL == dbus_message_get_type(dbus_msg))
+	{
+		bdaddr_t localBTAddress({ 0 });
+		if (dbus_message_is_signal(dbus_msg, "org.freedesktop.DBus.ObjectManager", "InterfacesAdded"))
+			bluez_dbus_msg_InterfacesAdded(dbus_msg, localBTAddress);
+		else if (dbus_message_is_signal(dbus_msg, "org.freedesktop.DBus.ObjectManager", "InterfacesRemoved"))
+			bluez_dbus_msg_InterfacesRemoved(dbus_msg, localBTAddress);
+		else if (dbus_message_is_signal(dbus_msg, "org.freedesktop.DBus.Properties", "PropertiesChanged"))
+			bluez_dbus_msg_PropertiesChanged(dbus_msg, localBTAddress);
+	}
+	return(DBUS_HANDLER_RESULT_NOT_YET_HANDLED);
+}
+/////////////////////////////////////////////////////////////////////////////
+// Each adapter we scan with works through these steps. Every step is one asynchronous method call,
+// bluez_session_step() starts the calls and bluez_adapter_result() moves on when each reply arrives.
+enum class BlueZAdapterStep { PowerOn, RegisterMonitor, SetFilter, StartDiscovery, Scanning, StopScanning, Finished };
+const int BlueZMethodRetries(3); // attempts at powering on or starting discovery before giving up on an adapter
+const std::chrono::seconds BlueZRetryDelay(5);
+const std::chrono::seconds BlueZTeardownTimeout(15); // how long to wait for the adapters to stop before closing the connection anyway
+struct BlueZAdapterSession {
+	explicit BlueZAdapterSession(const std::string& AdapterPath) : Path(AdapterPath) { };
+	std::string Path;
+	BlueZAdapterStep Step = BlueZAdapterStep::PowerOn;
+	bool bBusy = false; // the method call for Step is waiting for its reply
+	bool bMonitor = false; // scanning through our advertisement monitor rather than discovery
+	int Attempts = 0;
+	std::chrono::steady_clock::time_point RetryTime;
+};
+struct BlueZSession {
+	DBusConnection* dbus_conn = nullptr;
+	std::set<bdaddr_t> ControllerAddresses;
+	bool bMonitor = false; // our advertisement monitor object is exported, so adapters try it before falling back to discovery
+	bool bAdaptersBusy = false; // GetManagedObjects is waiting for its reply
+	std::chrono::steady_clock::time_point AdaptersRetryTime;
+	std::vector<std::shared_ptr<BlueZAdapterSession>> Adapters; // empty until BlueZ tells us which adapters exist
+	std::set<std::string> ScanningAdapters; // adapters the installed match rules were built for
+	std::set<std::string> MatchRules;
+	bool bStopping = false;
+};
+void bluez_adapter_result(BlueZSession& Session, BlueZAdapterSession& Adapter, const bool bSuccess)
+{
+	Adapter.bBusy = false;
+	switch (Adapter.Step)
+	{
+	case BlueZAdapterStep::PowerOn:
+	case BlueZAdapterStep::StartDiscovery:
+		if (bSuccess)
+		{
+			Adapter.Attempts = 0;
+			if (Adapter.Step == BlueZAdapterStep::StartDiscovery)
+				Adapter.Step = BlueZAdapterStep::Scanning;
+			else
+				Adapter.Step = Session.bMonitor ? BlueZAdapterStep::RegisterMonitor : BlueZAdapterStep::SetFilter;
+		}
+		else if (++Adapter.Attempts < BlueZMethodRetries)
+			Adapter.RetryTime = std::chrono::steady_clock::now() + BlueZRetryDelay;
+		else
+		{
+			if (Adapter.Step == BlueZAdapterStep::StartDiscovery)
+				bluez_power_on(Session.dbus_conn, Adapter.Path.c_str(), nullptr, false);
+			Adapter.Step = BlueZAdapterStep::Finished;
+		}
+		break;
+	case BlueZAdapterStep::RegisterMonitor:
+		Adapter.bMonitor = bSuccess;
+		if (bSuccess)
+			Adapter.Step = BlueZAdapterStep::Scanning;
+		else
+		{
+			// Advertisement monitors need a recent BlueZ, and some versions only offer them with --experimental
+			std::ostringstream ssOutput;
+			if (ConsoleVerbosity > 0)
+				ssOutput << "[                   ] ";
+			ssOutput << Adapter.Path << ": advertisement monitor not available, falling back to discovery";
+			if (ConsoleVerbosity > 0)
+				std::cout << ssOutput.str() << std::endl;
+			else
+				std::cerr << ssOutput.str() << std::endl;
+			Adapter.Step = BlueZAdapterStep::SetFilter;
+		}
+		break;
+	case BlueZAdapterStep::SetFilter:
+		Adapter.Step = BlueZAdapterStep::StartDiscovery; // discovery still works without the filter, we just get more traffic
+		break;
+	case BlueZAdapterStep::StopScanning:
+		bluez_dbus_RemoveKnownDevices(Session.dbus_conn, Adapter.Path.c_str()); // teardown carries on even if stopping failed
+		Adapter.Step = BlueZAdapterStep::Finished;
+		break;
+	default:
+		break;
+	}
+}
+// Starts any method calls that are due, and keeps the match rules in step with the adapters that are scanning.
+// Returns the time it next needs to be called if nothing arrives from D-Bus before then.
+std::chrono::steady_clock::time_point bluez_session_step(BlueZSession& Session)
+{
+	const auto TimeNow(std::chrono::steady_clock::now());
+	auto TimeNext(TimeNow + std::chrono::hours(24));
+	BlueZSession* pSession(&Session); // the session outlives every pending call, they are dropped when the connection is closed
+	if (!Session.bStopping && Session.Adapters.empty() && !Session.bAdaptersBusy)
+	{
+		if (TimeNow < Session.AdaptersRetryTime)
+			TimeNext = std::min(TimeNext, Session.AdaptersRetryTime);
+		else
+		{
+			Session.bAdaptersBusy = bluez_get_managed_objects(Session.dbus_conn, [pSession](DBusMessage* dbus_reply)
+				{
+					pSession->bAdaptersBusy = false;
+					std::map<bdaddr_t, std::string> BlueZAdapterMap;
+					if ((dbus_reply != nullptr) && bluez_find_adapters(dbus_reply, BlueZAdapterMap))
+					{
+						// Scan with every adapter, or only the ones given with --controller
+						for (auto& [AdapterAddress, AdapterPath] : BlueZAdapterMap)
+							if (pSession->ControllerAddresses.empty() || (pSession->ControllerAddresses.find(AdapterAddress) != pSession->ControllerAddresses.end()))
+								pSession->Adapters.push_back(std::make_shared<BlueZAdapterSession>(AdapterPath));
+						if (pSession->Adapters.empty())
+							pSession->Adapters.push_back(std::make_shared<BlueZAdapterSession>(BlueZAdapterMap.cbegin()->second));
+						bluez_dbus_FindExistingDevices(dbus_reply); // This pulls data from BlueZ on devices that BlueZ is already keeping track of
+					}
+					else
+					{
+						std::ostringstream ssOutput;
+						if (ConsoleVerbosity > 0)
+							ssOutput << "[" << getTimeISO8601(true) << "] ";
+						ssOutput << "Could not get list of adapters from BlueZ over DBus. Trying again in " << BlueZRetryDelay.count() << " seconds.";
+						if (ConsoleVerbosity > 0)
+							std::cout << ssOutput.str() << std::endl;
+						else
+							std::cerr << ssOutput.str() << std::endl;
+						pSession->AdaptersRetryTime = std::chrono::steady_clock::now() + BlueZRetryDelay;
+					}
+				});
+			if (!Session.bAdaptersBusy)
+			{
+				Session.AdaptersRetryTime = TimeNow + BlueZRetryDelay;
+				TimeNext = std::min(TimeNext, Session.AdaptersRetryTime);
+			}
+		}
+	}
+	for (auto& Adapter : Session.Adapters)
+	{
+		if (Session.bStopping)
+		{
+			if (Adapter->Step == BlueZAdapterStep::Scanning)
+			{
+				Adapter->Step = BlueZAdapterStep::StopScanning;
+				Adapter->RetryTime = TimeNow;
+			}
+			else if (!Adapter->bBusy && ((Adapter->Step == BlueZAdapterStep::PowerOn) || (Adapter->Step == BlueZAdapterStep::RegisterMonitor) || (Adapter->Step == BlueZAdapterStep::SetFilter) || (Adapter->Step == BlueZAdapterStep::StartDiscovery)))
+				Adapter->Step = BlueZAdapterStep::Finished; // never started scanning, so there's nothing to undo
+		}
+		if (Adapter->bBusy || (Adapter->Step == BlueZAdapterStep::Scanning) || (Adapter->Step == BlueZAdapterStep::Finished))
+			continue;
+		if (TimeNow < Adapter->RetryTime)
+		{
+			TimeNext = std::min(TimeNext, Adapter->RetryTime);
+			continue;
+		}
+		std::shared_ptr<BlueZAdapterSession> pAdapter(Adapter);
+		DBusReplyHandler Handler = [pSession, pAdapter](DBusMessage* dbus_reply) { bluez_adapter_result(*pSession, *pAdapter, dbus_reply != nullptr); };
+		switch (Adapter->Step)
+		{
+		case BlueZAdapterStep::PowerOn:
+			Adapter->bBusy = bluez_power_on(Session.dbus_conn, Adapter->Path.c_str(), Handler);
+			break;
+		case BlueZAdapterStep::RegisterMonitor:
+			Adapter->bBusy = bluez_register_monitor(Session.dbus_conn, Adapter->Path.c_str(), Handler);
+			break;
+		case BlueZAdapterStep::SetFilter:
+			Adapter->bBusy = bluez_filter_le(Session.dbus_conn, Adapter->Path.c_str(), Handler);
+			break;
+		case BlueZAdapterStep::StartDiscovery:
+			Adapter->bBusy = bluez_discovery(Session.dbus_conn, Adapter->Path.c_str(), Handler, true);
+			break;
+		case BlueZAdapterStep::StopScanning:
+			if (Adapter->bMonitor)
+				Adapter->bBusy = bluez_register_monitor(Session.dbus_conn, Adapter->Path.c_str(), Handler, false);
+			else
+				Adapter->bBusy = bluez_discovery(Session.dbus_conn, Adapter->Path.c_str(), Handler, false);
+			break;
+		default:
+			break;
+		}
+		if (!Adapter->bBusy)
+		{
+			bluez_adapter_result(Session, *Adapter, false); // the call couldn't even be sent
+			TimeNext = TimeNow;
+		}
+	}
+	std::set<std::string> ScanningAdapters;
+	for (auto& Adapter : Session.Adapters)
+		if (!Session.bStopping && (Adapter->Step == BlueZAdapterStep::Scanning))
+			ScanningAdapters.insert(Adapter->Path);
+	if (ScanningAdapters != Session.ScanningAdapters)
 	{
-		// TODO: convert dbus_msg_Path to dbusBTAddress using regex
-		const std::string dbus_msg_Path(dbus_message_get_path(dbus_msg)); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga18adf731bb42d324fe2624407319e4af
-		std::string BluetoothAddress;
-		const std::regex BluetoothAddressRegex("((([[:xdigit:]]{2}_){5}))[[:xdigit:]]{2}");
-		std::smatch AddressMatch;
-		if (std::regex_search(dbus_msg_Path, AddressMatch, BluetoothAddressRegex))
+		std::set<std::string> DesiredMatchRules;
+		for (auto& AdapterPath : ScanningAdapters)
 		{
-			BluetoothAddress = AddressMatch.str();
-			std::replace(BluetoothAddress.begin(), BluetoothAddress.end(), '_', ':');
-			dbusBTAddress = string2ba(BluetoothAddress);
+			const std::set<std::string> AdapterMatchRules(bluez_match_rules(AdapterPath));
+			DesiredMatchRules.insert(AdapterMatchRules.begin(), AdapterMatchRules.end());
 		}
-		DBusMessageIter root_iter;
-		std::string root_object_path;
-		dbus_message_iter_init(dbus_msg, &root_iter);
-		DBusBasicValue value;
-		dbus_message_iter_get_basic(&root_iter, &value);
-		root_object_path = std::string(value.str);
-		dbus_message_iter_next(&root_iter);
-		DBusMessageIter array_iter;
-		dbus_message_iter_recurse(&root_iter, &array_iter);
-		ssOutput << bluez_dbus_msg_iter(array_iter, dbusBTAddress);
+		bluez_update_match_rules(Session.dbus_conn, Session.MatchRules, DesiredMatchRules);
+		Session.ScanningAdapters = ScanningAdapters;
 	}
-	if (ConsoleVerbosity > 1)
-		std::cout << ssOutput.str();
+	return(TimeNext);
 }
-void bluez_dbus_RemoveKnownDevices(DBusConnection* dbus_conn, const char* adapter_path, const std::map<bdaddr_t, std::string>& KnownDevices)
+// True once every adapter has been torn down and no replies are outstanding.
+bool bluez_session_finished(const BlueZSession& Session)
 {
-	// This link helped figure out how to remove a device
-	// https://www.linumiz.com/bluetooth-removedevice-to-remove-the-device/
-	// https://www.mankier.com/5/org.bluez.Adapter#Interface-void_RemoveDevice(object_device)
+	bool rval(Session.bStopping && !Session.bAdaptersBusy && (DBusPendingCalls == 0));
+	for (auto& Adapter : Session.Adapters)
+		if (Adapter->Step != BlueZAdapterStep::Finished)
+			rval = false;
+	return(rval);
+}
+/////////////////////////////////////////////////////////////////////////////
+// The receive thread owns the D-Bus connection and reconnects to BlueZ every 24 hours.
+// It only queues the raw advertisements, all decoding and file I/O is left to the processing thread.
+std::atomic<bool> bReceiveThreadRunning(false);
+void BlueZReceiveThread(const std::set<bdaddr_t> ControllerAddresses)
+{
+	time_t TimeStart(0);
 	std::ostringstream ssOutput;
-	std::queue<std::string> ObjectsToDelete;
-	DBusMessage* dbus_msg = dbus_message_new_method_call("org.bluez", "/", "org.freedesktop.DBus.ObjectManager", "GetManagedObjects");
-	if (dbus_msg)
+	while (bRun)
 	{
-		// Initialize D-Bus error
+		time(&TimeStart);
 		DBusError dbus_error;
 		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-		DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_USE_DEFAULT, &dbus_error);
-		dbus_message_unref(dbus_msg);
-		if (dbus_reply)
+
+		// Connect to the system bus
+		DBusConnection* dbus_conn = dbus_bus_get_private(DBUS_BUS_SYSTEM, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga77ba5250adb84620f16007e1b023cf26
+		if (dbus_error_is_set(&dbus_error)) // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#gab0ed62e9fc2685897eb2d41467c89405
 		{
-			if (dbus_message_get_type(dbus_reply) == DBUS_MESSAGE_TYPE_METHOD_RETURN)
-			{
-				const std::string dbus_reply_Signature(dbus_message_get_signature(dbus_reply));
-				int indent(16);
-				if (!dbus_reply_Signature.compare("a{oa{sa{sv}}}"))
-				{
-					DBusMessageIter root_iter;
-					dbus_message_iter_init(dbus_reply, &root_iter);
-					do {
-						DBusMessageIter array1_iter;
-						dbus_message_iter_recurse(&root_iter, &array1_iter);
-						do {
-							indent += 4;
-							DBusMessageIter dict1_iter;
-							dbus_message_iter_recurse(&array1_iter, &dict1_iter);
-							DBusBasicValue value;
-							dbus_message_iter_get_basic(&dict1_iter, &value);
-							std::string dict1_object_path(value.str);
-							dbus_message_iter_next(&dict1_iter);
-							DBusMessageIter array2_iter;
-							dbus_message_iter_recurse(&dict1_iter, &array2_iter);
-							do
-							{
-								DBusMessageIter dict2_iter;
-								dbus_message_iter_recurse(&array2_iter, &dict2_iter);
-								dbus_message_iter_get_basic(&dict2_iter, &value);
-								std::string dict2_string(value.str);
-								if (!dict2_string.compare("org.bluez.Device1"))
-								{
-									dbus_message_iter_next(&dict2_iter);
-									DBusMessageIter array3_iter;
-									dbus_message_iter_recurse(&dict2_iter, &array3_iter);
-									const std::regex ModifiedBluetoothAddressRegex("((([[:xdigit:]]{2}_){5}))[[:xdigit:]]{2}");
-									std::smatch AddressMatch;
-									if (std::regex_search(dict1_object_path, AddressMatch, ModifiedBluetoothAddressRegex))
-									{
-										std::string BluetoothAddress(AddressMatch.str());
-										std::replace(BluetoothAddress.begin(), BluetoothAddress.end(), '_', ':');
-										bdaddr_t localBTAddress(string2ba(BluetoothAddress));
-										auto BT_Device = KnownDevices.find(localBTAddress);
-										if (BT_Device != KnownDevices.end())
-											ObjectsToDelete.push(dict1_object_path);
-									}
-								}
-							} while (dbus_message_iter_next(&array2_iter));
-							indent -= 4;
-						} while (dbus_message_iter_next(&array1_iter));
-					} while (dbus_message_iter_next(&root_iter));
-				}
-			}
-			dbus_message_unref(dbus_reply);
+			if (ConsoleVerbosity > 0)
+				ssOutput << "[" << getTimeISO8601(true) << "] ";
+			ssOutput << "Error connecting to the D-Bus system bus: " << dbus_error.message;
+			dbus_error_free(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#gaac6c14ead14829ee4e090f39de6a7568
+			if (ConsoleVerbosity > 0)
+				std::cout << ssOutput.str() << std::endl;
+			else
+				std::cerr << ssOutput.str() << std::endl;
+			ssOutput = std::ostringstream(); // reinitialize my output stringstream
 		}
-		dbus_error_free(&dbus_error);
-	}
-	while (!ObjectsToDelete.empty())
-	{
-		dbus_msg = dbus_message_new_method_call("org.bluez", adapter_path, "org.bluez.Adapter1", "RemoveDevice");
-		if (dbus_msg)
+		else
 		{
-			DBusMessageIter iterParameter;
-			dbus_message_iter_init_append(dbus_msg, &iterParameter); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf733047c467ce21f4a53b65a388f1e9d
-			const char* Object = ObjectsToDelete.front().c_str();
-			dbus_message_iter_append_basic(&iterParameter, DBUS_TYPE_OBJECT_PATH, &Object); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#ga17491f3b75b3203f6fc47dcc2e3b221b
-			// Initialize D-Bus error
-			DBusError dbus_error;
-			dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-			DBusMessage* dbus_reply = dbus_connection_send_with_reply_and_block(dbus_conn, dbus_msg, DBUS_TIMEOUT_USE_DEFAULT, &dbus_error);
 			if (ConsoleVerbosity > 0)
-				ssOutput << "[                   ] ";
-			ssOutput << dbus_message_get_path(dbus_msg) << ": " << dbus_message_get_interface(dbus_msg) << ": " << dbus_message_get_member(dbus_msg) << " " << ObjectsToDelete.front();
-			if (dbus_error_is_set(&dbus_error))
+				ssOutput << "[" << getTimeISO8601(true) << "] ";
+			ssOutput << "D-Bus connection \"" << dbus_bus_get_unique_name(dbus_conn) << "\" Opened"; // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga8c10339a1e62f6a2e5752d9c2270d37b
+			if (ConsoleVerbosity > 0)
+				std::cout << ssOutput.str() << std::endl;
+			else
+				std::cerr << ssOutput.str() << std::endl;
+			ssOutput = std::ostringstream(); // reinitialize my output stringstream
+			DBusEventLoop DBusLoop;
+			if (!dbus_event_loop_init(dbus_conn, DBusLoop))
 			{
-				std::string error(dbus_error.message);
-				for (auto pos = error.find('\r'); pos != std::string::npos; pos = error.find('\r'))
-					error.erase(pos, 1);
-				for (auto pos = error.find('\n'); pos != std::string::npos; pos = error.find('\n'))
-					error.erase(pos, 1);
-				ssOutput << " (" << error << ")";
+				if (ConsoleVerbosity > 0)
+					ssOutput << "[" << getTimeISO8601(true) << "] ";
+				ssOutput << "Error setting up D-Bus event loop: " << strerror(errno);
+				if (ConsoleVerbosity > 0)
+					std::cout << ssOutput.str() << std::endl;
+				else
+					std::cerr << ssOutput.str() << std::endl;
+				ssOutput = std::ostringstream(); // reinitialize my output stringstream
+				bRun = false;
 			}
-			ssOutput << std::endl;
-			dbus_error_free(&dbus_error);
-			dbus_message_unref(dbus_msg);
+			else if (!dbus_event_loop_add_fd(DBusLoop, ShutdownEvent, [] { uint64_t count; if (sizeof(count) != read(ShutdownEvent, &count, sizeof(count))) count = 0; }))
+				bRun = false;
+			else if (!dbus_event_loop_add_fd(DBusLoop, VictronEncryptionKeysEvent, [] { uint64_t count; if (sizeof(count) != read(VictronEncryptionKeysEvent, &count, sizeof(count))) count = 0; }))
+				bRun = false;
+			if (bRun)
+			{
+				// Everything from here on is driven by the event loop, so advertisements are received while adapters are set up and torn down
+				dbus_connection_add_filter(dbus_conn, bluez_dbus_signal_filter, nullptr, nullptr);
+				BlueZSession Session;
+				Session.dbus_conn = dbus_conn;
+				Session.ControllerAddresses = ControllerAddresses;
+				if (bMonitorMode)
+				{
+					dbus_error_init(&dbus_error);
+					Session.bMonitor = dbus_connection_try_register_fallback(dbus_conn, BlueZMonitorAppPath, &BlueZMonitorVTable, nullptr, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html
+					if (dbus_error_is_set(&dbus_error))
+					{
+						if (ConsoleVerbosity > 0)
+							ssOutput << "[" << getTimeISO8601(true) << "] ";
+						ssOutput << "Error exporting advertisement monitor: " << dbus_error.message;
+						dbus_error_free(&dbus_error);
+						if (ConsoleVerbosity > 0)
+							std::cout << ssOutput.str() << std::endl;
+						else
+							std::cerr << ssOutput.str() << std::endl;
+						ssOutput = std::ostringstream(); // reinitialize my output stringstream
+					}
+				}
+	#ifdef DEBUG
+				const time_t ReconnectSeconds(30); // Maintain DBus connection for no more than 30 seconds
+	#else
+				const time_t ReconnectSeconds(60 * 60 * 24); // Maintain DBus connection for no more than 24 hours
+	#endif // DEBUG
+				auto TeardownDeadline(std::chrono::steady_clock::now());
+				bool bConnected(true);
+				while (bConnected && !(Session.bStopping && (bluez_session_finished(Session) || (std::chrono::steady_clock::now() > TeardownDeadline))))
+				{
+					time_t TimeNow;
+					time(&TimeNow);
+					if (!Session.bStopping && (!bRun || (difftime(TimeNow, TimeStart) >= ReconnectSeconds)))
+					{
+						Session.bStopping = true;
+						TeardownDeadline = std::chrono::steady_clock::now() + BlueZTeardownTimeout;
+					}
+					if (bluez_refresh_keys())
+					{
+						Session.ScanningAdapters.clear(); // the match rules are rebuilt for the new keys on this step
+						if (ConsoleVerbosity > 0)
+							std::cout << "[" << getTimeISO8601(true) << "] Listening for " << BlueZEncryptionKeys->size() << " devices" << std::endl;
+					}
+					auto TimeNext(bluez_session_step(Session));
+					if (Session.bStopping)
+					{
+						if (bluez_session_finished(Session))
+							continue;
+						TimeNext = std::min(TimeNext, TeardownDeadline);
+					}
+					else
+						TimeNext = std::min(TimeNext, std::chrono::steady_clock::now() + std::chrono::seconds(std::max(time_t(0), TimeStart + ReconnectSeconds - TimeNow)));
+					// Sleep until D-Bus needs attention, a retry is due, or it is time to reconnect
+					const int WaitMilliseconds(int(std::max(std::chrono::milliseconds::zero(), std::chrono::duration_cast<std::chrono::milliseconds>(TimeNext - std::chrono::steady_clock::now())).count()));
+					if (!dbus_event_loop_iterate(dbus_conn, DBusLoop, WaitMilliseconds))
+					{
+						time(&TimeNow);
+						if (ConsoleVerbosity > 0)
+							ssOutput << "[" << timeToISO8601(TimeNow, true) << "] ";
+						ssOutput << "D-Bus connection Closed";
+						if (ConsoleVerbosity > 0)
+							std::cout << ssOutput.str() << std::endl;
+						else
+							std::cerr << ssOutput.str() << std::endl;
+						ssOutput = std::ostringstream(); // reinitialize my output stringstream
+						bRun = false;
+						bConnected = false;
+					}
+				}
+				if (Session.bMonitor)
+					dbus_connection_unregister_object_path(dbus_conn, BlueZMonitorAppPath);
+				dbus_connection_remove_filter(dbus_conn, bluez_dbus_signal_filter, nullptr);
+			}
+			if (ConsoleVerbosity > 0)
+				ssOutput << "[" << getTimeISO8601(true) << "] ";
+			ssOutput << "D-Bus connection \"" << dbus_bus_get_unique_name(dbus_conn) << "\" Closed"; // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga8c10339a1e62f6a2e5752d9c2270d37b
+			if (ConsoleVerbosity > 0)
+				std::cout << ssOutput.str() << std::endl;
+			else
+				std::cerr << ssOutput.str() << std::endl;
+			ssOutput = std::ostringstream(); // reinitialize my output stringstream
+			dbus_connection_close(dbus_conn);	// https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga2522ac5075dfe0a1535471f6e045e1ee
+			dbus_connection_unref(dbus_conn);	// https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga6385ff09bc108238c4429e7c195dab25
+			if (DBusLoop.epoll_fd >= 0)
+				close(DBusLoop.epoll_fd);	// closing the connection above removes all watches, so the epoll descriptor is no longer needed
 		}
-		ObjectsToDelete.pop();
 	}
-	if (ConsoleVerbosity > 0)
-		std::cout << ssOutput.str();
-	else
-		std::cerr << ssOutput.str();
+	bReceiveThreadRunning = false;
+	const uint64_t one(1);
+	if (sizeof(one) != write(VictronFrameEvent, &one, sizeof(one))) // wake the processing thread so it notices we are done
+		std::cerr << "Error waking processing thread: " << strerror(errno) << std::endl;
 }
 /////////////////////////////////////////////////////////////////////////////
 static void usage(int argc, char** argv)
@@ -2498,10 +5410,19 @@ static void usage(int argc, char** argv)
 	std::cout << "    -l | --log name      Logging Directory [" << LogDirectory << "]" << std::endl;
 	std::cout << "    -f | --cache name    cache file directory [" << CacheDirectory << "]" << std::endl;
 	std::cout << "    -s | --svg name      SVG output directory [" << SVGDirectory << "]" << std::endl;
-	std::cout << "    -C | --controller XX:XX:XX:XX:XX:XX use the controller with this address" << std::endl;
+	std::cout << "    -C | --controller XX:XX:XX:XX:XX:XX use the controller with this address, may be repeated [all controllers]" << std::endl;
+	std::cout << "    -q | --queue size    receive queue size in advertisements [" << VictronFrameQueueSize << "]" << std::endl;
+	std::cout << "    -i | --interval seconds minimum seconds between stored records per device [" << VictronMinimumInterval << "]" << std::endl;
+	std::cout << "    -c | --keystream kilobytes keystream cache size, zero to turn it off [" << VictronKeyStreamBudget / 1024 << "]" << std::endl;
+	std::cout << "    -m | --monitor       let the controller filter for Victron advertisements, falls back to discovery if unavailable" << std::endl;
+	std::cout << "    -D | --discover      also show devices that aren't in the key file on the console" << std::endl;
+	std::cout << "    -b | --binary        write log files as binary records (.bin) instead of text (.txt), both are read" << std::endl;
+	std::cout << "    -r | --repair name   cut the damaged end off a log file, or every log file in a directory, then exit, may be repeated" << std::endl;
+	std::cout << "    -d | --durability none|batch|seconds fdatasync log files never, after every write, or at most this often [none]" << std::endl;
+	std::cout << "    -x | --convert name  convert a log file, or every log file in a directory, between text and binary then exit, may be repeated" << std::endl;
 	std::cout << std::endl;
 }
-static const char short_options[] = "hv:k:l:f:s:C:";
+static const char short_options[] = "hv:k:l:f:s:C:q:i:c:mDbx:r:d:";
 static const struct option long_options[] = {
 		{ "help",   no_argument,       NULL, 'h' },
 		{ "verbose",required_argument, NULL, 'v' },
@@ -2510,11 +5431,22 @@ static const struct option long_options[] = {
 		{ "cache",	required_argument, NULL, 'f' },
 		{ "svg",	required_argument, NULL, 's' },
 		{ "controller", required_argument, NULL, 'C' },
+		{ "queue",	required_argument, NULL, 'q' },
+		{ "interval",	required_argument, NULL, 'i' },
+		{ "keystream",	required_argument, NULL, 'c' },
+		{ "monitor",	no_argument,       NULL, 'm' },
+		{ "discover",	no_argument,       NULL, 'D' },
+		{ "binary",	no_argument,       NULL, 'b' },
+		{ "convert",	required_argument, NULL, 'x' },
+		{ "repair",	required_argument, NULL, 'r' },
+		{ "durability",	required_argument, NULL, 'd' },
 		{ 0, 0, 0, 0 }
 };
 int main(int argc, char** argv) 
 {
-	std::string ControllerAddress;
+	std::set<bdaddr_t> ControllerAddresses;
+	std::deque<std::filesystem::path> ConvertPaths;
+	std::deque<std::filesystem::path> RepairPaths;
 	for (;;)
 	{
 		std::filesystem::path TempPath;
@@ -2562,7 +5494,57 @@ int main(int argc, char** argv)
 				SVGDirectory = TempPath;
 			break;
 		case 'C':	// --controller
-			ControllerAddress = std::string(optarg);
+			ControllerAddresses.insert(string2ba(optarg));
+			break;
+		case 'q':	// --queue
+			try { VictronFrameQueueSize = std::stoul(optarg); }
+			catch (const std::invalid_argument& ia) { std::cerr << "Invalid argument: " << ia.what() << std::endl; exit(EXIT_FAILURE); }
+			catch (const std::out_of_range& oor) { std::cerr << "Out of Range error: " << oor.what() << std::endl; exit(EXIT_FAILURE); }
+			if (VictronFrameQueueSize < 2)
+				VictronFrameQueueSize = 2;
+			break;
+		case 'i':	// --interval
+			try { VictronMinimumInterval = std::stoi(optarg); }
+			catch (const std::invalid_argument& ia) { std::cerr << "Invalid argument: " << ia.what() << std::endl; exit(EXIT_FAILURE); }
+			catch (const std::out_of_range& oor) { std::cerr << "Out of Range error: " << oor.what() << std::endl; exit(EXIT_FAILURE); }
+			break;
+		case 'c':	// --keystream
+			try { VictronKeyStreamBudget = std::stoul(optarg) * 1024; }
+			catch (const std::invalid_argument& ia) { std::cerr << "Invalid argument: " << ia.what() << std::endl; exit(EXIT_FAILURE); }
+			catch (const std::out_of_range& oor) { std::cerr << "Out of Range error: " << oor.what() << std::endl; exit(EXIT_FAILURE); }
+			break;
+		case 'm':	// --monitor
+			bMonitorMode = true;
+			break;
+		case 'D':	// --discover
+			bDiscoverMode = true;
+			break;
+		case 'b':	// --binary
+			VictronBinaryLog = true;
+			break;
+		case 'x':	// --convert
+			ConvertPaths.push_back(std::filesystem::path(optarg));
+			break;
+		case 'r':	// --repair
+			RepairPaths.push_back(std::filesystem::path(optarg));
+			break;
+		case 'd':	// --durability
+			if (0 == strcmp(optarg, "none"))
+				VictronLogDurability = LogDurability::none;
+			else if (0 == strcmp(optarg, "batch"))
+				VictronLogDurability = LogDurability::batch;
+			else
+			{
+				try { VictronLogSyncInterval = std::stol(optarg); }
+				catch (const std::invalid_argument& ia) { std::cerr << "Invalid argument: " << ia.what() << std::endl; exit(EXIT_FAILURE); }
+				catch (const std::out_of_range& oor) { std::cerr << "Out of Range error: " << oor.what() << std::endl; exit(EXIT_FAILURE); }
+				if (VictronLogSyncInterval < 1)
+				{
+					std::cerr << "Invalid durability: " << optarg << std::endl;
+					exit(EXIT_FAILURE);
+				}
+				VictronLogDurability = LogDurability::interval;
+			}
 			break;
 		default:
 			usage(argc, argv);
@@ -2575,6 +5557,49 @@ int main(int argc, char** argv)
 	else
 		std::cerr << ProgramVersionString << "  (starting)" << std::endl;
 
+	HexSelfTest();
+	Crc32cSelfTest();
+
+	if (!RepairPaths.empty() || !ConvertPaths.empty())
+	{
+		int ExitCode(EXIT_SUCCESS);
+		// A directory stands for every log file in it. Files named on their own must be named like a log file too, so a key file or a cache file can't be cut short by mistake.
+		auto LogFiles = [&ExitCode](const std::deque<std::filesystem::path>& Paths) {
+			std::deque<std::filesystem::path> rval;
+			for (auto& ThePath : Paths)
+			{
+				std::deque<std::filesystem::path> files;
+				if (std::filesystem::is_directory(ThePath))
+				{
+					for (auto const& dir_entry : std::filesystem::directory_iterator{ ThePath })
+						if (dir_entry.is_regular_file())
+							if (std::regex_match(dir_entry.path().filename().string(), LogFileRegex))
+								files.push_back(dir_entry);
+					sort(files.begin(), files.end());
+				}
+				else if (std::regex_match(ThePath.filename().string(), LogFileRegex))
+					files.push_back(ThePath);
+				else
+				{
+					if (ConsoleVerbosity > 0)
+						std::cout << "[" << getTimeISO8601(true) << "] Not a log file name, leaving it alone: " << ThePath.string() << std::endl;
+					else
+						std::cerr << "Not a log file name, leaving it alone: " << ThePath.string() << std::endl;
+					ExitCode = EXIT_FAILURE;
+				}
+				rval.insert(rval.end(), files.begin(), files.end());
+			}
+			return(rval);
+		};
+		for (auto& filename : LogFiles(RepairPaths)) // before converting, so a converted copy starts out clean
+			if (!RepairLogFile(filename))
+				ExitCode = EXIT_FAILURE;
+		for (auto& filename : LogFiles(ConvertPaths))
+			if (!ConvertLogFile(filename))
+				ExitCode = EXIT_FAILURE;
+		exit(ExitCode);
+	}
+
 	if (!SVGDirectory.empty())
 	{
 		//if (SVGTitleMapFilename.empty()) // If this wasn't set as a parameter, look in the SVG Directory for a default titlemap
@@ -2582,12 +5607,20 @@ int main(int argc, char** argv)
 		//ReadTitleMap(SVGTitleMapFilename);
 		ReadCacheDirectory(); // if cache directory is configured, read it before reading all the normal logs
 		ReadLoggedData(); // only read the logged data if creating SVG files
-		GenerateCacheFile(VictronSmartLithiumMRTGLogs); // update cache files if any new data was in logs
+		GenerateCacheFile(); // update cache files if any new data was in logs
 	}
 
 	ReadVictronEncryptionKeys(VictronEncryptionKeyFilename);
+	VictronAESSelfTest();
+	if (ConsoleVerbosity > 0)
+		std::cout << "[" << getTimeISO8601(true) << "] Decrypting with " << AES128EncryptBlockName << std::endl;
+#ifdef VICTRON_BENCHMARK
+	// The benchmark build only measures, the self tests above have printed theirs
+	VictronAdvertisementBenchmark();
+	exit(EXIT_SUCCESS);
+#endif // VICTRON_BENCHMARK
 
-	if (VictronEncryptionKeys.empty())
+	if (VictronEncryptionKeys->empty())
 	{
 		if (ConsoleVerbosity > 0)
 			std::cout << "[" << getTimeISO8601(true) << "] No Victron Encryption Keys Found! Exiting." << std::endl;
@@ -2596,196 +5629,146 @@ int main(int argc, char** argv)
 		exit(EXIT_FAILURE);
 	}
 
+	VictronFrameQueue = std::make_unique<SPSCRingBuffer<VictronRawFrame>>(VictronFrameQueueSize);
+	VictronFrameEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	ShutdownEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	VictronEncryptionKeysEvent = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ((VictronFrameEvent < 0) || (ShutdownEvent < 0) || (VictronEncryptionKeysEvent < 0))
+	{
+		std::cerr << "Error creating eventfd: " << strerror(errno) << std::endl;
+		exit(EXIT_FAILURE);
+	}
+	// Watch the directory rather than the file, editors usually save by writing a new file and renaming it over the old one
+	std::filesystem::path KeyFileDirectory(VictronEncryptionKeyFilename.parent_path());
+	if (KeyFileDirectory.empty())
+		KeyFileDirectory = ".";
+	int KeyFileWatch(inotify_init1(IN_CLOEXEC | IN_NONBLOCK)); // https://man7.org/linux/man-pages/man7/inotify.7.html
+	if ((KeyFileWatch >= 0) && (0 > inotify_add_watch(KeyFileWatch, KeyFileDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO)))
+	{
+		close(KeyFileWatch);
+		KeyFileWatch = -1;
+	}
+	if (KeyFileWatch < 0)
+	{
+		if (ConsoleVerbosity > 0)
+			std::cout << "[" << getTimeISO8601(true) << "] Not watching " << VictronEncryptionKeyFilename << " for changes: " << strerror(errno) << std::endl;
+		else
+			std::cerr << "Not watching " << VictronEncryptionKeyFilename << " for changes: " << strerror(errno) << std::endl;
+	}
+
 	// Set up CTR-C signal handler
 	typedef void(*SignalHandlerPointer)(int);
 	SignalHandlerPointer previousHandlerSIGINT = std::signal(SIGINT, SignalHandlerSIGINT);	// Install CTR-C signal handler
 	SignalHandlerPointer previousHandlerSIGHUP = std::signal(SIGHUP, SignalHandlerSIGHUP);	// Install Hangup signal handler
 
-	time_t TimeStart(0), TimeLog(0), TimeSVG(0);
-	std::ostringstream ssOutput;
-	// Main loop
+	// The receive thread owns the D-Bus connection, this thread decodes what it receives and writes the cache and svg files, the log writer thread appends the log files
 	bRun = true;
-	while (bRun)
+	bReceiveThreadRunning = true;
+	std::thread ReceiveThread(BlueZReceiveThread, ControllerAddresses);
+	std::thread LogWriterThread(VictronLogWriterThread);
+	const int LogFileTime(60);
+	time_t TimeNow(0), TimeLog(0), TimeSVG(0);
+	size_t FramesDropped(0);
+	while (bReceiveThreadRunning || (VictronFrameQueue->Size() > 0))
 	{
-		time(&TimeStart);
-		DBusError dbus_error;
-		dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-
-		// Connect to the system bus
-		DBusConnection* dbus_conn = dbus_bus_get_private(DBUS_BUS_SYSTEM, &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga77ba5250adb84620f16007e1b023cf26
-		if (dbus_error_is_set(&dbus_error)) // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#gab0ed62e9fc2685897eb2d41467c89405
-		{
-			if (ConsoleVerbosity > 0)
-				ssOutput << "[" << getTimeISO8601(true) << "] ";
-			ssOutput << "Error connecting to the D-Bus system bus: " << dbus_error.message;
-			dbus_error_free(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#gaac6c14ead14829ee4e090f39de6a7568
-			if (ConsoleVerbosity > 0)
-				std::cout << ssOutput.str() << std::endl;
-			else
-				std::cerr << ssOutput.str() << std::endl;
-			ssOutput = std::ostringstream(); // reinitialize my output stringstream
-		}
-		else
+		// Sleep until frames are queued or until the next time we have file work to do
+		time(&TimeNow);
+		time_t TimeNext(TimeLog + LogFileTime + 1);
+		if (!SVGDirectory.empty())
+			TimeNext = std::min(TimeNext, time_t(TimeSVG + DAY_SAMPLE + 1));
+		struct pollfd FramePoll[2] = { { VictronFrameEvent, POLLIN, 0 }, { KeyFileWatch, POLLIN, 0 } }; // poll ignores the watch if it is -1
+		if (0 < poll(FramePoll, 2, int(std::max(time_t(0), TimeNext - TimeNow) * 1000)))
 		{
-			if (ConsoleVerbosity > 0)
-				ssOutput << "[" << getTimeISO8601(true) << "] ";
-			ssOutput << "D-Bus connection \"" << dbus_bus_get_unique_name(dbus_conn) << "\" Opened"; // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga8c10339a1e62f6a2e5752d9c2270d37b
-			if (ConsoleVerbosity > 0)
-				std::cout << ssOutput.str() << std::endl;
-			else
-				std::cerr << ssOutput.str() << std::endl;
-			ssOutput = std::ostringstream(); // reinitialize my output stringstream
-			std::map<bdaddr_t, std::string> BlueZAdapterMap;
-			bool bUse_HCI_Interface = !bluez_find_adapters(dbus_conn, BlueZAdapterMap);
-			if (bUse_HCI_Interface && BlueZAdapterMap.empty())
-			{
-				if (ConsoleVerbosity > 0)
-					ssOutput << "[" << getTimeISO8601(true) << "] ";
-				ssOutput << "Could not get list of adapters from BlueZ over DBus. Reverting to HCI interface.";
-				if (ConsoleVerbosity > 0)
-					std::cout << ssOutput.str() << std::endl;
-				else
-					std::cerr << ssOutput.str() << std::endl;
-				ssOutput = std::ostringstream(); // reinitialize my output stringstream
-			}
-			if (!BlueZAdapterMap.empty())
+			uint64_t FrameEventCount;
+			if ((FramePoll[0].revents & POLLIN) && (sizeof(FrameEventCount) != read(VictronFrameEvent, &FrameEventCount, sizeof(FrameEventCount))))
+				FrameEventCount = 0;
+			if (FramePoll[1].revents & POLLIN)
 			{
-				std::string BlueZAdapter(BlueZAdapterMap.cbegin()->second);
-				if (!ControllerAddress.empty())
-					if (auto search = BlueZAdapterMap.find(string2ba(ControllerAddress)); search != BlueZAdapterMap.end())
-						BlueZAdapter = search->second;
-
-				if (bluez_power_on(dbus_conn, BlueZAdapter.c_str()))
-				{
-					bluez_filter_le(dbus_conn, BlueZAdapter.c_str());
-					bluez_dbus_FindExistingDevices(dbus_conn); // This pulls data from BlueZ on devices that BlueZ is already keeping track of
-					if (bluez_discovery(dbus_conn, BlueZAdapter.c_str(), true))
+				bool bKeyFileChanged(false);
+				alignas(struct inotify_event) char Events[4096];
+				for (ssize_t EventsLength = read(KeyFileWatch, Events, sizeof(Events)); EventsLength > 0; EventsLength = read(KeyFileWatch, Events, sizeof(Events)))
+					for (ssize_t offset = 0; offset < EventsLength; offset += sizeof(struct inotify_event) + reinterpret_cast<const struct inotify_event*>(Events + offset)->len)
 					{
-						dbus_connection_flush(dbus_conn); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga10e68d9d2f41d655a4151ddeb807ff54
-						std::vector<std::string> MatchRules;
-						MatchRules.push_back("type='signal',sender='org.bluez',member='InterfacesAdded'");
-						MatchRules.push_back("type='signal',sender='org.bluez',member='PropertiesChanged'");
-						for (auto& MatchRule : MatchRules)
-						{
-							if (ConsoleVerbosity > 0)
-								ssOutput << "[                   ] ";
-							ssOutput << "Add Match Rule: \"" << MatchRule << "\"";
-							bool MatchRuleError(false);
-							dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-							dbus_bus_add_match(dbus_conn, MatchRule.c_str(), &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga4eb6401ba014da3dbe3dc4e2a8e5b3ef
-							if (dbus_error_is_set(&dbus_error))
-							{
-								ssOutput << " Error: " << dbus_error.message;
-								dbus_error_free(&dbus_error);
-								MatchRuleError = true;
-							}
-							if (ConsoleVerbosity > 1)
-								std::cout << ssOutput.str() << std::endl;
-							else if (MatchRuleError)
-								std::cerr << ssOutput.str() << std::endl;
-							ssOutput = std::ostringstream(); // reinitialize my output stringstream
-						}
-						time_t TimeNow(0);
-						do
-						{
-							// Wait for access to the D-Bus
-							if (!dbus_connection_read_write(dbus_conn, 1000)) // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga371163b4955a6e0bf0f1f70f38390c14
-							{
-								time(&TimeNow);
-								if (ConsoleVerbosity > 0)
-									ssOutput << "[" << timeToISO8601(TimeNow, true) << "] ";
-								ssOutput << "D-Bus connection Closed";
-								if (ConsoleVerbosity > 0)
-									std::cout << ssOutput.str() << std::endl;
-								else
-									std::cerr << ssOutput.str() << std::endl;
-								ssOutput = std::ostringstream(); // reinitialize my output stringstream
-								bRun = false;
-							}
-							else
-							{
-								time(&TimeNow);
-								// Pop first message on D-Bus connection
-								DBusMessage* dbus_msg = dbus_connection_pop_message(dbus_conn); // https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga1e40d994ea162ce767e78de1c4988566
-
-								// If there is nothing to receive we get a NULL
-								if (dbus_msg != nullptr)
-								{
-									if (DBUS_MESSAGE_TYPE_SIGNAL == dbus_message_get_type(dbus_msg))
-									{
-										const std::string dbus_msg_Member(dbus_message_get_member(dbus_msg)); // https://dbus.freedesktop.org/doc/api/html/group__DBusMessage.html#gaf5c6b705c53db07a5ae2c6b76f230cf9
-										bdaddr_t localBTAddress({ 0 });
-										if (!dbus_msg_Member.compare("InterfacesAdded"))
-											bluez_dbus_msg_InterfacesAdded(dbus_msg, localBTAddress);
-										else if (!dbus_msg_Member.compare("PropertiesChanged"))
-											bluez_dbus_msg_PropertiesChanged(dbus_msg, localBTAddress);
-									}
-									dbus_message_unref(dbus_msg); // Free the message
-								}
-							}
-							if ((!SVGDirectory.empty()) && (difftime(TimeNow, TimeSVG) > DAY_SAMPLE))
-							{
-								if (ConsoleVerbosity > 0)
-									std::cout << "[" << getTimeISO8601(true) << "] " << std::dec << DAY_SAMPLE << " seconds or more have passed. Writing SVG Files" << std::endl;
-								TimeSVG = (TimeNow / DAY_SAMPLE) * DAY_SAMPLE; // hack to try to line up TimeSVG to be on a five minute period
-								WriteAllSVG();
-							}
-							const int LogFileTime(60);
-							if (difftime(TimeNow, TimeLog) > LogFileTime)
-							{
-								if (ConsoleVerbosity > 0)
-									std::cout << "[" << getTimeISO8601(true) << "] " << std::dec << LogFileTime << " seconds or more have passed. Writing LOG Files" << std::endl;
-								TimeLog = TimeNow;
-								GenerateLogFile(VictronVirtualLog);
-								GenerateCacheFile(VictronSmartLithiumMRTGLogs); // flush FakeMRTG data to cache files
-								//GenerateCacheFile(VictronOrionXSMRTGLogs); // flush FakeMRTG data to cache files
-							}
-	#ifdef DEBUG
-						} while (bRun && difftime(TimeNow, TimeStart) < 30); // Maintain DBus connection for no more than 30 seconds
-	#else
-						} while (bRun && difftime(TimeNow, TimeStart) < (60 * 60 * 24));  // Maintain DBus connection for no more than 24 hours
-	#endif // DEBUG
-						for (auto& MatchRule : MatchRules)
-						{
-							if (ConsoleVerbosity > 0)
-								ssOutput << "[                   ] ";
-							ssOutput << "Remove Match Rule: \"" << MatchRule << "\"";
-							bool MatchRuleError(false);
-							dbus_error_init(&dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusErrors.html#ga8937f0b7cdf8554fa6305158ce453fbe
-							dbus_bus_remove_match(dbus_conn, MatchRule.c_str(), &dbus_error); // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga4eb6401ba014da3dbe3dc4e2a8e5b3ef
-							if (dbus_error_is_set(&dbus_error))
-							{
-								ssOutput << " Error: " << dbus_error.message;
-								dbus_error_free(&dbus_error);
-								MatchRuleError = true;
-							}
-							if (ConsoleVerbosity > 1)
-								std::cout << ssOutput.str() << std::endl;
-							else if (MatchRuleError)
-								std::cerr << ssOutput.str() << std::endl;
-							ssOutput = std::ostringstream(); // reinitialize my output stringstream
-						}
-						bluez_discovery(dbus_conn, BlueZAdapter.c_str(), false);
-						bluez_dbus_RemoveKnownDevices(dbus_conn, BlueZAdapter.c_str(), VictronEncryptionKeys);
-						//bluez_filter_le(dbus_conn, BlueZAdapter.c_str(), false, false); // remove discovery filter
+						const struct inotify_event* Event(reinterpret_cast<const struct inotify_event*>(Events + offset));
+						if ((Event->len > 0) && (VictronEncryptionKeyFilename.filename() == Event->name))
+							bKeyFileChanged = true;
 					}
-					else
-						bluez_power_on(dbus_conn, BlueZAdapter.c_str(), false);
+				if (bKeyFileChanged)
+				{
+					const size_t Generation(VictronEncryptionKeysGeneration);
+					ReadVictronEncryptionKeys(VictronEncryptionKeyFilename);
+					if (Generation != VictronEncryptionKeysGeneration)
+						RefreshVictronCiphers();
 				}
 			}
+		}
+		// Frames come off the queue in batches so that their decryption can be interleaved
+		VictronRawFrame Frames[VictronDecryptBatchMax];
+		uint8_t Plain[VictronDecryptBatchMax][VictronManufacturerDataMax];
+		const uint8_t* Payloads[VictronDecryptBatchMax];
+		size_t FrameCount(0);
+		do
+		{
+			FrameCount = 0;
+			while ((FrameCount < VictronDecryptBatchMax) && VictronFrameQueue->Pop(Frames[FrameCount]))
+				FrameCount++;
+			VictronDecryptFrames(Frames, FrameCount, Plain, Payloads);
+			for (size_t index = 0; index < FrameCount; index++)
+			{
+				std::string ssFrameOutput;
+				ProcessVictronFrame(Frames[index], Payloads[index], (ConsoleVerbosity > 1) ? &ssFrameOutput : nullptr);
+				if (!ssFrameOutput.empty())
+					std::cout << ssFrameOutput;
+			}
+		} while (FrameCount > 0);
+		VictronKeyStreamLookahead();
+		time(&TimeNow);
+		if ((!SVGDirectory.empty()) && (difftime(TimeNow, TimeSVG) > DAY_SAMPLE))
+		{
 			if (ConsoleVerbosity > 0)
-				ssOutput << "[" << getTimeISO8601(true) << "] ";
-			ssOutput << "D-Bus connection \"" << dbus_bus_get_unique_name(dbus_conn) << "\" Closed"; // https://dbus.freedesktop.org/doc/api/html/group__DBusBus.html#ga8c10339a1e62f6a2e5752d9c2270d37b
+				std::cout << "[" << getTimeISO8601(true) << "] " << std::dec << DAY_SAMPLE << " seconds or more have passed. Writing SVG Files" << std::endl;
+			TimeSVG = (TimeNow / DAY_SAMPLE) * DAY_SAMPLE; // hack to try to line up TimeSVG to be on a five minute period
+			WriteAllSVG();
+		}
+		if (difftime(TimeNow, TimeLog) > LogFileTime)
+		{
 			if (ConsoleVerbosity > 0)
-				std::cout << ssOutput.str() << std::endl;
-			else
-				std::cerr << ssOutput.str() << std::endl;
-			ssOutput = std::ostringstream(); // reinitialize my output stringstream
-			dbus_connection_close(dbus_conn);	// https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga2522ac5075dfe0a1535471f6e045e1ee
-			dbus_connection_unref(dbus_conn);	// https://dbus.freedesktop.org/doc/api/html/group__DBusConnection.html#ga6385ff09bc108238c4429e7c195dab25
+				std::cout << "[" << getTimeISO8601(true) << "] " << std::dec << LogFileTime << " seconds or more have passed. Writing LOG Files" << std::endl;
+			TimeLog = TimeNow;
+			GenerateLogFile(VictronVirtualLog);
+			GenerateCacheFile(); // flush FakeMRTG data to cache files
+			// Queue statistics, so --queue can be sized for the number of devices in range
+			if (ConsoleVerbosity > 0)
+				std::cout << "[" << getTimeISO8601(true) << "] Receive queue high water: " << std::dec << VictronFrameQueue->HighWater() << "/" << VictronFrameQueue->Capacity() << " dropped: " << VictronFrameQueue->Dropped() << " duplicates: " << VictronDuplicateFrames << " within interval: " << VictronIntervalFrames << " too long to log: " << VictronOversizeFrames << std::endl;
+			if ((ConsoleVerbosity > 0) && (VictronKeyStreamBudget > 0))
+				std::cout << "[                   ] Keystream cache hits: " << VictronKeyStreamHits << " misses: " << VictronKeyStreamMisses << std::endl;
+			if (ConsoleVerbosity > 0)
+			{
+				std::lock_guard<std::mutex> StatsLock(BlueZAdapterStatisticsMutex);
+				for (auto& [AdapterPath, Stats] : BlueZAdapterStatistics)
+					std::cout << "[                   ] " << AdapterPath << " received: " << Stats.Received << " unique: " << Stats.Unique << std::endl;
+			}
+			else if (VictronFrameQueue->Dropped() > FramesDropped)
+				std::cerr << "Receive queue full, dropped " << VictronFrameQueue->Dropped() - FramesDropped << " advertisements (high water: " << VictronFrameQueue->HighWater() << "/" << VictronFrameQueue->Capacity() << ")" << std::endl;
+			FramesDropped = VictronFrameQueue->Dropped();
 		}
 	}
+	ReceiveThread.join();
+	FreeVictronCiphers();
+	if (KeyFileWatch >= 0)
+		close(KeyFileWatch);
+	close(VictronEncryptionKeysEvent);
+	VictronEncryptionKeysEvent = -1;
+	close(ShutdownEvent);
+	ShutdownEvent = -1;
+	close(VictronFrameEvent);
 	GenerateLogFile(VictronVirtualLog);	// flush contents of accumulated map to logfiles
+	{
+		std::lock_guard<std::mutex> WriterLock(VictronLogWriterMutex);
+		bVictronLogWriterStop = true;
+	}
+	VictronLogWriterWake.notify_one();
+	LogWriterThread.join();
 	std::signal(SIGHUP, previousHandlerSIGHUP);	// Restore original Hangup signal handler
 	std::signal(SIGINT, previousHandlerSIGINT);	// Restore original Ctrl-C signal handler
 	if (ConsoleVerbosity > 0)